@@ -20,6 +20,35 @@ typedef struct {
 	int LastUse;
 }cache_entry;
 
+//Data Structure for an entry in the compressed tier, the frame follows the
+//header (len == 1024 means the frame did not compress and is stored raw)
+typedef struct ctier_entry {
+	struct ctier_entry *prev;	//more recently used
+	struct ctier_entry *next;	//less recently used
+	CartridgeIndex cart;
+	CartFrameIndex frm;
+	uint16_t len;
+	char data[];
+}ctier_entry;
+
+//A slot in the victim tier file
+typedef struct {
+	uint32_t key;				//cart*CART_CARTRIDGE_SIZE + frame
+	char used;
+	char referenced;			//hit since the CLOCK hand last passed
+}dtier_slot;
+
+//Reference LRU of the cache for the property test and the benchmark: a list
+//over every key of the trace, most recently used first, the first capacity
+//of which are resident
+typedef struct {
+	uint32_t capacity;			//frames the cache holds
+	uint32_t count;				//keys resident
+	uint32_t head, tail;		//most and least recently used resident key
+	uint32_t *prev, *next;		//the list, UINT32_MAX at the ends
+	char *resident;
+}cache_model;
+
 
 
 
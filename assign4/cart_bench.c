@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_bench.c
+//  Description    : This is the frame cache benchmark.  It checks the cache
+//                   against the reference LRU with the property tests, then
+//                   times fills, hits, misses and evictions at a few sizes
+//                   and compares hit ratios with the model.  It needs no
+//                   server or workload.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/19/26
+//
+
+// Include Files
+#include <stdio.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cart_cache.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_BENCH_ARGUMENTS "hvPl:"
+#define USAGE \
+	"USAGE: cart_bench [-h] [-v] [-P] [-l <logfile>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -P - run the property tests only, no timing\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"\n"
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the cache benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if the cache agrees with the model, -1 if not
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, log_initialized = 0, property_only = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_BENCH_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			enableLogLevels(LOG_INFO_LEVEL);
+			break;
+
+		case 'P': // Property tests only
+			property_only = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+
+	// Check the cache is exact LRU before timing it
+	if ( cartCachePropertyTest() != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "Cache property test failed, aborting." );
+		return( -1 );
+	}
+	return( property_only ? 0 : cartCacheBenchmark() );
+}
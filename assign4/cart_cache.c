@@ -2,27 +2,352 @@
 //
 //  File           : cart_cache.c
 //  Description    : This is the implementation of the cache for the CART
-//                   driver.
+//                   driver.  Frames evicted from the (raw) cache can drop into
+//                   an optional compressed tier, which holds many more frames
+//                   in the same memory since the data is mostly text.  Below
+//                   both sits an optional victim tier in a local file, which
+//                   catches frames the memory tiers drop.
 //
 //  Author         : Edward Bagdon
-//  Last Modified  : 11/18/16
+//  Last Modified  : 10/18/26
 //
 
 // Includes
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
 // Project includes
 #include <cache_support.h>
+#include <cart_network.h>
+#include <cart_cache.h>
 #include <cmpsc311_log.h>
+#include <cart_log.h>
+#include <cart_timeline.h>
 #include <cmpsc311_util.h>
 // Defines
-#define CART_FRAME_SIZE 1024
+#define CTIER_SLOTS (CART_MAX_SERVERS*CART_MAX_CARTRIDGES*CART_CARTRIDGE_SIZE)
+#define DTIER_TEMPLATE "/tmp/cart_victimXXXXXX"
+#define CACHE_DEMOTED (1<<30)				//age of a frame demoted to be the next evicted
+#define CACHE_PROPERTY_OPS 20000			//operations in each property test trace
+#define CACHE_BENCH_UNIVERSE 16384			//keys the benchmark traces draw from
+#define CACHE_BENCH_WORK (1<<26)			//entries scanned in a timed phase, about
+#define CACHE_BENCH_MAX_OPS (1<<20)
+#define CACHE_BENCH_ZIPF 0.99
 //Global Variables
 uint32_t maxFrames;
 cache_entry **cacheEntries;
 
+//Compressed tier
+uint32_t ctierBudget;			//bytes the tier may use (entries and data)
+uint32_t ctierUsed;				//bytes the tier is using
+ctier_entry **ctierIndex;		//entry for each cart/frame, NULL if not held
+ctier_entry *ctierHead;			//most recently used
+ctier_entry *ctierTail;			//least recently used
+z_stream ctierDeflate, ctierInflate;
+int ctierHits, ctierFrames, ctierEvicted;
+uint64_t ctierRawBytes, ctierPackedBytes;		//totals over every frame compressed
+uint64_t ctierPackNanos, ctierUnpackNanos;		//time spent in the codec
+int ctierPacks, ctierUnpacks;
+
+//Victim tier on local disk, a fixed array of frame slots replaced by CLOCK
+uint32_t dtierSlots;			//frames the file may hold, 0 disables the tier
+int dtierFd = -1;
+uint32_t *dtierIndex;			//slot+1 for each cart/frame, 0 if not held
+dtier_slot *dtierSlot;			//what each slot holds
+uint32_t dtierHand;				//the CLOCK hand
+int dtierHits, dtierSpills, dtierEvicted, dtierFrames;
+uint64_t dtierReadNanos, dtierWriteNanos;
+
 // Functions
 
+static void ctier_evict(void);
+static void *cache_find(CartridgeIndex cart, CartFrameIndex frm);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ctier_nanos
+// Description  : Read the monotonic clock, for timing the codec
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+static uint64_t ctier_nanos(void) {
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return((uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dtier_put
+// Description  : Spill a frame to the victim tier file, replacing a slot
+//                that has not been used since the hand last passed it
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+//                buf - the frame
+// Outputs      : none
+
+static void dtier_put(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+uint32_t key = cart*CART_CARTRIDGE_SIZE + frm, slot;
+uint64_t start;
+
+if(dtierFd == -1)
+	return;
+if(dtierIndex[key] != 0){				//already there and still current
+	dtierSlot[dtierIndex[key] - 1].referenced = 1;
+	return;
+}
+
+while(dtierSlot[dtierHand].used && dtierSlot[dtierHand].referenced){
+	dtierSlot[dtierHand].referenced = 0;
+	dtierHand = (dtierHand + 1) % dtierSlots;
+}
+slot = dtierHand;
+dtierHand = (dtierHand + 1) % dtierSlots;
+if(dtierSlot[slot].used){
+	dtierIndex[dtierSlot[slot].key] = 0;
+	dtierEvicted++;
+	dtierFrames--;
+}
+dtierSlot[slot].used = 1;
+dtierSlot[slot].referenced = 0;
+dtierSlot[slot].key = key;
+dtierIndex[key] = slot + 1;
+dtierFrames++;
+
+start = ctier_nanos();
+if(pwrite(dtierFd, buf, CART_FRAME_SIZE, (off_t)slot*CART_FRAME_SIZE) != CART_FRAME_SIZE){
+	logMessage(LOG_ERROR_LEVEL, "Victim cache write failed, dropping frame %d/%d", cart, frm);
+	dtierIndex[key] = 0;
+	dtierSlot[slot].used = 0;
+	dtierFrames--;
+}
+dtierWriteNanos += ctier_nanos() - start;
+dtierSpills++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dtier_get
+// Description  : Read a frame from the victim tier (if it is there).  The
+//                slot is kept, so spilling the frame again costs nothing
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+//                buf - where to put the frame
+// Outputs      : 0 if found, -1 if not
+
+static int dtier_get(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+uint32_t key = cart*CART_CARTRIDGE_SIZE + frm, slot;
+uint64_t start;
+int ret = 0;
+
+if(dtierFd == -1 || cart >= CART_MAX_SERVERS*CART_MAX_CARTRIDGES || frm >= CART_CARTRIDGE_SIZE || dtierIndex[key] == 0)
+	return(-1);
+slot = dtierIndex[key] - 1;
+start = ctier_nanos();
+if(pread(dtierFd, buf, CART_FRAME_SIZE, (off_t)slot*CART_FRAME_SIZE) != CART_FRAME_SIZE){
+	logMessage(LOG_ERROR_LEVEL, "Victim cache read of frame %d/%d failed", cart, frm);
+	ret = -1;
+}
+dtierReadNanos += ctier_nanos() - start;
+dtierSlot[slot].referenced = 1;
+return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dtier_drop
+// Description  : Forget the victim tier copy of a frame that is being
+//                rewritten
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+// Outputs      : none
+
+static void dtier_drop(CartridgeIndex cart, CartFrameIndex frm) {
+uint32_t key = cart*CART_CARTRIDGE_SIZE + frm;
+
+if(dtierFd == -1 || cart >= CART_MAX_SERVERS*CART_MAX_CARTRIDGES || frm >= CART_CARTRIDGE_SIZE || dtierIndex[key] == 0)
+	return;
+dtierSlot[dtierIndex[key] - 1].used = 0;
+dtierIndex[key] = 0;
+dtierFrames--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ctier_unlink
+// Description  : Remove an entry from the compressed tier and free it
+//
+// Inputs       : entry - the entry to remove
+// Outputs      : none
+
+static void ctier_unlink(ctier_entry *entry) {
+if(entry->prev != NULL)
+	entry->prev->next = entry->next;
+else
+	ctierHead = entry->next;
+if(entry->next != NULL)
+	entry->next->prev = entry->prev;
+else
+	ctierTail = entry->prev;
+ctierIndex[entry->cart*CART_CARTRIDGE_SIZE + entry->frm] = NULL;
+ctierUsed -= sizeof(ctier_entry) + entry->len;
+ctierFrames--;
+free(entry);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ctier_put
+// Description  : Compress a frame into the compressed tier, evicting the
+//                least recently used frames until it fits
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+//                buf - the frame
+// Outputs      : none
+
+static void ctier_put(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+char packed[CART_FRAME_SIZE];
+ctier_entry *entry;
+uint32_t len, need;
+uint64_t start = ctier_nanos();
+
+//Compress the frame, anything that doesn't shrink is kept raw
+deflateReset(&ctierDeflate);
+ctierDeflate.next_in = buf;
+ctierDeflate.avail_in = CART_FRAME_SIZE;
+ctierDeflate.next_out = (Bytef *)packed;
+ctierDeflate.avail_out = CART_FRAME_SIZE - 1;
+if(deflate(&ctierDeflate, Z_FINISH) == Z_STREAM_END){
+	len = ctierDeflate.total_out;
+}
+else{
+	len = CART_FRAME_SIZE;
+}
+ctierPackNanos += ctier_nanos() - start;
+ctierPacks++;
+ctierRawBytes += CART_FRAME_SIZE;
+ctierPackedBytes += len;
+
+need = sizeof(ctier_entry) + len;
+if(need > ctierBudget){
+	dtier_put(cart, frm, buf);
+	return;
+}
+while(ctierUsed + need > ctierBudget){
+	ctier_evict();
+}
+
+entry = malloc(need);
+entry->cart = cart;
+entry->frm = frm;
+entry->len = len;
+memcpy(entry->data, (len == CART_FRAME_SIZE) ? (char *)buf : packed, len);
+entry->prev = NULL;
+entry->next = ctierHead;
+if(ctierHead != NULL)
+	ctierHead->prev = entry;
+else
+	ctierTail = entry;
+ctierHead = entry;
+ctierIndex[cart*CART_CARTRIDGE_SIZE + frm] = entry;
+ctierUsed += need;
+ctierFrames++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ctier_take
+// Description  : Take a frame out of the compressed tier (if it is there)
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+//                buf - where to put the frame
+// Outputs      : 0 if found, -1 if not
+
+static int ctier_take(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+ctier_entry *entry;
+uint64_t start;
+int ret = 0;
+
+if(ctierIndex == NULL || cart >= CART_MAX_SERVERS*CART_MAX_CARTRIDGES || frm >= CART_CARTRIDGE_SIZE)
+	return(-1);
+if((entry = ctierIndex[cart*CART_CARTRIDGE_SIZE + frm]) == NULL)
+	return(-1);
+
+if(entry->len == CART_FRAME_SIZE){
+	memcpy(buf, entry->data, CART_FRAME_SIZE);
+}
+else{
+	start = ctier_nanos();
+	inflateReset(&ctierInflate);
+	ctierInflate.next_in = (Bytef *)entry->data;
+	ctierInflate.avail_in = entry->len;
+	ctierInflate.next_out = buf;
+	ctierInflate.avail_out = CART_FRAME_SIZE;
+	if(inflate(&ctierInflate, Z_FINISH) != Z_STREAM_END || ctierInflate.total_out != CART_FRAME_SIZE){
+		logMessage(LOG_ERROR_LEVEL, "Compressed cache frame %d/%d is corrupt", cart, frm);
+		ret = -1;
+	}
+	ctierUnpackNanos += ctier_nanos() - start;
+	ctierUnpacks++;
+}
+ctier_unlink(entry);
+return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ctier_drop
+// Description  : Forget the compressed tier copy of a frame without
+//                inflating it
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+// Outputs      : 0 if found, -1 if not
+
+static int ctier_drop(CartridgeIndex cart, CartFrameIndex frm) {
+ctier_entry *entry;
+
+if(ctierIndex == NULL || cart >= CART_MAX_SERVERS*CART_MAX_CARTRIDGES || frm >= CART_CARTRIDGE_SIZE)
+	return(-1);
+if((entry = ctierIndex[cart*CART_CARTRIDGE_SIZE + frm]) == NULL)
+	return(-1);
+ctier_unlink(entry);
+return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ctier_evict
+// Description  : Drop the least recently used frame from the compressed
+//                tier, spilling it to the victim tier if there is one
+//
+// Inputs       : none
+// Outputs      : none
+
+static void ctier_evict(void) {
+char framebuf[CART_FRAME_SIZE];
+CartridgeIndex cart = ctierTail->cart;
+CartFrameIndex frm = ctierTail->frm;
+
+if(dtierFd != -1){
+	if(ctier_take(cart, frm, framebuf) == 0)
+		dtier_put(cart, frm, framebuf);
+}
+else
+	ctier_unlink(ctierTail);
+ctierEvicted++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : set_cart_cache_size
@@ -36,6 +361,34 @@ maxFrames = max_frames;
 return(0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_disk
+// Description  : Set the size of the victim tier file (must be called before
+//                init)
+//
+// Inputs       : frames - the frames the file may hold, 0 to disable it
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_disk(uint32_t frames) {
+dtierSlots = frames;
+return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_ctier
+// Description  : Set the memory budget of the compressed tier (must be
+//                called before init)
+//
+// Inputs       : bytes - the bytes the tier may use, 0 to disable it
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_ctier(uint32_t bytes) {
+ctierBudget = bytes;
+return(0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : init_cart_cache
@@ -46,6 +399,39 @@ return(0);
 
 int init_cart_cache(void) {
 cacheEntries = calloc(maxFrames,sizeof(void *));
+
+//The compressed tier only holds frames the raw cache evicts
+ctierIndex = NULL;
+ctierHead = ctierTail = NULL;
+ctierUsed = 0;
+ctierHits = ctierFrames = ctierEvicted = ctierPacks = ctierUnpacks = 0;
+ctierRawBytes = ctierPackedBytes = ctierPackNanos = ctierUnpackNanos = 0;
+if(ctierBudget > 0 && maxFrames > 0){
+	memset(&ctierDeflate, 0x0, sizeof(ctierDeflate));
+	memset(&ctierInflate, 0x0, sizeof(ctierInflate));
+	if(deflateInit2(&ctierDeflate, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK ||
+			inflateInit2(&ctierInflate, -MAX_WBITS) != Z_OK){
+		logMessage(LOG_ERROR_LEVEL, "Compressed cache tier setup failed");
+		return(-1);
+	}
+	ctierIndex = calloc(CTIER_SLOTS, sizeof(ctier_entry *));
+}
+
+//The victim file is unlinked straight away, it goes when we do
+dtierFd = -1;
+dtierHand = 0;
+dtierHits = dtierSpills = dtierEvicted = dtierFrames = 0;
+dtierReadNanos = dtierWriteNanos = 0;
+if(dtierSlots > 0 && maxFrames > 0){
+	char path[] = DTIER_TEMPLATE;
+	if((dtierFd = mkstemp(path)) == -1){
+		logMessage(LOG_ERROR_LEVEL, "Victim cache file setup failed");
+		return(-1);
+	}
+	unlink(path);
+	dtierIndex = calloc(CTIER_SLOTS, sizeof(uint32_t));
+	dtierSlot = calloc(dtierSlots, sizeof(dtier_slot));
+}
 return(0);
 }
 
@@ -63,20 +449,36 @@ for(i=0;i<maxFrames;i++){
 	free(cacheEntries[i]);
 }
 free(cacheEntries);
+if(ctierIndex != NULL){
+	while(ctierTail != NULL){
+		ctier_unlink(ctierTail);
+	}
+	free(ctierIndex);
+	ctierIndex = NULL;
+	deflateEnd(&ctierDeflate);
+	inflateEnd(&ctierInflate);
+}
+if(dtierFd != -1){
+	close(dtierFd);
+	dtierFd = -1;
+	free(dtierIndex);
+	free(dtierSlot);
+}
 return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : put_cart_cache
-// Description  : Put an object into the frame cache
+// Function     : cache_insert
+// Description  : Place a frame in the cache, demoting the least recently
+//                used frame if the cache is full
 //
 // Inputs       : cart - the cartridge number of the frame to cache
 //                frm - the frame number of the frame to cache
 //                buf - the buffer to insert into the cache
-// Outputs      : 0 if successful, -1 if failure
+// Outputs      : none
 
-int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf)  {
+static void cache_insert(CartridgeIndex cart, CartFrameIndex frm, void *buf)  {
 cache_entry *putCache;	
 putCache = malloc(sizeof(cache_entry));
 putCache -> cart = cart;
@@ -85,28 +487,57 @@ putCache -> LastUse = 0;
 memcpy(putCache -> framebuf, buf, CART_FRAME_SIZE);
 int i=0;
 int j=0;
-int LRU=0;
+int LRU=-1;
+int slot=-1;
 
-while(cacheEntries[i] != NULL && i< maxFrames){
+//Every other entry ages, as on a lookup, so the oldest is the least recently used
+while(i< maxFrames && cacheEntries[i] != NULL){
 	if(cacheEntries[i]->frm == frm && cacheEntries[i]-> cart == cart ){	//if the frame is already in the cache replace it
-		break;
+		slot = i;
 	}
-	if(cacheEntries[i]-> LastUse > LRU){								//find the least recently used
+	else if(++cacheEntries[i]-> LastUse > LRU){						//find the least recently used
 		LRU = cacheEntries[i]-> LastUse;
 		j = i;
 	}
 	i++;																
 }
-if(i == maxFrames){			//If the cache is full, replace the LRU frame
+if(slot == -1 && i < maxFrames){	//If the cache is not full, place the frame in the next available entry
+	slot = i;
+}
+if(slot == -1){				//If the cache is full, replace the LRU frame
+	if(ctierIndex != NULL)	//demoting it to the compressed tier
+		ctier_put(cacheEntries[j]->cart, cacheEntries[j]->frm, cacheEntries[j]->framebuf);
+	else					//or the victim tier
+		dtier_put(cacheEntries[j]->cart, cacheEntries[j]->frm, cacheEntries[j]->framebuf);
 	free(cacheEntries[j]);
 	cacheEntries[j] = putCache;
 }
-else {						//If the cache is not full, place the frame in the next available entry
-	free(cacheEntries[i]);
-	cacheEntries[i] = putCache;
+else {
+	free(cacheEntries[slot]);
+	cacheEntries[slot] = putCache;
+}
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_cart_cache
+// Description  : Put an object into the frame cache
+//
+// Inputs       : cart - the cartridge number of the frame to cache
+//                frm - the frame number of the frame to cache
+//                buf - the buffer to insert into the cache
+// Outputs      : 0 if successful, -1 if failure
 
+int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf)  {
+uint64_t span = CART_TIMELINE_BEGIN();
+if(maxFrames == 0)			//No cache
+	return(0);
+
+//Any compressed or spilled copy is now out of date
+ctier_drop(cart, frm);
+dtier_drop(cart, frm);
+cache_insert(cart, frm, buf);
+CART_TIMELINE_END("cache", "put", cart_timeline_track(), span, "cart,frame", cart, frm, 0);
 return(0);
 
 }
@@ -114,16 +545,144 @@ return(0);
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : get_cart_cache
-// Description  : Get an frame from the cache (and return it)
+// Description  : Get an frame from the cache (and return it), a frame found
+//                in the compressed or victim tier is moved back into the
+//                cache.  The frame must not be changed through the pointer,
+//                use put_cart_cache
 //
 // Inputs       : cart - the cartridge number of the cartridge to find
 //                frm - the  number of the frame to find
 // Outputs      : pointer to cached frame or NULL if not found
 
 void * get_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
+	void *frameptr;
+	char framebuf[CART_FRAME_SIZE];
+	uint64_t span = CART_TIMELINE_BEGIN();
+	int tier = 1;
+
+	frameptr = cache_find(cart, frm);
+	if(frameptr == NULL && ctier_take(cart, frm, framebuf) == 0){
+		ctierHits++;
+		cache_insert(cart, frm, framebuf);
+		frameptr = cache_find(cart, frm);
+		tier = 2;
+	}
+	else if(frameptr == NULL && dtier_get(cart, frm, framebuf) == 0){
+		dtierHits++;
+		cache_insert(cart, frm, framebuf);
+		frameptr = cache_find(cart, frm);
+		tier = 3;
+	}
+
+	CART_TIMELINE_END("cache", "get", cart_timeline_track(), span, "cart,frame,tier",
+		cart, frm, (frameptr == NULL) ? 0 : tier);
+	return(frameptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : peek_cart_cache
+// Description  : Look for a frame in the cache and the tiers below it
+//                without using it: nothing is aged, moved or decompressed
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+// Outputs      : 1 if the frame is held, 0 if not
+
+int peek_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
+	uint32_t key = cart*CART_CARTRIDGE_SIZE + frm;
+	int i = 0;
+
+	while(i < maxFrames && cacheEntries[i] != NULL){
+		if(cacheEntries[i]->frm == frm && cacheEntries[i]->cart == cart)
+			return(1);
+		i++;
+	}
+	if(cart >= CART_MAX_SERVERS*CART_MAX_CARTRIDGES || frm >= CART_CARTRIDGE_SIZE)
+		return(0);
+	return((ctierIndex != NULL && ctierIndex[key] != NULL) || (dtierFd != -1 && dtierIndex[key] != 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_cart_cache
+// Description  : Remove a frame from the cache and from the compressed and
+//                victim tiers.  The last entry moves into its place, so the
+//                entries stay packed at the front
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+// Outputs      : 1 if the frame was in memory, 0 if not
+
+int drop_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
+	int i = 0, found = -1, held = 0;
+
+	while(i < maxFrames && cacheEntries[i] != NULL){
+		if(cacheEntries[i]->frm == frm && cacheEntries[i]->cart == cart)
+			found = i;
+		i++;
+	}
+	if(found != -1){
+		free(cacheEntries[found]);
+		cacheEntries[found] = cacheEntries[i-1];
+		cacheEntries[i-1] = NULL;
+		held = 1;
+	}
+	if(ctier_drop(cart, frm) == 0)
+		held = 1;
+	dtier_drop(cart, frm);
+	return(held);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : demote_cart_cache
+// Description  : Age a cached frame past every other, so it is the next
+//                evicted unless it is used again first
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+// Outputs      : 1 if the frame was cached, 0 if not
+
+int demote_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
+	int i = 0;
+
+	while(i < maxFrames && cacheEntries[i] != NULL){
+		if(cacheEntries[i]->frm == frm && cacheEntries[i]->cart == cart){
+			cacheEntries[i]->LastUse = CACHE_DEMOTED;
+			return(1);
+		}
+		i++;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_cart_cache_size
+// Description  : Report how many frames the cache holds
+//
+// Inputs       : none
+// Outputs      : the number of frames, 0 if the cache is off
+
+uint32_t get_cart_cache_size(void) {
+	return(maxFrames);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_find
+// Description  : Look for a frame in the cache (not the tiers below it),
+//                aging every other entry
+//
+// Inputs       : cart - the cartridge number of the cartridge to find
+//                frm - the  number of the frame to find
+// Outputs      : pointer to cached frame or NULL if not found
+
+static void *cache_find(CartridgeIndex cart, CartFrameIndex frm) {
 	void *frameptr = NULL;
 	int i = 0;
-	while(cacheEntries[i] != NULL && i < maxFrames){
+	while(i < maxFrames && cacheEntries[i] != NULL){
 		if (cacheEntries[i]->frm == frm && cacheEntries[i]->cart == cart){
 			cacheEntries[i] -> LastUse = 0;
 			frameptr = cacheEntries[i]->framebuf;
@@ -132,10 +691,258 @@ void * get_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
 			cacheEntries[i] -> LastUse++;
 		i++;
 	}
-
 	return(frameptr);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_cart_cache_stats
+// Description  : Log how well the compressed and victim tiers are doing
+//
+// Inputs       : none
+// Outputs      : none
+
+void log_cart_cache_stats(void) {
+	if(dtierFd != -1){
+		logMessage(LOG_OUTPUT_LEVEL, "Victim Tier Hits:%d\nVictim Tier Frames:%d of %u\n"
+			"Victim Tier Spills:%d\nVictim Tier Evictions:%d\n"
+			"Victim Read Latency:%.2f us\nVictim Write Latency:%.2f us\n",
+			dtierHits, dtierFrames, dtierSlots, dtierSpills, dtierEvicted,
+			dtierHits ? dtierReadNanos/1000.0/dtierHits : 0.0,
+			dtierSpills ? dtierWriteNanos/1000.0/dtierSpills : 0.0);
+	}
+	if(ctierIndex == NULL)
+		return;
+	logMessage(LOG_OUTPUT_LEVEL, "Compressed Tier Hits:%d\nCompressed Tier Frames:%d (%u of %u bytes)\n"
+		"Compressed Tier Evictions:%d\nCompression Ratio:%.2f\n"
+		"Compress Latency:%.2f us\nDecompress Latency:%.2f us\n",
+		ctierHits, ctierFrames, ctierUsed, ctierBudget, ctierEvicted,
+		ctierPackedBytes ? (double)ctierRawBytes/ctierPackedBytes : 0.0,
+		ctierPacks ? ctierPackNanos/1000.0/ctierPacks : 0.0,
+		ctierUnpacks ? ctierUnpackNanos/1000.0/ctierUnpacks : 0.0);
+}
+
+
+// Reference model
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_model_init
+// Description  : Set up an empty reference LRU over keys 0 to keys-1
+//
+// Inputs       : model - the model
+//                capacity - the frames the cache holds
+//                keys - the number of keys the trace uses
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_model_init(cache_model *model, uint32_t capacity, uint32_t keys) {
+	model->capacity = capacity;
+	model->count = 0;
+	model->head = model->tail = UINT32_MAX;
+	model->prev = malloc(keys*sizeof(uint32_t));
+	model->next = malloc(keys*sizeof(uint32_t));
+	model->resident = calloc(keys, 1);
+	if(model->prev == NULL || model->next == NULL || model->resident == NULL){
+		logMessage(LOG_ERROR_LEVEL, "Unable to allocate the cache model of %u keys", keys);
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_model_unlink
+// Description  : Take a resident key off the model's list
+//
+// Inputs       : model - the model
+//                key - the key
+// Outputs      : none
+
+static void cache_model_unlink(cache_model *model, uint32_t key) {
+	if(model->prev[key] == UINT32_MAX)
+		model->head = model->next[key];
+	else
+		model->next[model->prev[key]] = model->next[key];
+	if(model->next[key] == UINT32_MAX)
+		model->tail = model->prev[key];
+	else
+		model->prev[model->next[key]] = model->prev[key];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_model_front
+// Description  : Put a key at the most recently used end of the model's list
+//
+// Inputs       : model - the model
+//                key - the key
+// Outputs      : none
+
+static void cache_model_front(cache_model *model, uint32_t key) {
+	model->prev[key] = UINT32_MAX;
+	model->next[key] = model->head;
+	if(model->head != UINT32_MAX)
+		model->prev[model->head] = key;
+	else
+		model->tail = key;
+	model->head = key;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_model_get
+// Description  : Look a key up in the model, a hit makes it the most
+//                recently used and a miss changes nothing (as get_cart_cache)
+//
+// Inputs       : model - the model
+//                key - the key
+// Outputs      : 1 if the key is resident, 0 if not
+
+static int cache_model_get(cache_model *model, uint32_t key) {
+	if(!model->resident[key])
+		return(0);
+	cache_model_unlink(model, key);
+	cache_model_front(model, key);
+	return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_model_put
+// Description  : Make a key the most recently used in the model, evicting
+//                the least recently used key if the model is full
+//
+// Inputs       : model - the model
+//                key - the key
+// Outputs      : none
+
+static void cache_model_put(cache_model *model, uint32_t key) {
+	uint32_t victim;
+
+	if(model->resident[key]){
+		cache_model_unlink(model, key);
+	}
+	else{
+		if(model->capacity == 0)
+			return;
+		if(model->count == model->capacity){
+			victim = model->tail;
+			cache_model_unlink(model, victim);
+			model->resident[victim] = 0;
+			model->count--;
+		}
+		model->resident[key] = 1;
+		model->count++;
+	}
+	cache_model_front(model, key);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_model_free
+// Description  : Free the model's list
+//
+// Inputs       : model - the model
+// Outputs      : none
+
+static void cache_model_free(cache_model *model) {
+	free(model->prev);
+	free(model->next);
+	free(model->resident);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_bench_random
+// Description  : Step a xorshift generator, so traces repeat from run to run
+//
+// Inputs       : state - the generator state (not 0)
+// Outputs      : the next value
+
+static uint64_t cache_bench_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return(*state);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_bench_frame
+// Description  : Build the contents of a version of a key's frame
+//
+// Inputs       : buf - the frame to fill
+//                key - the key
+//                version - how many times the key has been put
+// Outputs      : none
+
+static void cache_bench_frame(char *buf, uint32_t key, uint32_t version) {
+	int i;
+	memcpy(buf, &key, sizeof(key));
+	memcpy(buf + sizeof(key), &version, sizeof(version));
+	for(i = sizeof(key) + sizeof(version); i < CART_FRAME_SIZE; i++)
+		buf[i] = (char)(key*31 + version*7 + i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_property_test
+// Description  : Run a random trace of puts and gets against the cache and
+//                the reference LRU.  With no tiers the cache must hit exactly
+//                when the model does; with a tier below it the cache must hit
+//                at least when the model does.  Every hit must return the last
+//                frame put for the key
+//
+// Inputs       : capacity - the frames the cache holds
+//                tier - 0 for none, 1 for the compressed tier, 2 for the victim file
+//                seed - the trace generator seed (not 0)
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_property_test(uint32_t capacity, int tier, uint64_t seed) {
+	uint32_t keys = 4*capacity + 8, key, *version, i;
+	char frame[CART_FRAME_SIZE], *membuf;
+	cache_model model;
+	int hit, ret = 0;
+
+	set_cart_cache_size(capacity);
+	set_cart_cache_ctier((tier == 1) ? keys*(sizeof(ctier_entry) + CART_FRAME_SIZE) : 0);
+	set_cart_cache_disk((tier == 2) ? keys : 0);
+	version = calloc(keys, sizeof(uint32_t));
+	if(version == NULL || cache_model_init(&model, capacity, keys) == -1 || init_cart_cache() == -1){
+		logMessage(LOG_ERROR_LEVEL, "Cache property test: setup failed");
+		return(-1);
+	}
+	for(i = 0; i < CACHE_PROPERTY_OPS && ret == 0; i++){
+		key = cache_bench_random(&seed) % keys;
+		if(cache_bench_random(&seed) % 3 == 0){
+			cache_bench_frame(frame, key, ++version[key]);
+			put_cart_cache(key / CART_CARTRIDGE_SIZE, key % CART_CARTRIDGE_SIZE, frame);
+			cache_model_put(&model, key);
+			continue;
+		}
+		membuf = get_cart_cache(key / CART_CARTRIDGE_SIZE, key % CART_CARTRIDGE_SIZE);
+		hit = cache_model_get(&model, key);
+		if((membuf == NULL && hit) || (membuf != NULL && !hit && tier == 0)){
+			logMessage(LOG_ERROR_LEVEL, "Cache property test: %u frames tier %d op %u key %u %s but LRU %s",
+				capacity, tier, i, key, membuf ? "hit" : "missed", hit ? "hits" : "misses");
+			ret = -1;
+		}
+		else if(membuf != NULL){
+			cache_bench_frame(frame, key, version[key]);
+			if(version[key] == 0 || memcmp(membuf, frame, CART_FRAME_SIZE) != 0){
+				logMessage(LOG_ERROR_LEVEL, "Cache property test: %u frames tier %d op %u key %u returned stale data",
+					capacity, tier, i, key);
+				ret = -1;
+			}
+		}
+	}
+	close_cart_cache();
+	cache_model_free(&model);
+	free(version);
+	set_cart_cache_ctier(0);
+	set_cart_cache_disk(0);
+	return(ret);
+}
 
 // Unit test
 
@@ -167,10 +974,278 @@ int cartCacheUnitTest(void) {
 	}
 char* membuf;
 		membuf = get_cart_cache(cart1, frm1);
+	if(membuf == NULL){
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test: last frame put is missing");
+		return(-1);
+	}
+	close_cart_cache();
+
+	//Text frames pushed out of a small cache must come back intact from the
+	//compressed tier
+	char text[64][CART_FRAME_SIZE];
+	set_cart_cache_size(8);
+	set_cart_cache_ctier(64*CART_FRAME_SIZE);
+	init_cart_cache();
+	for(i=0;i<64;i++){
+		int j;
+		for(j=0;j<CART_FRAME_SIZE;j++)
+			text[i][j] = "the quick brown fox jumps over the lazy dog\n"[(i+j)%44];
+		put_cart_cache(1, i, text[i]);
+	}
+	for(i=0;i<64;i++){
+		membuf = get_cart_cache(1, i);
+		if(membuf == NULL || memcmp(membuf, text[i], CART_FRAME_SIZE) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test: frame %d lost in the compressed tier", i);
+			return(-1);
+		}
+	}
+	log_cart_cache_stats();
+	close_cart_cache();
+	set_cart_cache_ctier(0);
+
+	//Random frames pushed out of a small cache must come back from the
+	//victim file
+	set_cart_cache_size(4);
+	set_cart_cache_disk(32);
+	init_cart_cache();
+	for(i=0;i<32;i++){
+		getRandomData(text[i], CART_FRAME_SIZE);
+		put_cart_cache(2, i, text[i]);
+	}
+	for(i=0;i<32;i++){
+		membuf = get_cart_cache(2, i);
+		if(membuf == NULL || memcmp(membuf, text[i], CART_FRAME_SIZE) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Cache unit test: frame %d lost in the victim tier", i);
+			return(-1);
+		}
+	}
+	log_cart_cache_stats();
+	close_cart_cache();
+	set_cart_cache_disk(0);
+
+	//A demoted frame goes next, a dropped one is gone from every tier
+	set_cart_cache_size(4);
+	set_cart_cache_ctier(8*CART_FRAME_SIZE);
+	init_cart_cache();
+	for(i=0;i<4;i++)
+		put_cart_cache(3, i, text[i]);
+	demote_cart_cache(3, 0);
+	put_cart_cache(3, 4, text[4]);
+	drop_cart_cache(3, 1);
+	if(cache_find(3, 0) != NULL || cache_find(3, 2) == NULL || get_cart_cache(3, 1) != NULL ||
+			get_cart_cache(3, 0) == NULL){
+		logMessage(LOG_ERROR_LEVEL, "Cache unit test: demoted or dropped frame mishandled");
+		return(-1);
+	}
+	close_cart_cache();
+	set_cart_cache_ctier(0);
 
-	
+	if(cartCachePropertyTest() != 0)
+		return(-1);
 
 	// Return successfully
 	logMessage(LOG_OUTPUT_LEVEL, "Cache unit test completed successfully.");
 	return(0);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartCachePropertyTest
+// Description  : Check random puts and gets agree with the reference LRU,
+//                at a few sizes and with each tier below the cache
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cartCachePropertyTest(void) {
+	uint32_t sizes[] = { 1, 2, 7, 64 };
+	int i, tier;
+
+	for(i=0;i<4;i++){
+		for(tier=0;tier<3;tier++){
+			if(cache_property_test(sizes[i], tier, 0x9E3779B97F4A7C15ULL + i*3 + tier) != 0)
+				return(-1);
+		}
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "Cache property test: %d traces agree with the reference LRU", 4*3);
+	return(0);
+}
+
+// Benchmark
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_bench_trace
+// Description  : Fill a trace with keys from one of the benchmark
+//                distributions: uniform, zipf, hotspot (90% of the accesses
+//                to 10% of the keys) and a loop a half again the cache size
+//
+// Inputs       : trace - the keys to fill
+//                ops - the length of the trace
+//                dist - the distribution (0 to 3)
+//                frames - the cache size
+//                cdf - the zipf distribution over the keys
+//                seed - the generator state
+// Outputs      : none
+
+static void cache_bench_trace(uint32_t *trace, uint32_t ops, int dist, uint32_t frames, double *cdf, uint64_t *seed) {
+	uint32_t i, lo, hi, mid;
+	double u;
+
+	for(i = 0; i < ops; i++){
+		uint64_t r = cache_bench_random(seed);
+		switch(dist){
+		case 0:
+			trace[i] = r % CACHE_BENCH_UNIVERSE;
+			break;
+		case 1:
+			u = (r >> 11) * (1.0/9007199254740992.0);
+			lo = 0;
+			hi = CACHE_BENCH_UNIVERSE - 1;
+			while(lo < hi){
+				mid = (lo + hi)/2;
+				if(cdf[mid] < u)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			trace[i] = lo;
+			break;
+		case 2:
+			if(r % 10 < 9)
+				trace[i] = (r >> 8) % (CACHE_BENCH_UNIVERSE/10);
+			else
+				trace[i] = CACHE_BENCH_UNIVERSE/10 + (r >> 8) % (CACHE_BENCH_UNIVERSE - CACHE_BENCH_UNIVERSE/10);
+			break;
+		default:
+			trace[i] = i % (frames + frames/2);
+			break;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartCacheBenchmark
+// Description  : Time the raw cache at a few sizes: filling it, hits, misses
+//                and puts that evict, in ns per operation.  Then replay
+//                traces of each distribution (a get, and a put on a miss)
+//                and compare the hit ratio with the reference LRU's.  The
+//                tiers are off while it runs and the cache size is put back
+//
+// Inputs       : none
+// Outputs      : 0 if every hit ratio matches the model, -1 if not
+
+int cartCacheBenchmark(void) {
+	static const char *dists[] = { "uniform", "zipf", "hotspot", "loop" };
+	uint32_t sizes[] = { 64, 256, 1024, 4096 };
+	uint32_t saveFrames = maxFrames, saveCtier = ctierBudget, saveDisk = dtierSlots;
+	uint32_t ops, mixed, frames, key, i, hits, modelHits;
+	uint64_t seed = 0x2545F4914F6CDD1DULL, start, elapsed;
+	double fill, hit, miss, evict, *cdf, sum;
+	char frame[CART_FRAME_SIZE];
+	uint32_t *trace;
+	cache_model model;
+	int s, d, ret = 0;
+
+	cdf = malloc(CACHE_BENCH_UNIVERSE*sizeof(double));
+	trace = malloc((CACHE_BENCH_MAX_OPS > 4*CACHE_BENCH_UNIVERSE ? CACHE_BENCH_MAX_OPS : 4*CACHE_BENCH_UNIVERSE)*sizeof(uint32_t));
+	if(cdf == NULL || trace == NULL){
+		logMessage(LOG_ERROR_LEVEL, "Unable to allocate the cache benchmark traces");
+		return(-1);
+	}
+	for(i = 0, sum = 0; i < CACHE_BENCH_UNIVERSE; i++)
+		cdf[i] = (sum += 1.0/pow(i + 1, CACHE_BENCH_ZIPF));
+	for(i = 0; i < CACHE_BENCH_UNIVERSE; i++)
+		cdf[i] /= sum;
+	set_cart_cache_ctier(0);
+	set_cart_cache_disk(0);
+	memset(frame, 0x5a, CART_FRAME_SIZE);
+
+	for(s = 0; s < 4; s++){
+		frames = sizes[s];
+		ops = CACHE_BENCH_WORK/frames;
+		if(ops > CACHE_BENCH_MAX_OPS)
+			ops = CACHE_BENCH_MAX_OPS;
+		set_cart_cache_size(frames);
+		init_cart_cache();
+
+		//Fill it, then hit on the keys held and miss on the rest
+		start = ctier_nanos();
+		for(key = 0; key < frames; key++)
+			put_cart_cache(key / CART_CARTRIDGE_SIZE, key % CART_CARTRIDGE_SIZE, frame);
+		fill = (double)(ctier_nanos() - start)/frames;
+		for(i = 0; i < ops; i++)
+			trace[i] = cache_bench_random(&seed) % frames;
+		start = ctier_nanos();
+		for(i = 0; i < ops; i++){
+			if(get_cart_cache(trace[i] / CART_CARTRIDGE_SIZE, trace[i] % CART_CARTRIDGE_SIZE) == NULL)
+				ret = -1;
+		}
+		hit = (double)(ctier_nanos() - start)/ops;
+		for(i = 0; i < ops; i++)
+			trace[i] = frames + cache_bench_random(&seed) % (CACHE_BENCH_UNIVERSE - frames);
+		start = ctier_nanos();
+		for(i = 0; i < ops; i++){
+			if(get_cart_cache(trace[i] / CART_CARTRIDGE_SIZE, trace[i] % CART_CARTRIDGE_SIZE) != NULL)
+				ret = -1;
+		}
+		miss = (double)(ctier_nanos() - start)/ops;
+
+		//A loop over more keys than it holds evicts on every put
+		start = ctier_nanos();
+		for(i = 0; i < ops; i++){
+			key = (frames + i) % CACHE_BENCH_UNIVERSE;
+			put_cart_cache(key / CART_CARTRIDGE_SIZE, key % CART_CARTRIDGE_SIZE, frame);
+		}
+		evict = (double)(ctier_nanos() - start)/ops;
+		close_cart_cache();
+		logMessage(LOG_OUTPUT_LEVEL, "Cache Benchmark %u frames: fill %.1f ns/op, hit %.1f ns/op, miss %.1f ns/op, evict %.1f ns/op",
+			frames, fill, hit, miss, evict);
+		if(ret != 0){
+			logMessage(LOG_ERROR_LEVEL, "Cache benchmark: a held frame missed or a new one hit at %u frames", frames);
+			break;
+		}
+
+		//Each distribution from empty, against the model
+		mixed = (ops > 4*CACHE_BENCH_UNIVERSE) ? ops : 4*CACHE_BENCH_UNIVERSE;
+		for(d = 0; d < 4; d++){
+			cache_bench_trace(trace, mixed, d, frames, cdf, &seed);
+			init_cart_cache();
+			hits = 0;
+			start = ctier_nanos();
+			for(i = 0; i < mixed; i++){
+				if(get_cart_cache(trace[i] / CART_CARTRIDGE_SIZE, trace[i] % CART_CARTRIDGE_SIZE) != NULL)
+					hits++;
+				else
+					put_cart_cache(trace[i] / CART_CARTRIDGE_SIZE, trace[i] % CART_CARTRIDGE_SIZE, frame);
+			}
+			elapsed = ctier_nanos() - start;
+			close_cart_cache();
+			if(cache_model_init(&model, frames, CACHE_BENCH_UNIVERSE) == -1){
+				ret = -1;
+				break;
+			}
+			for(i = 0, modelHits = 0; i < mixed; i++){
+				if(cache_model_get(&model, trace[i]))
+					modelHits++;
+				else
+					cache_model_put(&model, trace[i]);
+			}
+			cache_model_free(&model);
+			logMessage(LOG_OUTPUT_LEVEL, "Cache Benchmark %u frames %s: hit ratio %.4f (LRU %.4f), %.1f ns/op",
+				frames, dists[d], (double)hits/mixed, (double)modelHits/mixed, (double)elapsed/mixed);
+			if(hits != modelHits){
+				logMessage(LOG_ERROR_LEVEL, "Cache benchmark: %u hits where LRU has %u", hits, modelHits);
+				ret = -1;
+			}
+		}
+	}
+
+	free(cdf);
+	free(trace);
+	set_cart_cache_size(saveFrames);
+	set_cart_cache_ctier(saveCtier);
+	set_cart_cache_disk(saveDisk);
+	return(ret);
+}
@@ -23,6 +23,12 @@
 int set_cart_cache_size(uint32_t max_frames);
 	// Set the size of the cache (must be called before init)
 
+int set_cart_cache_ctier(uint32_t bytes);
+	// Set the memory budget of the compressed tier, 0 disables it (before init)
+
+int set_cart_cache_disk(uint32_t frames);
+	// Set the frames the local victim file may hold, 0 disables it (before init)
+
 int init_cart_cache(void);
 	// Initialize the cache 
 
@@ -35,10 +41,31 @@ int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *frame);
 void * get_cart_cache(CartridgeIndex dsk, CartFrameIndex blk);
 	// Get an object from the cache (and return it)
 
+int peek_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Is a frame held in the cache or a tier below it (without using it)
+
+int drop_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Remove a frame from the cache and the tiers below it
+
+int demote_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Make a cached frame the next to be evicted
+
+uint32_t get_cart_cache_size(void);
+	// The number of frames the cache holds, 0 if it is off
+
+void log_cart_cache_stats(void);
+	// Log the compressed and victim tier statistics
+
 //
 // Unit test
 
 int cartCacheUnitTest(void);
 	// Run a UNIT test checking the cache implementation
 
+int cartCachePropertyTest(void);
+	// Check random puts and gets against the reference LRU
+
+int cartCacheBenchmark(void);
+	// Time hits, misses and evictions and the hit ratio of a few key distributions
+
 #endif
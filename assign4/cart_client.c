@@ -8,24 +8,36 @@
 //
 
 // Include Files
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdint.h>
 #include <cmpsc311_util.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 
 // Project Include Files
 #include <cart_network.h>
 #include <cart_controller.h>
 #include <cmpsc311_log.h>
+#include <cart_log.h>
 #include <cart_support.h>
+#include <cart_shm.h>
 //
 //  Global data
-int client_socket = -1;
+int client_socket[CART_MAX_LANES] = { [0 ... CART_MAX_LANES-1] = -1 };	// The connections, cart_network_connections to each server
+CartShmSegment *client_shm = NULL;	// Shared memory segment, when not using TCP
+int client_shm_lost = 0;		// A response timed out, a late one may still arrive
+int                cart_network_shm = 0;        // Use shared memory, not TCP
+int                cart_network_servers = 1;    // Servers the frames are striped over
+int                cart_network_connections = 1; // Connections to each server
 int                cart_network_shutdown = 0;   // Flag indicating shutdown
 unsigned char     *cart_network_address = NULL; // Address of CART server
 unsigned short     cart_network_port = 0;       // Port of CART serve
@@ -33,8 +45,6 @@ unsigned long      CartControllerLLevel = 0; // Controller log level (global)
 unsigned long      CartDriverLLevel = 0;     // Driver log level (global)
 unsigned long      CartSimulatorLLevel = LOG_INFO_LEVEL;  // Driver log level (global)
 
-struct sockaddr_in cart_sock;
-
 
 //
 // Functions
@@ -42,13 +52,15 @@ int16_t extract_cart_opcode(CartXferRegister resp, char *KY1, char *KY2, char *R
 //
 int16_t client_test(void);
 //
-CartXferRegister client_read(CartXferRegister reg, void* buf);
+int client_connect(int conn);
 //
-CartXferRegister client_write(CartXferRegister reg, void *buf);
+void client_payload(CartXferRegister reg, size_t *outlen, size_t *inlen);
 //
-CartXferRegister client_poweroff(CartXferRegister reg);
+int client_send_all(int sock, CartXferRegister reg, void *out, size_t outlen);
 //
-CartXferRegister client_op(CartXferRegister reg);
+int client_recv_all(int sock, void *buf, size_t len);
+//
+void client_disconnect(int conn);
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -66,110 +78,299 @@ CartXferRegister client_op(CartXferRegister reg);
 
 CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf) {
 
-char KY1, KY2, RT;
-uint16_t CT1, FM1;
-CartXferRegister resp;
+if(client_cart_bus_send(0, reg, buf) != 0){
+	return(-1);
+}
+return(client_cart_bus_recv(0, reg, buf));
+}
 
-extract_cart_opcode(reg, &KY1, &KY2, &RT, &CT1, &FM1);
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_send
+// Description  : Send a request (and any outgoing frames) on one of the
+//                connections, connecting first if needed, without waiting
+//                for the response.  Sending on several connections before
+//                receiving lets them work in parallel
+//
+// Inputs       : conn - the connection (0 .. servers*connections-1)
+//                reg - the request register
+//                buf - the frame(s) or payload to send, or to read into later
+// Outputs      : 0 if successful, -1 if failure
 
-if(client_socket == -1){
-	
-	//Get Address
-	cart_sock.sin_family = AF_INET;
-	cart_sock.sin_port = htons(CART_DEFAULT_PORT);
-	if ( inet_aton(CART_DEFAULT_IP, &cart_sock.sin_addr) == 0 ) {
-		return( -1 );
-		}
-	//Create Socket
-	client_socket = socket(PF_INET, SOCK_STREAM, 0);
-	if (client_socket == -1) {
-		return( -1 );
-		}	
-	//Open Connection
-	if ( connect(client_socket, (const struct sockaddr *)&cart_sock, sizeof(cart_sock)) == -1 ) {
-		return( -1 );
-		}
+int client_cart_bus_send(int conn, CartXferRegister reg, void *buf) {
+
+size_t outlen, inlen;
+
+if(conn < 0 || conn >= CART_MAX_LANES || ((reg & KY1_MASK) >> 56) >= CART_OP_MAXVAL){
+	return(-1);
+}
+if(client_connect(conn) != 0){
+	return(-1);
+}
+client_payload(reg, &outlen, &inlen);
+
+if(client_shm != NULL){
+	//A late response would be taken as the answer to this request
+	if(client_shm_lost){
+		logMessage(LOG_ERROR_LEVEL, "Shared memory segment unusable after a lost response");
+		return(-1);
 	}
-	if(KY1 >= CART_OP_MAXVAL){
+	if(outlen > CART_SHM_SLAB_SIZE || inlen > CART_SHM_SLAB_SIZE){
 		return(-1);
 	}
-	if(KY1 == CART_OP_WRFRME){
-		resp = client_write(reg, buf);
+	if(outlen > 0){
+		memcpy(client_shm->slab, buf, outlen);
 	}
-	if(KY1 == CART_OP_RDFRME){
-		resp = client_read(reg, buf);
+	cart_shm_push(&client_shm->request, reg);
+	return(0);
+}
+return(client_send_all(client_socket[conn], reg, buf, outlen));
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_recv
+// Description  : Receive the response to the oldest request sent on a
+//                connection, and any frames it returns.  A POWOFF response
+//                closes the connection
+//
+// Inputs       : conn - the connection
+//                reg - the request register that was sent
+//                buf - where to put returned frames
+// Outputs      : the response register (host order), -1 on failure
+
+CartXferRegister client_cart_bus_recv(int conn, CartXferRegister reg, void *buf) {
+
+CartXferRegister resp;
+size_t outlen, inlen;
+
+client_payload(reg, &outlen, &inlen);
+if(client_shm != NULL){
+	//Give a server that has gone away a few seconds before failing
+	if(client_shm_lost || cart_shm_pop(&client_shm->response, &resp, CART_SHM_CLIENT_WAITS) != 0){
+		logMessage(LOG_ERROR_LEVEL, "No response from the shared memory server");
+		client_shm_lost = 1;
+		return(-1);
+	}
+	if(inlen > 0 && (resp & RT_MASK) == 0){
+		memcpy(buf, client_shm->slab, inlen);
 	}
-	if(KY1 == CART_OP_POWOFF){
-		resp = client_poweroff(reg);
+}
+else{
+	if(client_socket[conn] == -1 || client_recv_all(client_socket[conn], &resp, sizeof(resp)) != 0){
+		return(-1);
 	}
-	else{
-		resp = client_op(reg);
+	resp = ntohll64(resp);
+	if(inlen > 0 && (resp & RT_MASK) == 0 && client_recv_all(client_socket[conn], buf, inlen) != 0){
+		return(-1);
 	}
+}
 
-	return resp;
+if(((reg & KY1_MASK) >> 56) == CART_OP_POWOFF){
+	client_disconnect(conn);
 }
+return(resp);
+}
+////////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_wait
+// Description  : Wait for one of the connections to start answering
+//
+// Inputs       : conns - the connections with requests outstanding
+//                count - the number of connections
+//                timeout - how long to wait (usec), -1 for no limit
+// Outputs      : the connection with a response waiting, -1 on timeout
+
+int client_cart_bus_wait(int *conns, int count, int64_t timeout) {
 
+struct pollfd fds[CART_MAX_LANES];
+struct timespec wait = { timeout / 1000000, (timeout % 1000000) * 1000 };
+int i;
+
+for(i = 0; i < count; i++){
+	fds[i].fd = client_socket[conns[i]];
+	fds[i].events = POLLIN;
+	fds[i].revents = 0;
+}
+if(ppoll(fds, count, (timeout < 0) ? NULL : &wait, NULL) <= 0){
+	return(-1);
+}
+for(i = 0; i < count; i++){
+	if(fds[i].revents != 0){
+		return(conns[i]);
+	}
+}
+return(-1);
+}
 ////////////////////////////////////////////////////////////////////////////////////
 int16_t client_test(void){
 
 return(0);
 }
 ////////////////////////////////////////////////////////////////////////////////////
-CartXferRegister client_read(CartXferRegister reg, void* buf){
+//
+// Function     : client_connect
+// Description  : Make a connection unless already connected.  Connections
+//                are numbered server by server, cart_network_connections to
+//                each, and server n listens on the base port plus n; shared
+//                memory only reaches the one server on this host
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if failure
 
-reg = htonll64(reg);
-CartXferRegister resp;
-if(write( client_socket, &reg, sizeof(reg)) != sizeof(reg)){
-	return(-1);
+int client_connect(int conn){
+
+struct sockaddr_in cart_sock;
+unsigned short port = (cart_network_port == 0) ? CART_DEFAULT_PORT : cart_network_port;
+int one = 1;
+
+int server = conn / cart_network_connections;
+
+if(client_socket[conn] != -1 || client_shm != NULL){
+	return(0);
+}
+if(cart_network_shm){
+	//Attach to the segment of the server on this host
+	if(conn != 0 || (client_shm = cart_shm_attach(port)) == NULL){
+		return( -1 );
+		}
+	return(0);
 }
-read( client_socket, &resp, sizeof(resp));
-read( client_socket, (char *)buf, CART_FRAME_SIZE );
 
-return(resp);
+//Get Address
+memset(&cart_sock, 0x0, sizeof(cart_sock));
+cart_sock.sin_family = AF_INET;
+cart_sock.sin_port = htons(port + server);
+if ( inet_aton((cart_network_address == NULL) ? CART_DEFAULT_IP : (char *)cart_network_address, &cart_sock.sin_addr) == 0 ) {
+	return( -1 );
+	}
+//Create Socket
+client_socket[conn] = socket(PF_INET, SOCK_STREAM, 0);
+if (client_socket[conn] == -1) {
+	return( -1 );
+	}
+//Frames follow the header immediately, don't let Nagle hold them back
+setsockopt(client_socket[conn], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+//Open Connection
+if ( connect(client_socket[conn], (const struct sockaddr *)&cart_sock, sizeof(cart_sock)) == -1 ) {
+	logMessage(LOG_ERROR_LEVEL, "Connection to CART server %d (port %d) failed", server, port + server);
+	close(client_socket[conn]);
+	client_socket[conn] = -1;
+	return( -1 );
+	}
+return(0);
 }
 ////////////////////////////////////////////////////////////////////////////////////
-CartXferRegister client_write(CartXferRegister reg, void *buf){
-
-reg = htonll64(reg);
-CartXferRegister resp;
+//
+// Function     : client_payload
+// Description  : Work out how many bytes travel with a request and with its
+//                response
+//
+// Inputs       : reg - the request register
+//                outlen, inlen - where to put the sizes
+// Outputs      : none
 
-if(write( client_socket, &reg, sizeof(reg)) != sizeof(reg)){
-	return(-1);
-}
-write( client_socket, (char *)buf, CART_FRAME_SIZE );
-read( client_socket, &resp, sizeof(resp));
+void client_payload(CartXferRegister reg, size_t *outlen, size_t *inlen){
 
-return(resp);
+uint64_t KY1 = (reg & KY1_MASK) >> 56, CNT = reg & CNT_MASK;
 
+*outlen = *inlen = 0;
+if(KY1 == CART_OP_WRFRME){
+	*outlen = CART_FRAME_SIZE;
+}
+else if(KY1 == CART_OP_RDFRME){
+	*inlen = CART_FRAME_SIZE;
+}
+else if(KY1 == CART_OP_WRFRMS){
+	*outlen = CNT * CART_FRAME_SIZE;
+}
+else if(KY1 == CART_OP_RDFRMS){
+	*inlen = CNT * CART_FRAME_SIZE;
+}
+else if(KY1 == CART_OP_WRPART && CNT > 0){
+	*outlen = CART_PARTIAL_HEADER_SIZE + CNT;
+}
 }
 ////////////////////////////////////////////////////////////////////////////////////
-CartXferRegister client_poweroff(CartXferRegister reg){
+//
+// Function     : client_send_all
+// Description  : Send a request header and any outgoing frames in one
+//                gathered write, looping until all of it has gone out
+//
+// Inputs       : sock - the socket
+//                reg - the request register (host order)
+//                out, outlen - frame data to send with the request
+// Outputs      : 0 if successful, -1 if failure
 
-reg = htonll64(reg);
-CartXferRegister resp;
+int client_send_all(int sock, CartXferRegister reg, void *out, size_t outlen){
 
-if(write( client_socket, &reg, sizeof(reg)) != sizeof(reg)){
-	return(-1);
-}
-read( client_socket, &resp, sizeof(resp));
+struct iovec iov[2];
+ssize_t sent, total = sizeof(reg) + outlen;
+int iovcnt = (outlen > 0) ? 2 : 1;
 
-close(client_socket); 
+reg = htonll64(reg);
+iov[0].iov_base = &reg;
+iov[0].iov_len = sizeof(reg);
+iov[1].iov_base = out;
+iov[1].iov_len = outlen;
 
-return(resp);
+while(total > 0){
+	if((sent = writev(sock, iov, iovcnt)) <= 0){
+		return(-1);
+	}
+	total -= sent;
+	while(iovcnt > 0 && sent >= (ssize_t)iov[0].iov_len){
+		sent -= iov[0].iov_len;
+		iov[0] = iov[1];
+		iovcnt--;
+	}
+	if(iovcnt > 0){
+		iov[0].iov_base = (char *)iov[0].iov_base + sent;
+		iov[0].iov_len -= sent;
+	}
+}
+return(0);
 }
 ////////////////////////////////////////////////////////////////////////////////////
-CartXferRegister client_op(CartXferRegister reg){
+//
+// Function     : client_disconnect
+// Description  : Close a connection (or leave the segment)
+//
+// Inputs       : conn - the connection
+// Outputs      : none
 
-reg = htonll64(reg);
-CartXferRegister resp;
+void client_disconnect(int conn){
 
-if(write( client_socket, &reg, sizeof(reg)) != sizeof(reg)){
-	return(-1);
+if(client_shm != NULL){
+	cart_shm_detach(client_shm);
+	client_shm = NULL;
+	return;
+}
+close(client_socket[conn]);
+client_socket[conn] = -1;
 }
-read( client_socket, &resp, sizeof(resp));
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_recv_all
+// Description  : Read exactly len bytes from the socket (TCP may split them)
+//
+// Inputs       : sock - the socket
+//                buf, len - where to put the bytes and how many
+// Outputs      : 0 if successful, -1 if failure
 
-return(resp);
+int client_recv_all(int sock, void *buf, size_t len){
 
-}
+ssize_t got;
 
+while(len > 0){
+	if((got = read(sock, buf, len)) <= 0){
+		return(-1);
+	}
+	buf = (char *)buf + got;
+	len -= got;
+}
+return(0);
+}
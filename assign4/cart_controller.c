@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_controller.c
+//  Description    : This is an in-memory implementation of the CART
+//                   controller (cart_io_bus).  It backs the stand-in server
+//                   and the driver's in-process (direct) bus mode, and
+//                   supports the multi-frame RDFRMS/WRFRMS and partial frame
+//                   WRPART extensions.  Stand-in sessions run on their own
+//                   threads, each with its own loaded cartridge.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+// Project includes
+#include <cart_controller.h>
+#include <cart_support.h>
+#include <cmpsc311_log.h>
+
+// Global Variables
+CartCartridge *cartridges[CART_MAX_CARTRIDGES]; // Cartridge memory (allocated on first use)
+CartridgeIndex LoadedCart = CART_NO_CARTRIDGE;   // The currently loaded cartridge (cart_io_bus)
+pthread_mutex_t CartridgeLock = PTHREAD_MUTEX_INITIALIZER; // Guards allocating and freeing cartridges
+int ControllerOn = 0;                            // Has INITMS been issued
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : controller_frames
+// Description  : Return a pointer to frames in the loaded cartridge,
+//                allocating the cartridge on first use
+//
+// Inputs       : loaded - the loaded cartridge
+//                frm - the first frame
+//                count - the number of frames
+// Outputs      : pointer to the first frame, NULL if out of range
+
+static char * controller_frames(CartridgeIndex loaded, CartFrameIndex frm, uint32_t count) {
+	if ( (!ControllerOn) || (loaded >= CART_MAX_CARTRIDGES) ||
+		 ((uint32_t)frm + count > CART_CARTRIDGE_SIZE) ) {
+		return(NULL);
+	}
+	if (cartridges[loaded] == NULL) {
+		pthread_mutex_lock(&CartridgeLock);
+		if (cartridges[loaded] == NULL) {
+			cartridges[loaded] = calloc(1, sizeof(CartCartridge));
+		}
+		pthread_mutex_unlock(&CartridgeLock);
+		if (cartridges[loaded] == NULL) {
+			return(NULL);
+		}
+	}
+	return((*cartridges[loaded])[frm]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_io_bus
+// Description  : This is the bus interface for communicating with controller
+//
+// Inputs       : regstate - the request registers
+//                buf - the frame(s) to read into or write from
+// Outputs      : the response registers (RT set on failure)
+
+CartXferRegister cart_io_bus(CartXferRegister regstate, void *buf) {
+	return(cart_io_bus_session(&LoadedCart, regstate, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_io_bus_session
+// Description  : Run a request for one session (client connection), which
+//                has its own loaded cartridge.  The cartridges are shared
+//
+// Inputs       : loaded - the session's loaded cartridge
+//                regstate - the request registers
+//                buf - the frame(s) to read into or write from
+// Outputs      : the response registers (RT set on failure)
+
+CartXferRegister cart_io_bus_session(CartridgeIndex *loaded, CartXferRegister regstate, void *buf) {
+
+	// Local variables
+	uint8_t KY1 = (regstate & KY1_MASK) >> 56;
+	uint16_t CT1 = (regstate & CT1_MASK) >> 31;
+	uint16_t FM1 = (regstate & FM1_MASK) >> 15;
+	uint32_t count = 1;
+	uint16_t offset;
+	char *frames;
+	int fail = 0, i;
+
+	switch (KY1) {
+	case CART_OP_INITMS:
+		if (ControllerOn) {
+			logMessage(CartControllerLLevel, "CART INIT: re-initializing the memory system");
+		}
+		ControllerOn = 1;
+		*loaded = CART_NO_CARTRIDGE;
+		break;
+
+	case CART_OP_BZERO:
+		if ((frames = controller_frames(*loaded, 0, CART_CARTRIDGE_SIZE)) == NULL) {
+			fail = 1;
+		} else {
+			memset(frames, 0x0, sizeof(CartCartridge));
+		}
+		break;
+
+	case CART_OP_LDCART:
+		if ((!ControllerOn) || (CT1 >= CART_MAX_CARTRIDGES)) {
+			fail = 1;
+		} else {
+			*loaded = CT1;
+		}
+		break;
+
+	case CART_OP_RDFRMS:
+	case CART_OP_WRFRMS:
+		count = regstate & CNT_MASK;
+		if (count > CART_MAX_XFER_FRAMES) {
+			fail = 1;
+			break;
+		}
+		/* fallthrough */
+
+	case CART_OP_RDFRME:
+	case CART_OP_WRFRME:
+		if ((frames = controller_frames(*loaded, FM1, count)) == NULL) {
+			fail = 1;
+		} else if (count == 0) {
+			// Empty transfers are how clients probe for RDFRMS/WRFRMS
+		} else if ((KY1 == CART_OP_RDFRME) || (KY1 == CART_OP_RDFRMS)) {
+			memcpy(buf, frames, count*CART_FRAME_SIZE);
+		} else {
+			memcpy(frames, buf, count*CART_FRAME_SIZE);
+		}
+		break;
+
+	case CART_OP_WRPART:
+		count = regstate & CNT_MASK;
+		if ((frames = controller_frames(*loaded, FM1, 1)) == NULL) {
+			fail = 1;
+		} else if (count == 0) {
+			// Empty writes are how clients probe for WRPART
+		} else {
+			memcpy(&offset, buf, CART_PARTIAL_HEADER_SIZE);
+			offset = ntohs(offset);
+			if ((uint32_t)offset + count > CART_FRAME_SIZE) {
+				fail = 1;
+			} else {
+				memcpy(&frames[offset], (char *)buf + CART_PARTIAL_HEADER_SIZE, count);
+			}
+		}
+		break;
+
+	case CART_OP_POWOFF:
+		pthread_mutex_lock(&CartridgeLock);
+		for (i=0; i<CART_MAX_CARTRIDGES; i++) {
+			free(cartridges[i]);
+			cartridges[i] = NULL;
+		}
+		pthread_mutex_unlock(&CartridgeLock);
+		ControllerOn = 0;
+		*loaded = CART_NO_CARTRIDGE;
+		break;
+
+	default:
+		logMessage(LOG_ERROR_LEVEL, "CART BUS FAULT: unknown op instruction [%d]", KY1);
+		return((CartXferRegister)-1);
+	}
+
+	// Echo the request, with the return bit set if it failed
+	return(regstate | (fail ? RT_MASK : 0));
+}
@@ -19,6 +19,7 @@
 #define CART_CARTRIDGE_SIZE 1024
 #define CART_FRAME_SIZE 1024
 #define CART_NO_CARTRIDGE (CART_MAX_CARTRIDGES+0xff)
+#define CART_MAX_XFER_FRAMES 64  // Maximum frames moved by one RDFRMS/WRFRMS
 
 // Type definitions
 typedef uint64_t CartXferRegister; // This is the value passed through the 
@@ -39,7 +40,8 @@ typedef CartFrame CartCartridge[CART_CARTRIDGE_SIZE]; // A Cartridge
     16 - RT1 (Return code register 1)
  17-32 - CT1 (Cartridge register 1)
  33-48 - FM1 (Frame register 1)
- 48-63 - UNUSED
+ 49-63 - CNT (Frame count register for RDFRMS/WRFRMS, byte count for
+               WRPART, otherwise zero)
 
 */
 
@@ -51,7 +53,8 @@ typedef enum {
 	CART_REG_RT1 = 2,   // Return code 1 (1 bit)
 	CART_REG_CT1 = 3,   // Cartridge register 1
 	CART_REG_FM1 = 4,   // Frame register 1
-	CART_REG_MAXVAL = 5 // Maximum opcode value
+	CART_REG_CNT = 5,   // Frame count register (15 bits)
+	CART_REG_MAXVAL = 6 // Maximum opcode value
 
 } CartRegisters;
 
@@ -64,7 +67,10 @@ typedef enum {
 	CART_OP_RDFRME = 3,  // Read the cartidge frame
 	CART_OP_WRFRME = 4,  // Write to the cartridge frame
 	CART_OP_POWOFF = 5,  // Power off the memory system
-	CART_OP_MAXVAL = 6   // Maximum opcode value
+	CART_OP_RDFRMS = 6,  // Read CNT contiguous frames starting at FM1
+	CART_OP_WRFRMS = 7,  // Write CNT contiguous frames starting at FM1
+	CART_OP_WRPART = 8,  // Write CNT bytes into frame FM1 (payload: offset, bytes)
+	CART_OP_MAXVAL = 9   // Maximum opcode value
 
 } CartOpCodes;
 
@@ -82,6 +88,9 @@ extern unsigned long CartSimulatorLLevel;   // Driver log level
 CartXferRegister cart_io_bus(CartXferRegister regstate, void *buf);
 	// This is the bus interface for communicating with controller
 
+CartXferRegister cart_io_bus_session(CartridgeIndex *loaded, CartXferRegister regstate, void *buf);
+	// The bus interface for one of several sessions, each with its own loaded cartridge
+
 int cart_unit_test(void);
 	// This function runs the unit tests for the cart controller.
 
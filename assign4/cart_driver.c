@@ -10,6 +10,7 @@
 
 // Includes
 #include <stdlib.h>
+#include <time.h>
 
 // Project Includes
 #include <cart_driver.h>
@@ -17,21 +18,102 @@
 #include <cart_support.h>
 #include <string.h>
 #include <cmpsc311_log.h>
+#include <cart_log.h>
+#include <cart_timeline.h>
 #include <cart_cache.h>
+#include <cart_mmap.h>
 #include <cart_network.h>
+#include <cmpsc311_util.h>
+#include <arpa/inet.h>
 
 // Implementation
 // Global Variables
-uint16_t NextFrame; 				//global int that contains the location of the next frame to be allocated
-									//The upper 6 bits of this variable contain the cartridge number..
-									//while the lower 10 contain the frame
-
-uint16_t FileCounter;				//next file handle to be assigned
-CartridgeIndex CurrentCart;			//Number of the current cartridge loaded
+uint32_t NextFrame[CART_MAX_LANES];	//frames allocated from each connection's share of its server's
+									//cartridges (see cart_new_frame)
+int NumServers;						//servers the files are striped over
+int Connections;					//connections to each server, each with a share of the cartridges
+int NumLanes;						//connections to all the servers (NumServers * Connections)
+int StripeUnit = 1;					//frames of a file placed on a server before moving to the next
+int Replicas = 1;					//servers holding a copy of each frame
+uint32_t HedgeDelay;				//usec before a slow read goes to another replica, 0 to adapt
+CartBusPending BusPending[CART_MAX_LANES][CART_BUS_DEPTH];	//requests awaiting responses, oldest first
+int BusHead[CART_MAX_LANES];		//oldest entry of each lane's BusPending
+int BusCount[CART_MAX_LANES];		//entries in each lane's BusPending
+char BusScratch[CART_MAX_XFER_FRAMES*CART_FRAME_SIZE];	//frames of stale responses
+uint64_t ServerLatency[CART_MAX_SERVERS];	//smoothed response time of each server (usec)
+int ServerReads[CART_MAX_SERVERS];	//frames read from each server
+int hedgessent;						//reads sent to a second replica
+int hedgeswon;						//hedged reads the second replica answered first
+
+uint32_t FileCounter;				//files in the table
+CartridgeIndex CurrentCart[CART_MAX_LANES];	//Number of the cartridge loaded on each lane
 file *files;						//global pointer to the first file in the file structure
+uint32_t FileCapacity;				//entries allocated in the file table
+uint32_t *FileHash;					//file index + 1 of each path by its hash, 0 if empty (open addressing)
+uint32_t FileHashSize;				//slots in FileHash, a power of 2 at least twice FileCounter
+char **PathBlocks;					//blocks the interned paths are kept in
+int NumPathBlocks;					//blocks allocated
+uint32_t PathUsed;					//bytes used in the last block
+uint32_t *Handles;					//file index each handle (less one) refers to
+int NumHandles;						//handles handed out so far
+int HandleCapacity;					//entries allocated in Handles and FreeHandles
+int16_t *FreeHandles;				//handles given back by cart_close
+int NumFreeHandles;					//entries in FreeHandles
 
 int cachehits;
 int cachemisses;
+int busrequests;					//bus round trips issued
+uint64_t busbytes;					//bytes moved over the bus (headers and frames)
+int partialwrites;					//sub-frame writes issued
+int framesread;						//frames moved over the bus by reads
+int frameswritten;					//frames moved over the bus by writes
+int BatchedFrames;					//server supports RDFRMS/WRFRMS
+int PartialWrites;					//server supports WRPART
+
+int DirectBus;						//call the in-process controller, no server
+int SimBus;							//run the in-process controller in virtual time
+uint64_t SimOpNanos;				//virtual cost of every request
+uint64_t SimSwitchNanos;			//virtual cost of loading a different cartridge
+uint64_t SimByteNanos;				//virtual cost of each byte moved
+uint64_t SimNow;					//the virtual clock (nsec)
+uint64_t SimLaneFree[CART_MAX_LANES];	//when each connection has finished what it was sent
+CartridgeIndex SimLoaded[CART_MAX_LANES];	//each connection's cartridge in the controller
+CartridgeIndex SimMounted[CART_MAX_LANES];	//each connection's cartridge once what it was sent is done
+int simswitches;					//cartridge changes the simulated bus charged for
+int DedupFrames;					//share frames with identical contents
+uint32_t *FrameRefs;				//references to each frame (dedup only)
+dedup_entry **DedupTable;			//contents -> frame index
+dedup_entry **FrameDigest;			//frame -> its index entry, NULL if unindexed
+uint32_t *FreeFrames;				//frames nothing refers to any more
+int NumFreeFrames;
+int dedupavoided;					//frame writes that matched existing contents
+int dedupcopies;					//shared frames copied before writing
+int CoalesceWrites;					//gather appends into whole frames before writing
+int coalescedwrites;				//appends that went through the file's buffer
+int bufferflushes;					//append buffers written out
+int LfsCartridges;					//cartridges of each connection's share the log uses, 0 to write in place
+uint64_t *FrameOwner;				//file index + 1 (above bit 32) and frame index of each live frame, 0 if dead (log only)
+uint16_t *LiveFrames;				//live frames on each cartridge counted across servers (log only)
+int LfsCart[CART_MAX_LANES];		//slot in its share of the cartridge each connection's log is filling
+uint32_t LfsNext[CART_MAX_LANES];	//next frame of that cartridge
+int lfsrelocated;					//frames rewritten at the head of the log
+int lfscleaned;						//cartridges emptied by the cleaner
+int lfsmoved;						//live frames the cleaner copied
+int cartloads;						//cartridges loaded
+int readaheadframes;				//frames fetched ahead of sequential reads
+int prefetchedframes;				//frames fetched for CART_ADVICE_WILLNEED
+int droppedframes;					//frames dropped from the cache for CART_ADVICE_DONTNEED
+static const char *BusOpNames[CART_OP_MAXVAL] = { "INITMS", "BZERO", "LDCART", "RDFRME",
+	"WRFRME", "POWOFF", "RDFRMS", "WRFRMS", "WRPART" };	//timeline names of the opcodes
+
+static int32_t cart_write_through(file *wfile, void *buf, int32_t count);
+static int32_t cart_write_append(file *wfile, char *buf, int32_t count);
+static uint32_t cart_lfs_frame(int lane);
+static int64_t cart_file_lookup(const char *path);
+static int cart_read_ahead(file *rfile, int32_t count, uint32_t next);
+static void cart_lfs_release(uint32_t location);
+static void cart_dedup_forget(uint32_t location);
+static void cart_free_tables(void);
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : cart_poweron
@@ -41,39 +123,111 @@ int cachemisses;
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t cart_poweron(void) {
-
-	char KY1, KY2, RT;
-	uint16_t CT1, FM1;
-	NextFrame = 0;		//Initalize global variables and data structures
-	FileCounter = 0;
-	CurrentCart = 0;
+	int l;
+
+	FileCounter = 0;	//Initalize global variables and data structures
+	NumHandles = 0;
+	NumFreeHandles = 0;
+	NumServers = (DirectBus || SimBus || cart_network_shm) ? 1 : cart_network_servers;
+	Connections = (DirectBus || cart_network_shm) ? 1 : cart_network_connections;
+	NumLanes = NumServers * Connections;
+	memset(NextFrame, 0x0, sizeof(NextFrame));
+	memset(BusCount, 0x0, sizeof(BusCount));
+	memset(ServerLatency, 0x0, sizeof(ServerLatency));
+	memset(ServerReads, 0x0, sizeof(ServerReads));
+	hedgessent = 0;
+	hedgeswon = 0;
+	SimNow = 0;
+	simswitches = 0;
+	readaheadframes = 0;
+	prefetchedframes = 0;
+	droppedframes = 0;
+	memset(SimLaneFree, 0x0, sizeof(SimLaneFree));
+	for(l = 0; l < CART_MAX_LANES; l++){
+		SimLoaded[l] = SimMounted[l] = CART_NO_CARTRIDGE;
+	}
+	if(NumServers % Replicas != 0){
+		logMessage(LOG_ERROR_LEVEL, "Error: %d servers can't be split into groups of %d replicas \n", NumServers, Replicas);
+		return(-1);
+	}
 	cachehits = 0;
 	cachemisses = 0;
-	files = calloc(CART_MAX_TOTAL_FILES , sizeof(file));
+	busrequests = 0;
+	busbytes = 0;
+	partialwrites = 0;
+	framesread = 0;
+	frameswritten = 0;
+	BatchedFrames = 0;
+	PartialWrites = 0;
+	dedupavoided = 0;
+	dedupcopies = 0;
+	coalescedwrites = 0;
+	bufferflushes = 0;
+	lfsrelocated = 0;
+	lfscleaned = 0;
+	lfsmoved = 0;
+	cartloads = 0;
+	NumFreeFrames = 0;
+	if(LfsCartridges){
+		if(DedupFrames){
+			logMessage(LOG_ERROR_LEVEL, "Error: Deduplicated frames can't be moved by the log \n");
+			return(-1);
+		}
+		LfsCartridges = min(LfsCartridges, CART_MAX_CARTRIDGES / Connections);
+		if(LfsCartridges <= CART_LFS_RESERVE + 1){
+			logMessage(LOG_ERROR_LEVEL, "Error: A log of %d cartridges leaves none to write \n", LfsCartridges);
+			return(-1);
+		}
+		FrameOwner = calloc(CART_TOTAL_FRAMES, sizeof(uint64_t));
+		LiveFrames = calloc(CART_MAX_SERVERS*CART_MAX_CARTRIDGES, sizeof(uint16_t));
+		memset(LfsCart, 0x0, sizeof(LfsCart));
+		memset(LfsNext, 0x0, sizeof(LfsNext));
+	}
+	FileCapacity = CART_FILES_INITIAL;
+	files = calloc(FileCapacity, sizeof(file));
+	FileHashSize = 2*CART_FILES_INITIAL;
+	FileHash = calloc(FileHashSize, sizeof(uint32_t));
+	HandleCapacity = CART_HANDLES_INITIAL;
+	Handles = malloc(HandleCapacity*sizeof(uint32_t));
+	FreeHandles = malloc(HandleCapacity*sizeof(int16_t));
+	NumPathBlocks = 0;
+	PathBlocks = NULL;
+	PathUsed = CART_PATH_BLOCK;
+	if(DedupFrames){
+		gcry_check_version(NULL);
+		FrameRefs = calloc(CART_TOTAL_FRAMES, sizeof(uint32_t));
+		DedupTable = calloc(CART_DEDUP_BUCKETS, sizeof(dedup_entry *));
+		FrameDigest = calloc(CART_TOTAL_FRAMES, sizeof(dedup_entry *));
+		FreeFrames = malloc(CART_TOTAL_FRAMES*sizeof(uint32_t));
+	}
 	
-	CartXferRegister INIT, RESP, LDCART, ZEROCART;
+	CartXferRegister INIT, LDCART, ZEROCART;
 	
+	//Every server is set up in step, they work on each request in parallel
 	INIT = create_cart_opcode(CART_OP_INITMS,0,0,0);
-	RESP = client_cart_bus_request(INIT, NULL);
-	
-	extract_cart_opcode(RESP, &KY1, &KY2, &RT, &CT1, &FM1);
-
-	if(RT !=0){
-		logMessage(LOG_ERROR_LEVEL,"CART INITIALIZATION FAILED");
-		return (-1);
-	}
-	int i;
-	for(i = 0;i<CART_MAX_CARTRIDGES;i++){
+	int i, failed = (cart_bus_broadcast(INIT, 0) != 0);
+	for(i = 0;!failed && i<CART_MAX_CARTRIDGES;i++){
 	
 	LDCART = create_cart_opcode(CART_OP_LDCART,0,i,0);
-	client_cart_bus_request(LDCART,NULL);
-	
 	ZEROCART = create_cart_opcode(CART_OP_BZERO, 0, i,0);
-	client_cart_bus_request(ZEROCART, NULL);
+	failed = (cart_bus_broadcast(LDCART, 0) != 0) || (cart_bus_broadcast(ZEROCART, 0) != 0);
 	}
 	
 	LDCART = create_cart_opcode(CART_OP_LDCART,0,0,0);
-	client_cart_bus_request(LDCART,NULL);
+	if(failed || cart_bus_broadcast(LDCART, 0) != 0){
+		//Close what was opened and give back the tables, as poweroff would
+		logMessage(LOG_ERROR_LEVEL,"CART INITIALIZATION FAILED");
+		cart_bus_broadcast(create_cart_opcode(CART_OP_POWOFF,0,0,0), 1);
+		cart_free_tables();
+		return (-1);
+	}
+	for(i = 0; i < NumLanes; i++){
+		CurrentCart[i] = (i % Connections == 0) ? 0 : CART_NO_CARTRIDGE;
+	}
+
+	//Probe for multi-frame transfers with an empty read, older servers fail it
+	BatchedFrames = (cart_bus_broadcast(create_cart_xfer_opcode(CART_OP_RDFRMS,0,0,0), 0) == 0);
+	PartialWrites = (cart_bus_broadcast(create_cart_xfer_opcode(CART_OP_WRPART,0,0,0), 0) == 0);
 
 	init_cart_cache();
 	// Return successfully
@@ -89,26 +243,129 @@ int32_t cart_poweron(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t cart_poweroff(void) {
-	char RT, KY1, KY2;
-	uint16_t CT1, FM1;
-	CartXferRegister SHUTDOWN,RESP;
+	CartXferRegister SHUTDOWN;
+	uint32_t allocated = 0;
+	int i;
 	SHUTDOWN = create_cart_opcode(CART_OP_POWOFF, 0,0,0);
-	
-	RESP = client_cart_bus_request(SHUTDOWN, NULL);
 
-	extract_cart_opcode(RESP, &KY1, &KY2, &RT, &CT1, &FM1);
+	//Mappings are written back like any other buffered stores
+	cart_mmap_close_all();
+
+	//Anything still in an append buffer goes out before the servers stop
+	for(i = 0; i < (int)FileCounter; i++){
+		cart_flush_file(&files[i]);
+		free(files[i].wbuf);
+		files[i].wbuf = NULL;
+	}
 
-	if(RT !=0){
+	if(cart_bus_broadcast(SHUTDOWN, 1) != 0){
 		logMessage(LOG_ERROR_LEVEL,"CART POWEROFF FAILED");
 		return (-1);
 	}
 
 	logMessage(LOG_OUTPUT_LEVEL, "\nCache Hits:%d\nCache Misses:%d\n", cachehits, cachemisses);
+	logMessage(LOG_OUTPUT_LEVEL, "Bus Requests:%d\nBus Bytes:%lu\nFrames Read:%d\nFrames Written:%d\n"
+		"Partial Writes:%d\nCartridge Loads:%d\nBatched Transfers:%s\nPartial Writes Supported:%s\nBus:%s\n",
+		busrequests, busbytes, framesread, frameswritten, partialwrites, cartloads,
+		BatchedFrames ? "yes" : "no", PartialWrites ? "yes" : "no",
+		SimBus ? "simulated" : (DirectBus ? "in-process" : "server"));
+	logMessage(LOG_OUTPUT_LEVEL, "Frames Read Ahead:%d\nFrames Prefetched:%d\nFrames Dropped:%d\n",
+		readaheadframes, prefetchedframes, droppedframes);
+	if(SimBus){
+		logMessage(LOG_OUTPUT_LEVEL, "Simulated Bus Time:%.3f ms\nSimulated Cartridge Switches:%d\n",
+			SimNow/1000000.0, simswitches);
+	}
+	for(i = 0; i < NumLanes; i++){
+		allocated += NextFrame[i];
+	}
+	if(NumServers > 1){
+		logMessage(LOG_OUTPUT_LEVEL, "Striped over %d servers, %d frame stripe unit, %d replicas",
+			NumServers, StripeUnit, Replicas);
+	}
+	if(NumLanes > 1){
+		logMessage(LOG_OUTPUT_LEVEL, "Connections per server:%d", Connections);
+		for(i = 0; i < NumServers; i++){
+			uint32_t frames = 0;
+			int l;
+			for(l = i * Connections; l < (i + 1) * Connections; l++){
+				frames += NextFrame[l];
+			}
+			logMessage(LOG_OUTPUT_LEVEL, "Server %d: %u frames allocated, %d frames read, %lu usec latency",
+				i, frames, ServerReads[i], ServerLatency[i]);
+		}
+	}
+	if(CoalesceWrites){
+		logMessage(LOG_OUTPUT_LEVEL, "Coalesced Appends:%d\nAppend Buffer Flushes:%d\n", coalescedwrites, bufferflushes);
+	}
+	if(LfsCartridges){
+		logMessage(LOG_OUTPUT_LEVEL, "Log Frames Relocated:%d\nLog Cartridges Cleaned:%d\nLog Frames Moved:%d\n",
+			lfsrelocated, lfscleaned, lfsmoved);
+	}
+	if(Replicas > 1){
+		logMessage(LOG_OUTPUT_LEVEL, "Hedged Reads:%d\nHedged Reads Won:%d\n", hedgessent, hedgeswon);
+	}
+	if(DedupFrames){
+		int logical = 0;
+		for(i = 0; i < (int)FileCounter; i++){
+			logical += files[i].NumberOfFrames;
+		}
+		logMessage(LOG_OUTPUT_LEVEL, "Dedup Writes Avoided:%d\nDedup Copies:%d\n"
+			"Dedup Frames:%d logical, %d physical (%d saved)\n",
+			dedupavoided, dedupcopies, logical, allocated - NumFreeFrames,
+			logical - (allocated - NumFreeFrames));
+	}
+	log_cart_cache_stats();
+
+	//The file table goes, the frames it pointed at went with the servers
+	logMessage(LOG_OUTPUT_LEVEL, "Files:%u\nPath Bytes:%lu\n", FileCounter,
+		(unsigned long)(NumPathBlocks > 0 ? (NumPathBlocks - 1) * (unsigned long)CART_PATH_BLOCK + PathUsed : 0));
+	cart_free_tables();
 	// Return successfully
 	close_cart_cache();
+	cart_timeline_write();
 	return(0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_free_tables
+// Description  : Free the file table and the frame tables poweron allocated
+//
+// Inputs       : none
+// Outputs      : none
+
+static void cart_free_tables(void) {
+	int i;
+
+	if(LfsCartridges){
+		free(FrameOwner);
+		free(LiveFrames);
+	}
+	if(DedupFrames){
+		for(i = 0; i < CART_TOTAL_FRAMES; i++){
+			free(FrameDigest[i]);
+		}
+		free(FrameRefs);
+		free(DedupTable);
+		free(FrameDigest);
+		free(FreeFrames);
+	}
+	for(i = 0; i < (int)FileCounter; i++){
+		free(files[i].CartFrame);
+	}
+	for(i = 0; i < NumPathBlocks; i++){
+		free(PathBlocks[i]);
+	}
+	free(PathBlocks);
+	free(files);
+	free(FileHash);
+	free(Handles);
+	free(FreeHandles);
+	files = NULL;
+	FileCounter = 0;
+	NumHandles = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : cart_open
@@ -119,30 +376,132 @@ int32_t cart_poweroff(void) {
 
 int16_t cart_open(char *path) {
 
-	int i = 0;
-	
-	while(strcmp(path ,files[i].path) == 0 || i < FileCounter){ 
-		i++;
-	}
-	if(strcmp(path ,files[i].path) == 0){		//If a file with path name already exists
-		if(files[i].status == OPEN ){			//Check if the file is already open
-			logMessage(LOG_ERROR_LEVEL, "Error: File already open \n");
-			return(-1);							//Return -1 if it is already open
-		}
-		files[i].status = OPEN;					//If the file is not open, set file to OPEN
-							
-	}
-	if(i >= FileCounter){						//If the end of the table is reached without finding the path
-		strncpy( files[i].path, path, strlen(path));//Create a new file
-		files[i].status = OPEN;					//Set file to open
-		files[i].fd = i+1;						//Assign a file handle
-		FileCounter++;							//Increase the file count by one for the new file	
-	}						
-	
-	return (files[i].fd);						//Return the file handle
+	int64_t i;
+	int16_t fd;
+
+	if((i = cart_file_lookup(path)) < 0){		//Find the file, creating it if it is new
+		return(-1);
+	}
+	if(files[i].status == OPEN ){				//Check if the file is already open
+		logMessage(LOG_ERROR_LEVEL, "Error: File already open \n");
+		return(-1);								//Return -1 if it is already open
+	}
+
+	//Handles closed files gave back are used first
+	if(NumFreeHandles > 0){
+		fd = FreeHandles[--NumFreeHandles];
+	}
+	else if(NumHandles < CART_MAX_OPEN_FILES){
+		if(NumHandles == HandleCapacity){
+			HandleCapacity *= 2;
+			Handles = realloc(Handles, HandleCapacity*sizeof(uint32_t));
+			FreeHandles = realloc(FreeHandles, HandleCapacity*sizeof(int16_t));
+		}
+		fd = ++NumHandles;
+	}
+	else{
+		logMessage(LOG_ERROR_LEVEL, "Error: %d files already open \n", CART_MAX_OPEN_FILES);
+		return(-1);
+	}
+	Handles[fd-1] = i;
+	files[i].fd = fd;							//Assign a file handle
+	files[i].status = OPEN;						//Set file to open
+	files[i].advice = CART_ADVICE_NORMAL;		//Advice lasts as long as the handle
+	files[i].readahead = 0;
+	files[i].readnext = -1;
+	return (fd);								//Return the file handle
 	
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_path_hash
+// Description  : Hash a path (FNV-1a)
+//
+// Inputs       : path - the path
+// Outputs      : the hash
+
+static uint32_t cart_path_hash(const char *path) {
+	uint32_t hash = 2166136261u;
+
+	while(*path != 0){
+		hash = (hash ^ (unsigned char)*path++) * 16777619u;
+	}
+	return(hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_file_lookup
+// Description  : Find a file in the table by path, adding it (with its path
+//                interned) if it isn't there.  The table, its hash and the
+//                path blocks grow as they fill
+//
+// Inputs       : path - the path
+// Outputs      : the file's index in the table, -1 if failure
+
+static int64_t cart_file_lookup(const char *path) {
+	uint32_t slot, i, len = strlen(path) + 1, block;
+	uint32_t *grown;
+	char *interned;
+
+	for(slot = cart_path_hash(path) & (FileHashSize-1); FileHash[slot] != 0; slot = (slot+1) & (FileHashSize-1)){
+		if(strcmp(files[FileHash[slot]-1].path, path) == 0){
+			return(FileHash[slot]-1);
+		}
+	}
+
+	//A new file, make room for it in the table
+	if(FileCounter == UINT32_MAX - 1){
+		logMessage(LOG_ERROR_LEVEL, "Error: File table full \n");
+		return(-1);
+	}
+	if(FileCounter == FileCapacity){
+		FileCapacity *= 2;
+		files = realloc(files, FileCapacity*sizeof(file));
+		memset(&files[FileCounter], 0x0, (FileCapacity - FileCounter)*sizeof(file));
+	}
+	if(PathUsed + len > CART_PATH_BLOCK){
+		block = (len > CART_PATH_BLOCK) ? len : CART_PATH_BLOCK;
+		PathBlocks = realloc(PathBlocks, (NumPathBlocks+1)*sizeof(char *));
+		PathBlocks[NumPathBlocks++] = malloc(block);
+		PathUsed = 0;
+	}
+	interned = &PathBlocks[NumPathBlocks-1][PathUsed];
+	memcpy(interned, path, len);
+	PathUsed += len;
+	files[FileCounter].path = interned;
+	FileHash[slot] = ++FileCounter;
+
+	//Keep the hash at most half full
+	if(FileCounter*2 > FileHashSize){
+		grown = calloc(FileHashSize*2, sizeof(uint32_t));
+		for(i = 0; i < FileCounter; i++){
+			for(slot = cart_path_hash(files[i].path) & (FileHashSize*2-1); grown[slot] != 0; slot = (slot+1) & (FileHashSize*2-1));
+			grown[slot] = i+1;
+		}
+		free(FileHash);
+		FileHash = grown;
+		FileHashSize *= 2;
+	}
+	return(FileCounter-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_handle_file
+// Description  : Find the open file a handle refers to
+//
+// Inputs       : fd - the file handle
+// Outputs      : the file, NULL if the handle isn't open
+
+file *cart_handle_file(int16_t fd) {
+	if(fd < 1 || fd > NumHandles || files[Handles[fd-1]].fd != fd || files[Handles[fd-1]].status == CLOSED){
+		return(NULL);
+	}
+	return(&files[Handles[fd-1]]);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -153,15 +512,18 @@ int16_t cart_open(char *path) {
 // Outputs      : 0 if successful, -1 if failure
 
 int16_t cart_close(int16_t fd) {	
-	if(fd > FileCounter || fd < 1){
+	file *cfile = cart_handle_file(fd);
+
+	if(cfile == NULL){
 		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle \n");
-		return(-1);			//Failure: bad file handle
+		return(-1);			//Failure: bad file handle (or already closed)
 	}
-	if(files[fd-1].status == CLOSED){
-		logMessage(LOG_ERROR_LEVEL, "Error: File already closed \n");
-		return(-1);			//Failure: file already closed
+	if(cart_flush_file(cfile) != 0){
+		return(-1);			//Failure: buffered writes lost
 	}
-	files[fd-1].status = CLOSED;
+	cfile->status = CLOSED;
+	cfile->fd = 0;
+	FreeHandles[NumFreeHandles++] = fd;
 
 	return (0);				// Return successfully
 }
@@ -179,94 +541,173 @@ int16_t cart_close(int16_t fd) {
 
 int32_t cart_read(int16_t fd, void *buf, int32_t count) {
 	
-	if(fd > FileCounter || fd < 1){
+	file *rfile = cart_handle_file(fd);
+
+	if(rfile == NULL){
 		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle\n");
-		return(-1);			//Failure: bad file handle
+		return(-1);			//Failure: bad file handle (or file not open)
 	}
-	if(files[fd-1].status == CLOSED){
-		logMessage(LOG_ERROR_LEVEL, "Error: File not open \n");
-		return(-1);			//Failure: file not open
+	char* framebuf;
+	uint64_t span = CART_TIMELINE_BEGIN();
+
+	if(span){
+		CartTimelineCall++;
+	}
+
+	//Set count to either count or the amount of bytes from fp to the end of the file
+	if(rfile->filesize - rfile->fp < count){
+		count = rfile->filesize - rfile->fp;
+	}
+	if(count <= 0){
+		return(0);
+	}
+
+	//Reads of bytes still in the append buffer see them once they're written
+	if(rfile->buflen > 0 && rfile->fp + count > rfile->bufstart && cart_flush_file(rfile) != 0){
+		return(-1);
 	}
-	
-	file *rfile = &files[fd-1];
-	//Declare buffers
-	char* rbuf = calloc(count,sizeof(char));
-	char* framebuf = calloc(CART_FRAME_SIZE, sizeof(char));
-	char* cachebuf;
 
 	int32_t byteOffset = rfile ->fp % CART_FRAME_SIZE;
-	int FrameIndex = rfile->fp/CART_FRAME_SIZE;
-	int32_t BytesToRead = min(count,(rfile -> filesize - rfile -> fp));
-	//Set bytes to read to either count or the amount of bytes from fp to the end of the file
-	count = BytesToRead;
+	uint32_t FrameIndex = rfile->fp/CART_FRAME_SIZE;
+	int NumFrames = (byteOffset + count + CART_FRAME_SIZE - 1)/CART_FRAME_SIZE;
+	int Ahead = cart_read_ahead(rfile, count, FrameIndex + NumFrames);
+	int i;
+
+	//Gather every frame the read touches (and any read ahead, into the cache
+	//with them), then copy the requested bytes out
+	framebuf = malloc((NumFrames + Ahead)*CART_FRAME_SIZE);
+	if(cart_load_frames(&rfile->CartFrame[FrameIndex], NumFrames + Ahead, Ahead, framebuf) != 0){
+		logMessage(LOG_ERROR_LEVEL, "Error: Frame read failed \n");
+		free(framebuf);
+		return(-1);
+	}
+	memcpy(buf,&framebuf[byteOffset],count);
+	for(i = 0; rfile->advice == CART_ADVICE_NOREUSE && i < NumFrames; i++){
+		uint16_t FM1, CT1;
+		file_ExtractFrame(rfile->CartFrame[FrameIndex + i], &FM1, &CT1);
+		demote_cart_cache(CT1, FM1);
+	}
+	rfile -> fp = rfile ->fp +count;
+	// Return successfully
+	free(framebuf);
+	CART_TIMELINE_END("driver", "cart_read", cart_timeline_track(), span, "fd,offset,bytes",
+		fd, rfile->fp - count, count);
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_read_ahead
+// Description  : Work out how many frames to read ahead of a read.  With
+//                normal advice the window opens once a read starts where the
+//                last ended and doubles with each one after, sequential
+//                advice opens it all the way, anything else shuts it.  The
+//                frames are only fetched when the first of them isn't
+//                cached, so a window is read once, as the reads reach it
+//
+// Inputs       : rfile - the file being read (at its file pointer)
+//                count - the bytes being read
+//                next - the frame just past the read
+// Outputs      : the number of frames to read ahead
+
+static int cart_read_ahead(file *rfile, int32_t count, uint32_t next){
+	uint32_t last = (rfile->filesize + CART_FRAME_SIZE - 1)/CART_FRAME_SIZE;
 	uint16_t FM1, CT1;
-	CartXferRegister READ, LOADCART;
-	int i = 0;
-
-	if (byteOffset !=0){
-		file_ExtractFrame(rfile -> CartFrame[FrameIndex], &FM1, &CT1);
-		cachebuf = get_cart_cache(CT1, FM1); 
-		if(cachebuf == NULL){										//If the frame is not on the cache read normally
-		cachemisses++;
-		if (CT1 != CurrentCart){									//If the cartridge requested is not the current cartridge
-		LOADCART = create_cart_opcode(CART_OP_LDCART,0 ,CT1,0);		//Load requested cartridge
-		client_cart_bus_request(LOADCART,NULL);
-		CurrentCart = CT1;
-		}
-
-		READ = create_cart_opcode(CART_OP_RDFRME,0,CT1,FM1);
-		client_cart_bus_request(READ,framebuf);
-		
-		put_cart_cache(CT1, FM1, framebuf);							//put the frame on the cache
-		
-		memcpy(rbuf,&framebuf[byteOffset],min((CART_FRAME_SIZE - byteOffset),(BytesToRead)));
-		}
-		else{
-			cachehits++;
-			memcpy(rbuf,&cachebuf[byteOffset],min((CART_FRAME_SIZE - byteOffset),(BytesToRead)));
-		}
+	int ahead;
 
-		BytesToRead = BytesToRead - min((CART_FRAME_SIZE - byteOffset),(BytesToRead));
-		FrameIndex++;
-		i++;
+	if(rfile->advice == CART_ADVICE_SEQUENTIAL){
+		rfile->readahead = CART_READAHEAD_MAX;
+	}
+	else if(rfile->advice != CART_ADVICE_NORMAL || rfile->fp != rfile->readnext){
+		rfile->readahead = 0;
+	}
+	else{
+		rfile->readahead = (rfile->readahead == 0) ? CART_READAHEAD_MIN : min(2*rfile->readahead, CART_READAHEAD_MAX);
 	}
+	rfile->readnext = rfile->fp + count;
 
-	
-	while(BytesToRead  >0){
+	//Frames read ahead only last if the cache has room for them
+	if(last > rfile->NumberOfFrames){
+		last = rfile->NumberOfFrames;
+	}
+	if(rfile->readahead == 0 || next >= last || rfile->readahead > get_cart_cache_size()/2){
+		return(0);
+	}
+	file_ExtractFrame(rfile->CartFrame[next], &FM1, &CT1);
+	if(peek_cart_cache(CT1, FM1)){
+		return(0);
+	}
+	ahead = min(rfile->readahead, last - next);
+	return(ahead);
+}
 
-		file_ExtractFrame(rfile -> CartFrame[FrameIndex], &FM1, &CT1);
-		cachebuf = get_cart_cache(CT1, FM1);
-		if (cachebuf == NULL){
-		cachemisses++;
-		if (CT1 != CurrentCart){									//If the cartridge requested is not the current cartridge
-		LOADCART = create_cart_opcode(CART_OP_LDCART,0 ,CT1,0);		//Load requested cartridge
-		client_cart_bus_request(LOADCART,NULL);
-		CurrentCart = CT1;
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_advise
+// Description  : Take advice on how a file will be read.  Normal,
+//                sequential, random and noreuse set how reads of the file
+//                are treated from now on (the range is ignored).  Willneed
+//                fetches the range into the cache now, as one transfer over
+//                every lane, up to as much as the cache holds.  Dontneed
+//                drops the range from the cache and the tiers below it
+//
+// Inputs       : fd - the file handle
+//                offset - where the range starts
+//                len - the bytes in the range, 0 for to the end of the file
+//                advice - what to expect (CART_ADVICE_*)
+// Outputs      : 0 if successful, -1 if failure
 
-		READ = create_cart_opcode(CART_OP_RDFRME,0,CT1,FM1);
-		client_cart_bus_request(READ,framebuf);									//Send read message over bus
-		put_cart_cache(CT1, FM1, framebuf);
-		memcpy(&rbuf[(i*CART_FRAME_SIZE - byteOffset)],framebuf,min(CART_FRAME_SIZE,BytesToRead));
-		}
-		
-		else{
-			cachehits++;
-			memcpy(&rbuf[(i*CART_FRAME_SIZE - byteOffset)],cachebuf,min(CART_FRAME_SIZE,BytesToRead));
+int32_t cart_advise(int16_t fd, uint64_t offset, uint64_t len, int advice){
+	file *afile = cart_handle_file(fd);
+	uint32_t first, last, frame;
+	uint64_t end;
+	uint16_t FM1, CT1;
+
+	if(afile == NULL){
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle\n");
+		return(-1);
+	}
+	switch(advice){
+	case CART_ADVICE_NORMAL:
+	case CART_ADVICE_SEQUENTIAL:
+	case CART_ADVICE_RANDOM:
+	case CART_ADVICE_NOREUSE:
+		afile->advice = advice;
+		afile->readahead = 0;
+		return(0);
+	case CART_ADVICE_WILLNEED:
+	case CART_ADVICE_DONTNEED:
+		break;
+	default:
+		logMessage(LOG_ERROR_LEVEL, "Error: Unknown advice %d \n", advice);
+		return(-1);
+	}
+
+	//The frames the range touches, cut off at the end of the file
+	end = (len == 0 || offset + len > (uint64_t)afile->filesize) ? (uint64_t)afile->filesize : offset + len;
+	if(offset >= end){
+		return(0);
+	}
+	first = offset/CART_FRAME_SIZE;
+	last = (end + CART_FRAME_SIZE - 1)/CART_FRAME_SIZE;
+	if(last > afile->NumberOfFrames){
+		last = afile->NumberOfFrames;
+	}
+
+	if(advice == CART_ADVICE_DONTNEED){
+		for(frame = first; frame < last; frame++){
+			file_ExtractFrame(afile->CartFrame[frame], &FM1, &CT1);
+			droppedframes += drop_cart_cache(CT1, FM1);
 		}
-		
-		
-		BytesToRead = BytesToRead - min(CART_FRAME_SIZE, BytesToRead);//update bytes to read by subtracting 1024 or bytes to read
+		afile->readahead = 0;
+		return(0);
+	}
 
-		FrameIndex++;												//Move to the next frame
-		i++;														//increment i for address purposes
+	//Any more and the range would push its own start out of the cache
+	if(last - first > get_cart_cache_size()){
+		last = first + get_cart_cache_size();
 	}
-	memcpy(buf,rbuf,count);
-	rfile -> fp = rfile ->fp +count;
-	// Return successfully
-	free(rbuf);
-	free(framebuf);
-	return (count);
+	return((last > first) ? cart_load_frames(&afile->CartFrame[first], last - first, 0, NULL) : 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -282,104 +723,217 @@ int32_t cart_read(int16_t fd, void *buf, int32_t count) {
 
 int32_t cart_write(int16_t fd, void *buf, int32_t count) {
 
-	CartXferRegister WRITE, READ, LOADCART;
-	
-	if(fd > FileCounter || fd < 1){ 		//Check File handle
+	file *wfile = cart_handle_file(fd);
+
+	if(wfile == NULL){ 					//Check File handle
 		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle. \n");
-		return(-1);						//Failure: bad file handle
+		return(-1);						//Failure: bad file handle (or file not open)
 		}						
-	if(files[fd-1].status == CLOSED){	//Check of the file is open
-		logMessage(LOG_ERROR_LEVEL, "Error: File not open. \n");
-		return(-1);						//Failure: file not open
-		}
-	file *wfile;
-	wfile = &files[fd-1];
-
-	uint16_t CT1, FM1;
-	char *mbuf = calloc(count, sizeof(char));
-	char *writebuf = calloc(CART_FRAME_SIZE, sizeof(char));
-	
-	uint32_t FramesToAllocate;
-	int i= 0;
-	int32_t BytesToWrite = count;
-	
-	int FrameIndex = (wfile->fp)/CART_FRAME_SIZE;
-	int32_t byteOffset = (wfile->fp) % CART_FRAME_SIZE;
-	 
-	if(wfile->fp + count > wfile->filesize)
-		wfile->filesize = wfile->fp +count;
-
-	FramesToAllocate = ((wfile -> filesize)/CART_FRAME_SIZE) +1 - (wfile -> NumberOfFrames); 
-
-	memcpy(mbuf, buf, count);
+	if(count <= 0){
+		return(0);
+	}
+	uint64_t span = CART_TIMELINE_BEGIN();
+	int32_t ret;
 
-	while(i < FramesToAllocate){	
-		AllocateFrame( wfile);	//allocates the amount of frames needed
-		i++;
+	if(span){
+		CartTimelineCall++;
 	}
 
-	i = 0;
+	//Appends gather in the file's buffer, anything else flushes it first
+	if(CoalesceWrites && wfile->fp == wfile->filesize){
+		ret = cart_write_append(wfile, buf, count);
+	}
+	else{
+		ret = (cart_flush_file(wfile) == 0) ? cart_write_through(wfile, buf, count) : -1;
+	}
+	if(ret >= 0 && cart_lfs_clean() != 0){
+		ret = -1;
+	}
+	if(ret >= 0){
+		CART_TIMELINE_END("driver", "cart_write", cart_timeline_track(), span, "fd,offset,bytes",
+			fd, wfile->fp - count, count);
+	}
+	return(ret);
+}
 
-	if(byteOffset !=0){					//for "incomplete frames" 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_write_through
+// Description  : Write "count" bytes at the file position straight to the
+//                frames
+//
+// Inputs       : wfile - the file
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written if successful, -1 if failure
 
-		file_ExtractFrame(wfile -> CartFrame[FrameIndex], &FM1, &CT1); //Find the correct frame	
+static int32_t cart_write_through(file *wfile, void *buf, int32_t count) {
 
-		if (CT1 != CurrentCart){									//If the cartridge requested is not the current cartridge
-		LOADCART = create_cart_opcode(CART_OP_LDCART,0 ,CT1,0);		//Load requested cartridge
-		client_cart_bus_request(LOADCART,NULL);
-		CurrentCart = CT1;
+	char *writebuf;
+	int64_t OldSize = wfile->filesize;
+	uint32_t FrameIndex = (wfile->fp)/CART_FRAME_SIZE;
+	int32_t byteOffset = (wfile->fp) % CART_FRAME_SIZE;
+	int NumFrames = (byteOffset + count + CART_FRAME_SIZE - 1)/CART_FRAME_SIZE;
+	int LastFrame = NumFrames - 1;
+	int32_t lastEnd = (byteOffset + count) % CART_FRAME_SIZE;
+	uint32_t OldFrames = wfile->NumberOfFrames;
+	 
+	while(wfile->NumberOfFrames < FrameIndex + NumFrames){
+		if(AllocateFrame( wfile) != 0){	//allocates the amount of frames needed
+			return(-1);
 		}
-	
-		READ = create_cart_opcode(CART_OP_RDFRME,0,CT1,FM1);		//Cart opcode to read from the incomplete frame
-		client_cart_bus_request(READ,writebuf);
+	}
 
-		memcpy(&writebuf[byteOffset],mbuf, min(BytesToWrite,CART_FRAME_SIZE - byteOffset)); //Copy the bytes from buf to writebuf
-		//The number of bytes written is either count or the remainder of the frame to be written, whichever is less
+	if(wfile->fp + count > wfile->filesize)
+		wfile->filesize = wfile->fp +count;
 
-		WRITE = create_cart_opcode(CART_OP_WRFRME,0, CT1, FM1);		//Write to the frame
-		client_cart_bus_request(WRITE,writebuf);
-		put_cart_cache(CT1,FM1,writebuf);
+	writebuf = calloc(NumFrames, CART_FRAME_SIZE);
 
-		BytesToWrite = BytesToWrite - min(CART_FRAME_SIZE - byteOffset, BytesToWrite); //Update the bytes to be written
-		
-		FrameIndex++; //Move to the next frame in the file
-		i =1;			//Set i equal to one for offset purposes
-		
-	}
-	
+	memcpy(&writebuf[byteOffset], buf, count);
 
-	while(BytesToWrite > 0){	//for "empty frames"
-		
-		file_ExtractFrame(wfile -> CartFrame[FrameIndex], &FM1, &CT1);				//extract cart and frame numbers
-		
-		if (CT1 != CurrentCart){										// Load new cartridge if needed
-		LOADCART = create_cart_opcode(CART_OP_LDCART,0 ,CT1,0);
-		client_cart_bus_request(LOADCART,NULL);
-		CurrentCart = CT1;
+	//Frames at either end that the write only covers part of
+	int HeadPartial = (byteOffset != 0) || (NumFrames == 1 && lastEnd != 0);
+	int TailPartial = (lastEnd != 0) && !(NumFrames == 1 && HeadPartial);
+	int FullStart = HeadPartial ? 1 : 0;
+	int FullEnd = TailPartial ? LastFrame : NumFrames;
+
+	if(PartialWrites && !DedupFrames && !LfsCartridges){
+		//Ship just the new bytes of the partial frames, whole frames go as frames
+		if(HeadPartial && cart_write_partial(wfile->CartFrame[FrameIndex], byteOffset,
+				&writebuf[byteOffset], min(count, CART_FRAME_SIZE - byteOffset)) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Error: Partial frame write failed \n");
+			free(writebuf);
+			return(-1);
+		}
+		if(TailPartial && cart_write_partial(wfile->CartFrame[FrameIndex+LastFrame], 0,
+				&writebuf[LastFrame*CART_FRAME_SIZE], lastEnd) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Error: Partial frame write failed \n");
+			free(writebuf);
+			return(-1);
+		}
+		if(FullEnd > FullStart && cart_store_frames(&wfile->CartFrame[FrameIndex+FullStart],
+				FullEnd - FullStart, &writebuf[FullStart*CART_FRAME_SIZE]) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Error: Frame write failed \n");
+			free(writebuf);
+			return(-1);
+		}
+	}
+	else{
+		//Only the partially written frames need their old contents, and only
+		//if they held file data before this write
+		if(HeadPartial && ((int64_t)FrameIndex*CART_FRAME_SIZE) < OldSize){
+			if(cart_load_frames(&wfile->CartFrame[FrameIndex], 1, 0, writebuf) != 0){
+				free(writebuf);
+				return(-1);
+			}
+			memcpy(&writebuf[byteOffset], buf, min(count, CART_FRAME_SIZE - byteOffset));
+		}
+		if(TailPartial && ((int64_t)(FrameIndex+LastFrame)*CART_FRAME_SIZE) < OldSize){
+			if(cart_load_frames(&wfile->CartFrame[FrameIndex+LastFrame], 1, 0,
+					&writebuf[LastFrame*CART_FRAME_SIZE]) != 0){
+				free(writebuf);
+				return(-1);
+			}
+			memcpy(&writebuf[LastFrame*CART_FRAME_SIZE], (char *)buf + (count - lastEnd), lastEnd);
 		}
-		READ = create_cart_opcode(CART_OP_RDFRME,0,CT1,FM1);			//Read frame to prevent complete overwrite
-		client_cart_bus_request(READ,writebuf);
-		memcpy(writebuf,&mbuf[(i*CART_FRAME_SIZE)-byteOffset], min(BytesToWrite, CART_FRAME_SIZE)); //either copies an entire frame
-		// or BytesToWrite
 
-		WRITE = create_cart_opcode(CART_OP_WRFRME,0, CT1, FM1); 		//Send Write opcode
-		client_cart_bus_request(WRITE,writebuf);
-		put_cart_cache(CT1,FM1,writebuf);
+		//The log writes frames the file already had at its head instead of in place
+		if(FrameIndex < OldFrames && cart_lfs_relocate(wfile, FrameIndex, min(NumFrames, OldFrames - FrameIndex)) != 0){
+			free(writebuf);
+			return(-1);
+		}
 
-		BytesToWrite = BytesToWrite - min(CART_FRAME_SIZE, BytesToWrite); // Update the BytesToWrite
-		
-		FrameIndex++;// move to the next frame
-		i++;			//Increment i to modify the address of the source mbuf in memcpy
+		//Write all of the frames out
+		if(cart_store_frames(&wfile->CartFrame[FrameIndex], NumFrames, writebuf) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Error: Frame write failed \n");
+			free(writebuf);
+			return(-1);
+		}
 	}
 
 	wfile->fp  = wfile -> fp +count;
 	
-	free(mbuf);
 	free(writebuf);
 
 	return (count);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_write_append
+// Description  : Append to a file through its buffer.  The buffer holds the
+//                new bytes of the file's last frame and goes out when the
+//                frame fills, so small appends cost one frame write per
+//                frame rather than one (or a read and a write) each
+//
+// Inputs       : wfile - the file, positioned at its end
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written if successful, -1 if failure
+
+static int32_t cart_write_append(file *wfile, char *buf, int32_t count) {
+	int32_t done = 0, off, n, whole;
+
+	if(wfile->wbuf == NULL && (wfile->wbuf = malloc(CART_FRAME_SIZE)) == NULL){
+		return(cart_write_through(wfile, buf, count));
+	}
+	coalescedwrites++;
+	while(done < count){
+		if(wfile->buflen == 0){
+			//Whole frames starting on a frame boundary don't need the buffer
+			wfile->bufstart = wfile->fp;
+			whole = (count - done) - (count - done) % CART_FRAME_SIZE;
+			if(wfile->fp % CART_FRAME_SIZE == 0 && whole > 0){
+				if(cart_write_through(wfile, &buf[done], whole) < 0){
+					return(-1);
+				}
+				done += whole;
+				continue;
+			}
+		}
+		off = (wfile->bufstart + wfile->buflen) % CART_FRAME_SIZE;
+		n = min(count - done, CART_FRAME_SIZE - off);
+		memcpy(&wfile->wbuf[off], &buf[done], n);
+		wfile->buflen += n;
+		wfile->fp += n;
+		wfile->filesize = wfile->fp;
+		done += n;
+		if(off + n == CART_FRAME_SIZE && cart_flush_file(wfile) != 0){
+			return(-1);
+		}
+	}
+	return(count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_flush_file
+// Description  : Write out a file's append buffer.  The buffered bytes are
+//                always the end of the file
+//
+// Inputs       : wfile - the file
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_flush_file(file *wfile) {
+	int64_t fp = wfile->fp;
+	int32_t len = wfile->buflen, ret;
+
+	if(len == 0){
+		return(0);
+	}
+	bufferflushes++;
+	wfile->buflen = 0;
+	wfile->fp = wfile->bufstart;
+	wfile->filesize = wfile->bufstart;
+	ret = cart_write_through(wfile, &wfile->wbuf[wfile->bufstart % CART_FRAME_SIZE], len);
+	wfile->fp = fp;
+	if(ret < 0){
+		logMessage(LOG_ERROR_LEVEL, "Error: Append buffer flush failed \n");
+		return(-1);
+	}
+	return(0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : cart_read
@@ -389,25 +943,75 @@ int32_t cart_write(int16_t fd, void *buf, int32_t count) {
 //                loc - offfset of file in relation to beginning of file
 // Outputs      : 0 if successful, -1 if failure
 
-int32_t cart_seek(int16_t fd, uint32_t loc) {
+int32_t cart_seek(int16_t fd, uint64_t loc) {
 	
-	if(fd > FileCounter || fd < 1){
+	file *sfile = cart_handle_file(fd);
+
+	if(sfile == NULL){
 		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle. \n");
-		return(-1);									//Failure: bad file handle
+		return(-1);									//Failure: bad file handle (or file not open)
 	}
-	if (files[fd-1].status == CLOSED){
-		logMessage(LOG_ERROR_LEVEL, "Error: File not open. \n");
-		return(-1);									//Failure: file not open
+	if (loc < (uint64_t)sfile->filesize && cart_flush_file(sfile) != 0){
+		return(-1);									//Failure: buffered writes lost (a seek to the end keeps them)
 	}
-	if (loc > files[fd-1].filesize){				//if the loc is greater than the total filesize
-		files[fd-1].fp = files[fd-1].filesize;		//set file pointer to the end of the file
+	if (loc > (uint64_t)sfile->filesize){			//if the loc is greater than the total filesize
+		sfile->fp = sfile->filesize;				//set file pointer to the end of the file
 		return(0);
 	}													
-	files[fd-1].fp = loc;
+	sfile->fp = loc;
 	// Return successfully
 	return (0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_file_size
+// Description  : Return the size of an open file
+//
+// Inputs       : fd - the file handle
+// Outputs      : the size in bytes, -1 if failure
+
+int64_t cart_file_size(int16_t fd) {
+	file *sfile = cart_handle_file(fd);
+
+	if(sfile == NULL){
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle. \n");
+		return(-1);
+	}
+	return(sfile->filesize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_cached_frame
+// Description  : Return the cache's copy of a frame of a file without
+//                copying it, so callers can scan cached data in place.  The
+//                frame is only good until the next driver call, which may
+//                evict it
+//
+// Inputs       : fd - the file handle
+//                frame - the frame of the file (offset / CART_FRAME_SIZE)
+// Outputs      : the cached frame, NULL if it isn't cached (or bad handle)
+
+const void *cart_cached_frame(int16_t fd, uint32_t frame) {
+	uint16_t FM1, CT1;
+	void *cachebuf;
+	file *cfile = cart_handle_file(fd);
+
+	if(cfile == NULL || frame >= cfile->NumberOfFrames){
+		return(NULL);
+	}
+	//The frame the append buffer is filling is out of date until it's flushed
+	if(cfile->buflen > 0 && frame >= (uint64_t)(cfile->bufstart / CART_FRAME_SIZE)){
+		return(NULL);
+	}
+	file_ExtractFrame(cfile->CartFrame[frame], &FM1, &CT1);
+	if((cachebuf = get_cart_cache(CT1, FM1)) != NULL){
+		cachehits++;
+	}
+	return(cachebuf);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : create_cart_opcode
@@ -482,7 +1086,7 @@ int16_t extract_cart_opcode(CartXferRegister resp, char *KY1, char *KY2, char *R
 //                
 // Outputs      : 0 if successful, frame number and cartridge number
 
-int32_t file_ExtractFrame(uint16_t location, uint16_t* frame, uint16_t *cartridge){
+int32_t file_ExtractFrame(uint32_t location, uint16_t* frame, uint16_t *cartridge){
 	*frame = location & 0x03FF;
 	*cartridge  = location >> 10;
 
@@ -498,21 +1102,1320 @@ int32_t file_ExtractFrame(uint16_t location, uint16_t* frame, uint16_t *cartridg
 // Outputs      : 0 if successful, (By reference) struct file
 
 int16_t AllocateFrame(file *file){
-	int i = file->NumberOfFrames;	//sets i to the current number of frames in the file
-	if (i==0){
-		file-> CartFrame = malloc((i+1)*sizeof(uint16_t));
-		file->CartFrame[i] = NextFrame;	//the file's frame araay is updated with the next frame available			
+	uint32_t i = file->NumberOfFrames;	//sets i to the current number of frames in the file
+	//stripe the file over the replica groups then the connections to them,
+	//each file starting on a different one
+	uint32_t chunk = CART_FILE_INDEX(file) + 1 + i / StripeUnit, groups = NumServers / Replicas;
+	uint32_t location = cart_new_frame((chunk % groups) * Replicas * Connections + (chunk / groups) % Connections);
+	if(location == CART_NO_FRAME){
+		return(-1);
 	}
-	else{
-		file->CartFrame = realloc(file->CartFrame,(i+1)*sizeof(uint16_t));
-		file ->CartFrame[i] = NextFrame;
-	}					
-		file -> NumberOfFrames++;
-		NextFrame++;
-		//the file's number of frames are updated
+	if(LfsCartridges){
+		FrameOwner[location] = ((uint64_t)(CART_FILE_INDEX(file) + 1) << 32) | i;
+	}
+	if (i == file->FrameCapacity){		//the frame array doubles as it fills
+		file->FrameCapacity = (i == 0) ? 1 : 2*i;
+		file->CartFrame = realloc(file->CartFrame, file->FrameCapacity*sizeof(uint32_t));
+	}
+	file->CartFrame[i] = location;		//the file's frame araay is updated with the next frame available
+	file -> NumberOfFrames++;
+	//the file's number of frames are updated
 	return (0);
 
 }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lane
+// Description  : Find the connection (lane) that carries a cartridge's
+//                traffic to a server, each connection owns a share of the
+//                cartridges so its loaded cartridge changes less often
+//
+// Inputs       : server - the server
+//                cart - the cartridge on that server
+// Outputs      : the lane
+
+static int cart_lane(int server, CartridgeIndex cart){
+	return(server * Connections + cart % Connections);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_new_frame
+// Description  : Hand out an unused frame location from a connection's
+//                cartridges (those cart_lane gives it), frames freed by dedup
+//                are used first.  In log mode it comes from the head of the
+//                connection's log
+//
+// Inputs       : lane - the connection the frame should be reached through
+// Outputs      : the frame location, CART_NO_FRAME if there is no room
+
+uint32_t cart_new_frame(int lane){
+	uint32_t location, frame, share, used = 0;
+	int c;
+
+	if(LfsCartridges){
+		return(cart_lfs_frame(lane));
+	}
+	if(DedupFrames && NumFreeFrames > 0){
+		location = FreeFrames[--NumFreeFrames];
+	}
+	else{
+		//Past the server's last cartridge the location would name the next server
+		for(c = 0; c < Connections; c++){
+			used += NextFrame[(lane / Connections) * Connections + c];
+		}
+		if(used >= CART_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE){
+			logMessage(LOG_ERROR_LEVEL, "Error: Server %d has no free frames \n", lane / Connections);
+			return(CART_NO_FRAME);
+		}
+		//The connection gets every Connections'th cartridge of the server
+		share = (CART_MAX_CARTRIDGES - lane % Connections + Connections - 1) / Connections;
+		if(NextFrame[lane] / CART_CARTRIDGE_SIZE >= share){
+			logMessage(LOG_ERROR_LEVEL, "Error: Connection %d of server %d has no free frames \n",
+				lane % Connections, lane / Connections);
+			return(CART_NO_FRAME);
+		}
+		frame = NextFrame[lane]++;
+		location = CART_LOCATION(lane / Connections,
+			(frame / CART_CARTRIDGE_SIZE) * Connections + lane % Connections, frame % CART_CARTRIDGE_SIZE);
+	}
+	if(DedupFrames){
+		FrameRefs[location] = 1;
+	}
+	return(location);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_now
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in usec
+
+static uint64_t cart_bus_now(void){
+	struct timespec now;
+
+	if(SimBus){
+		return(SimNow/1000);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_sim_bus_cost
+// Description  : Charge a request to a lane of the simulated bus: it starts
+//                when the lane has finished what was sent before it (or
+//                now), and takes the per-request cost, the per-byte cost and
+//                the switch cost if it loads a different cartridge
+//
+// Inputs       : lane - the connection
+//                reg - the request register
+//                bytes - the bytes it moves, registers included
+// Outputs      : when it finishes (nsec of virtual time)
+
+static uint64_t cart_sim_bus_cost(int lane, CartXferRegister reg, uint64_t bytes){
+	uint64_t code = (reg & KY1_MASK) >> 56, cart = (reg & CT1_MASK) >> 31;
+	uint64_t cost = SimOpNanos + bytes*SimByteNanos;
+
+	if(code == CART_OP_LDCART && cart != SimMounted[lane]){
+		cost += SimSwitchNanos;
+		SimMounted[lane] = cart;
+		simswitches++;
+	}
+	else if(code == CART_OP_INITMS || code == CART_OP_POWOFF){
+		SimMounted[lane] = CART_NO_CARTRIDGE;
+	}
+	SimLaneFree[lane] = ((SimLaneFree[lane] > SimNow) ? SimLaneFree[lane] : SimNow) + cost;
+	return(SimLaneFree[lane]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_sim_bus_next
+// Description  : Pick the lane of the simulated bus whose oldest request
+//                finishes first.  If none finishes within the timeout the
+//                clock moves on by the timeout instead
+//
+// Inputs       : lanes - the lanes with requests outstanding
+//                count - how many there are
+//                timeout - how long to wait (usec), -1 for no limit
+// Outputs      : the lane that answers, -1 if none does in time
+
+static int cart_sim_bus_next(int *lanes, int count, int64_t timeout){
+	int i, best = lanes[0];
+	uint64_t done;
+
+	for(i = 1; i < count; i++){
+		if(BusPending[lanes[i]][BusHead[lanes[i]]].done < BusPending[best][BusHead[best]].done){
+			best = lanes[i];
+		}
+	}
+	done = BusPending[best][BusHead[best]].done;
+	if(timeout >= 0 && done > SimNow + (uint64_t)timeout*1000){
+		SimNow += (uint64_t)timeout*1000;
+		return(-1);
+	}
+	return(best);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_take
+// Description  : Read the response to the oldest request outstanding on a
+//                lane (into the scratch frames if it is stale) and update
+//                its server's smoothed latency
+//
+// Inputs       : lane - the connection
+//                op - where to put the op the request carried (may be NULL)
+// Outputs      : the response register
+
+static CartXferRegister cart_bus_take(int lane, int *op){
+	CartBusPending *pending = &BusPending[lane][BusHead[lane]];
+	int server = lane / Connections;
+	CartXferRegister RESP;
+	uint64_t sample;
+
+	if(SimBus){
+		RESP = cart_io_bus_session(&SimLoaded[lane], pending->reg, pending->stale ? BusScratch : pending->buf);
+		if(pending->done > SimNow){
+			SimNow = pending->done;
+		}
+	}
+	else if(DirectBus){
+		RESP = cart_io_bus(pending->reg, pending->stale ? BusScratch : pending->buf);
+	}
+	else{
+		RESP = client_cart_bus_recv(lane, pending->reg, pending->stale ? BusScratch : pending->buf);
+	}
+
+	CART_TIMELINE_END(pending->stale ? "stale" : "bus", BusOpNames[(pending->reg & KY1_MASK) >> 56],
+		CART_TIMELINE_LANE_TRACK + lane, pending->traced, "cart,frame,count",
+		(pending->reg & CT1_MASK) >> 31, (pending->reg & FM1_MASK) >> 15, pending->reg & CNT_MASK);
+
+	//Stale responses still show how slow the server is
+	sample = cart_bus_now() - pending->sent;
+	ServerLatency[server] = (ServerLatency[server] == 0) ? sample : (7*ServerLatency[server] + sample)/8;
+	if(op != NULL){
+		*op = pending->stale ? CART_BUS_STALE : pending->op;
+	}
+	BusHead[lane] = (BusHead[lane] + 1) % CART_BUS_DEPTH;
+	BusCount[lane]--;
+	return(RESP);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_post
+// Description  : Send a request on a lane and queue it to have its
+//                response read, keeping the bus statistics.  In direct mode
+//                the request is run when its response is taken
+//
+// Inputs       : lane - the connection
+//                reg - the request register
+//                buf - the frame(s) or payload for the request
+//                op - the transfer request it carries, -1 if none
+// Outputs      : 0 if successful, -1 if failure
+
+static int cart_bus_post(int lane, CartXferRegister reg, void *buf, int op){
+	uint64_t code = (reg & KY1_MASK) >> 56, cnt = reg & CNT_MASK, bytes;
+	CartBusPending *pending;
+
+	//Only stale responses can pile up this deep, clear them out of the way
+	while(BusCount[lane] == CART_BUS_DEPTH){
+		cart_bus_take(lane, NULL);
+	}
+
+	busrequests++;
+	bytes = 2*sizeof(CartXferRegister);
+	if(code == CART_OP_RDFRME || code == CART_OP_WRFRME){
+		bytes += CART_FRAME_SIZE;
+	}
+	else if(code == CART_OP_RDFRMS || code == CART_OP_WRFRMS){
+		bytes += cnt*CART_FRAME_SIZE;
+	}
+	else if(code == CART_OP_WRPART && cnt > 0){
+		bytes += CART_PARTIAL_HEADER_SIZE + cnt;
+	}
+	busbytes += bytes;
+
+	pending = &BusPending[lane][(BusHead[lane] + BusCount[lane]) % CART_BUS_DEPTH];
+	pending->reg = reg;
+	pending->buf = buf;
+	pending->op = op;
+	pending->stale = 0;
+	pending->sent = cart_bus_now();
+	pending->traced = CART_TIMELINE_BEGIN();
+	if(SimBus){
+		pending->done = cart_sim_bus_cost(lane, reg, bytes);
+	}
+	else if(!DirectBus && client_cart_bus_send(lane, reg, buf) != 0){
+		return(-1);
+	}
+	BusCount[lane]++;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_drop
+// Description  : Mark the copy of a transfer request on a lane stale, its
+//                response is read and thrown away later
+//
+// Inputs       : lane - the connection
+//                op - the transfer request
+// Outputs      : none
+
+static void cart_bus_drop(int lane, int op){
+	int i;
+	CartBusPending *pending;
+
+	for(i = 0; i < BusCount[lane]; i++){
+		pending = &BusPending[lane][(BusHead[lane] + i) % CART_BUS_DEPTH];
+		if(pending->op == op && !pending->stale){
+			pending->stale = 1;
+			return;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_ready
+// Description  : Wait for a lane with outstanding requests to answer
+//
+// Inputs       : timeout - how long to wait (usec), -1 for no limit
+// Outputs      : the lane that answered, -1 if none did in time
+
+static int cart_bus_ready(int64_t timeout){
+	int lanes[CART_MAX_LANES], count = 0, l;
+
+	for(l = 0; l < NumLanes; l++){
+		if(BusCount[l] > 0){
+			lanes[count++] = l;
+		}
+	}
+	if(count == 0){
+		return(-1);
+	}
+	if(SimBus){
+		return(cart_sim_bus_next(lanes, count, timeout));
+	}
+	if(DirectBus || (count == 1 && timeout < 0)){
+		return(lanes[0]);
+	}
+	return(client_cart_bus_wait(lanes, count, timeout));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_send
+// Description  : Send a request on a lane without waiting for the response
+//
+// Inputs       : lane - the connection
+//                reg - the request register
+//                buf - the frame(s) or payload for the request
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_bus_send(int lane, CartXferRegister reg, void *buf){
+	return(cart_bus_post(lane, reg, buf, -1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_recv
+// Description  : Receive the response to the oldest request still wanted
+//                on a lane, throwing away stale responses ahead of it
+//
+// Inputs       : lane - the connection
+// Outputs      : the response register
+
+CartXferRegister cart_bus_recv(int lane){
+	CartXferRegister RESP = -1;
+	int op = CART_BUS_STALE;
+
+	while(op == CART_BUS_STALE && BusCount[lane] > 0){
+		RESP = cart_bus_take(lane, &op);
+	}
+	return(RESP);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_request
+// Description  : Issue a request on a lane and wait for the response.  The
+//                request goes to the server, or straight to the in-process
+//                controller in direct mode
+//
+// Inputs       : lane - the connection
+//                reg - the request register
+//                buf - the frame(s) or payload for the request
+// Outputs      : the response register
+
+CartXferRegister cart_bus_request(int lane, CartXferRegister reg, void *buf){
+	if(cart_bus_send(lane, reg, buf) != 0){
+		return(-1);
+	}
+	return(cart_bus_recv(lane));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_broadcast
+// Description  : Issue a request with no frames to every server, sending to
+//                all of them before waiting on any
+//
+// Inputs       : reg - the request register
+//                every - non-zero to send it on every connection, zero for
+//                        the first connection to each server
+// Outputs      : 0 if every server succeeded, -1 if any failed
+
+int16_t cart_bus_broadcast(CartXferRegister reg, int every){
+	int l, sent[CART_MAX_LANES], ret = 0;
+
+	for(l = 0; l < NumLanes; l++){
+		sent[l] = (every || l % Connections == 0) ? (cart_bus_send(l, reg, NULL) == 0) : -1;
+	}
+	for(l = 0; l < NumLanes; l++){
+		if(sent[l] == 0 || (sent[l] == 1 && (cart_bus_recv(l) & RT_MASK))){
+			ret = -1;
+		}
+	}
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : create_cart_xfer_opcode
+// Description  : Create a packed register for a multi-frame transfer
+//
+// Inputs       : KY1- opcode, CT1- Cart Number, FM1- First Frame Number
+//                CNT- number of frames
+// Outputs      : packed_opcode- a 64 bit opcode to send over the I/O bus
+
+CartXferRegister create_cart_xfer_opcode(uint64_t KY1, uint64_t CT1, uint64_t FM1, uint64_t CNT){
+	return (create_cart_opcode(KY1, 0, CT1, FM1) | (CNT & CNT_MASK));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_load_cartridge
+// Description  : Load a cartridge on a lane, unless it is the current one
+//
+// Inputs       : lane - the connection
+//                cart - the cartridge to load
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_load_cartridge(int lane, CartridgeIndex cart){
+	CartXferRegister RESP;
+
+	if(cart == CurrentCart[lane]){
+		return(0);
+	}
+	RESP = cart_bus_request(lane, create_cart_opcode(CART_OP_LDCART,0,cart,0),NULL);
+	if(RESP & RT_MASK){
+		logMessage(LOG_ERROR_LEVEL, "Error: Load of cartridge %d on server %d failed \n", cart, lane / Connections);
+		CurrentCart[lane] = CART_NO_CARTRIDGE;
+		return(-1);
+	}
+	CurrentCart[lane] = cart;
+	cartloads++;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_transfer
+// Description  : Read or write runs of frames.  Each connection (lane) gets
+//                its own list of requests (cartridge loads, then one
+//                RDFRMS/WRFRMS per run when supported, single frames
+//                otherwise) and keeps one of them in flight, so the servers,
+//                and the connections to each, work in parallel.  Writes go
+//                to every replica; a read goes to the replica expected to
+//                finish it soonest, and is sent to an idle replica as well
+//                if the first is slow to answer (a hedged read)
+//
+// Inputs       : runs - the runs of frames (cart counted across servers)
+//                nruns - the number of runs
+//                write - non-zero to write the frames, zero to read them
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_bus_transfer(CartBusRun *runs, int nruns, int write){
+	CartXferRegister *regs, RESP;
+	char **bufs;
+	int *target, *owner, *partner;
+	int first[CART_MAX_LANES+1], next[CART_MAX_LANES], inflight[CART_MAX_LANES];
+	uint64_t *sent, queued[CART_MAX_SERVERS], cost, best, now, due, code;
+	int i, j, s, l, t, r, op, group, n = 0, frames = 0, waiting, ret = 0;
+	int64_t timeout;
+	CartridgeIndex cart;
+
+	for(i = 0; i < nruns; i++){
+		frames += runs[i].count;
+	}
+	regs = malloc(Replicas * (frames + nruns) * sizeof(CartXferRegister));
+	bufs = malloc(Replicas * (frames + nruns) * sizeof(char *));
+	owner = malloc(Replicas * (frames + nruns) * sizeof(int));
+	partner = malloc(Replicas * (frames + nruns) * sizeof(int));
+	sent = malloc(Replicas * (frames + nruns) * sizeof(uint64_t));
+	target = malloc(nruns * sizeof(int));
+
+	//Send each read to the replica with the least work queued, weighted by
+	//how quickly it has been answering
+	memset(queued, 0x0, sizeof(queued));
+	for(i = 0; i < nruns; i++){
+		target[i] = CART_SERVER_OF(runs[i].cart);
+		for(s = target[i], best = 0; !write && s < CART_SERVER_OF(runs[i].cart) + Replicas; s++){
+			cost = (queued[s] + runs[i].count) * (ServerLatency[s] + 1);
+			if(best == 0 || cost < best){
+				best = cost;
+				target[i] = s;
+			}
+		}
+		queued[target[i]] += runs[i].count;
+	}
+
+	//Lay out each lane's requests, following the cartridge it will have loaded
+	for(l = 0; l < NumLanes; l++){
+		first[l] = next[l] = n;
+		s = l / Connections;
+		for(i = 0; i < nruns; i++){
+			cart = CART_CARTRIDGE_OF(runs[i].cart);
+			if((write ? (s - s % Replicas) != CART_SERVER_OF(runs[i].cart) : target[i] != s) ||
+			   cart_lane(s, cart) != l){
+				continue;
+			}
+			if(cart != CurrentCart[l]){
+				owner[n] = l;
+				regs[n] = create_cart_opcode(CART_OP_LDCART,0,cart,0);
+				bufs[n++] = NULL;
+				CurrentCart[l] = cart;
+				cartloads++;
+			}
+			if(BatchedFrames && runs[i].count > 1){
+				owner[n] = l;
+				regs[n] = create_cart_xfer_opcode(write ? CART_OP_WRFRMS : CART_OP_RDFRMS, cart, runs[i].frm, runs[i].count);
+				bufs[n++] = runs[i].buf;
+				continue;
+			}
+			for(j = 0; j < runs[i].count; j++){
+				owner[n] = l;
+				regs[n] = create_cart_opcode(write ? CART_OP_WRFRME : CART_OP_RDFRME, 0, cart, runs[i].frm+j);
+				bufs[n++] = &runs[i].buf[j*CART_FRAME_SIZE];
+			}
+		}
+		inflight[l] = -1;
+	}
+	first[NumLanes] = n;
+	for(i = 0; i < n; i++){
+		partner[i] = -1;
+	}
+	if(write){
+		frameswritten += frames * Replicas;
+	}
+	else{
+		framesread += frames;
+	}
+
+	for(;;){
+		//Keep a request in flight on every lane with work left
+		waiting = 0;
+		for(l = 0; l < NumLanes; l++){
+			if(inflight[l] == -1 && next[l] < first[l+1]){
+				if(cart_bus_post(l, regs[next[l]], bufs[next[l]], next[l]) != 0){
+					logMessage(LOG_ERROR_LEVEL, "Error: Transfer on server %d failed \n", l / Connections);
+					CurrentCart[l] = CART_NO_CARTRIDGE;
+					next[l] = first[l+1];
+					ret = -1;
+					continue;
+				}
+				sent[next[l]] = cart_bus_now();
+				inflight[l] = next[l]++;
+			}
+			waiting += (inflight[l] != -1);
+		}
+		if(waiting == 0){
+			break;
+		}
+
+		//Wait no longer than the first hedge is due
+		timeout = -1;
+		now = cart_bus_now();
+		for(l = 0; !write && Replicas > 1 && l < NumLanes; l++){
+			op = inflight[l];
+			code = (op == -1) ? 0 : (regs[op] & KY1_MASK) >> 56;
+			if(op == -1 || owner[op] != l || partner[op] != -1 ||
+			   (code != CART_OP_RDFRME && code != CART_OP_RDFRMS)){
+				continue;
+			}
+			due = sent[op] + (HedgeDelay ? HedgeDelay : 2*ServerLatency[l / Connections] + CART_HEDGE_MIN_US);
+			if(due <= now){
+				//Hedge on the same connection of a replica with nothing else to do
+				cart = (regs[op] & CT1_MASK) >> 31;
+				group = (l / Connections) - (l / Connections) % Replicas;
+				for(s = group; s < group + Replicas; s++){
+					t = cart_lane(s, cart);
+					if(t == l || inflight[t] != -1 || next[t] < first[t+1] || BusCount[t] > CART_BUS_DEPTH-2){
+						continue;
+					}
+					if(cart != CurrentCart[t]){
+						if(cart_bus_post(t, create_cart_opcode(CART_OP_LDCART,0,cart,0), NULL, -1) != 0){
+							continue;
+						}
+						CurrentCart[t] = cart;
+						cartloads++;
+					}
+					if(cart_bus_post(t, regs[op], bufs[op], op) == 0){
+						inflight[t] = op;
+						partner[op] = t;
+						hedgessent++;
+					}
+					break;
+				}
+				continue;
+			}
+			if(timeout == -1 || (int64_t)(due - now) < timeout){
+				timeout = due - now;
+			}
+		}
+
+		if((r = cart_bus_ready(timeout)) == -1){
+			continue;
+		}
+		RESP = cart_bus_take(r, &op);
+		if(op == CART_BUS_STALE){
+			continue;
+		}
+		if(op == -1){
+			//The cartridge load ahead of a hedged read
+			if(RESP & RT_MASK){
+				CurrentCart[r] = CART_NO_CARTRIDGE;
+			}
+			continue;
+		}
+		inflight[r] = -1;
+		if(RESP & RT_MASK){
+			CurrentCart[r] = CART_NO_CARTRIDGE;
+			if(r != owner[op]){
+				continue;	//a failed hedge, the first copy may still succeed
+			}
+			//Give up on this lane, and don't trust the cartridge it has loaded
+			logMessage(LOG_ERROR_LEVEL, "Error: Transfer on server %d failed \n", r / Connections);
+			next[r] = first[r+1];
+			ret = -1;
+		}
+		else if(r != owner[op]){
+			hedgeswon++;
+		}
+
+		//The other copy of a hedged read isn't needed now
+		t = (r == owner[op]) ? partner[op] : owner[op];
+		if(t != -1 && inflight[t] == op){
+			cart_bus_drop(t, op);
+			inflight[t] = -1;
+		}
+		code = (regs[op] & KY1_MASK) >> 56;
+		if(!(RESP & RT_MASK) && (code == CART_OP_RDFRME || code == CART_OP_RDFRMS)){
+			ServerReads[r / Connections] += (code == CART_OP_RDFRMS) ? (regs[op] & CNT_MASK) : 1;
+		}
+	}
+
+	free(regs);
+	free(bufs);
+	free(owner);
+	free(partner);
+	free(sent);
+	free(target);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_write_partial
+// Description  : Write part of a frame with WRPART on every replica, shipping
+//                only the changed bytes, and patch the cached copy if there
+//                is one
+//
+// Inputs       : location - the frame location
+//                offset - the offset of the bytes in the frame
+//                data - the bytes to write
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_write_partial(uint32_t location, int32_t offset, char *data, int32_t len){
+	char payload[CART_PARTIAL_HEADER_SIZE + CART_FRAME_SIZE], frame[CART_FRAME_SIZE];
+	uint16_t FM1, CT1, netoff = htons((uint16_t)offset);
+	CartXferRegister WRPART;
+	char *cachebuf;
+	int server, s, ret = 0;
+
+	file_ExtractFrame(location, &FM1, &CT1);
+	server = CART_SERVER_OF(CT1);
+	for(s = server; s < server + Replicas; s++){
+		if(cart_load_cartridge(cart_lane(s, CART_CARTRIDGE_OF(CT1)), CART_CARTRIDGE_OF(CT1)) != 0){
+			return(-1);
+		}
+	}
+	memcpy(payload, &netoff, CART_PARTIAL_HEADER_SIZE);
+	memcpy(&payload[CART_PARTIAL_HEADER_SIZE], data, len);
+	WRPART = create_cart_xfer_opcode(CART_OP_WRPART,CART_CARTRIDGE_OF(CT1),FM1,len);
+	for(s = server; s < server + Replicas; s++){
+		if(cart_bus_send(cart_lane(s, CART_CARTRIDGE_OF(CT1)), WRPART, payload) != 0){
+			return(-1);
+		}
+	}
+	for(s = server; s < server + Replicas; s++){
+		if(cart_bus_recv(cart_lane(s, CART_CARTRIDGE_OF(CT1))) & RT_MASK){
+			ret = -1;
+		}
+	}
+	partialwrites++;
+	if(ret != 0){
+		return(-1);
+	}
+
+	//Keep the cached copy (if any) in step, there is no whole frame to insert
+	if((cachebuf = get_cart_cache(CT1, FM1)) != NULL){
+		memcpy(frame, cachebuf, CART_FRAME_SIZE);
+		memcpy(&frame[offset], data, len);
+		put_cart_cache(CT1, FM1, frame);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_contiguous_run
+// Description  : Count how many of the locations, from the first, sit in
+//                consecutive frames of the same cartridge
+//
+// Inputs       : locations - the frame locations
+//                count - the number of locations
+// Outputs      : the length of the run (at most CART_MAX_XFER_FRAMES)
+
+static int cart_contiguous_run(uint32_t *locations, int count){
+	int run = 1;
+	while(run < count && run < CART_MAX_XFER_FRAMES &&
+		  locations[run] == locations[0] + run &&
+		  (locations[run] >> 10) == (locations[0] >> 10)){
+		run++;
+	}
+	return(run);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_load_frames
+// Description  : Fill buf with the frames at the locations.  Cached frames
+//                are copied from the cache, runs of missing frames that are
+//                contiguous on a cartridge are fetched in one bus transfer.
+//                With no buf the missing frames are only fetched into the
+//                cache (prefetching them).  Frames read ahead count as read
+//                ahead when fetched, and not as cache hits or misses
+//
+// Inputs       : locations - the frame locations
+//                count - the number of frames
+//                ahead - how many of the last frames are read ahead
+//                buf - where to put the frames (count frames), NULL for none
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_load_frames(uint32_t *locations, int count, int ahead, char *buf){
+	uint16_t FM1, CT1, fm, ct;
+	char *cachebuf;
+	int i = 0, run, j, nruns = 0, ret = 0, fetched = 0, wanted = count - ahead, missed;
+	CartBusRun *runs = malloc(count * sizeof(CartBusRun));
+	char *scratch = (buf == NULL) ? malloc(count * CART_FRAME_SIZE) : NULL;
+
+	while(i < count){
+		file_ExtractFrame(locations[i], &FM1, &CT1);
+
+		//A frame read ahead that is already held isn't used, so isn't touched
+		if(i >= wanted && peek_cart_cache(CT1, FM1)){
+			i++;
+			continue;
+		}
+		cachebuf = (i < wanted) ? get_cart_cache(CT1, FM1) : NULL;
+		if(cachebuf != NULL && buf != NULL){
+			cachehits++;
+			memcpy(&buf[i*CART_FRAME_SIZE], cachebuf, CART_FRAME_SIZE);
+		}
+		if(cachebuf != NULL){
+			i++;
+			continue;
+		}
+
+		//Extend the miss over following frames that are contiguous and uncached
+		run = cart_contiguous_run(&locations[i], count - i);
+		for(j = 1; j < run; j++){
+			file_ExtractFrame(locations[i+j], &fm, &ct);
+			if((i+j < wanted) ? (get_cart_cache(ct, fm) != NULL) : peek_cart_cache(ct, fm)){
+				break;
+			}
+		}
+		run = j;
+		missed = (i + run <= wanted) ? run : ((i < wanted) ? wanted - i : 0);
+		if(buf != NULL){
+			cachemisses += missed;
+		}
+		readaheadframes += run - missed;
+
+		runs[nruns].cart = CT1;
+		runs[nruns].frm = FM1;
+		runs[nruns].count = run;
+		runs[nruns++].buf = (buf != NULL) ? &buf[i*CART_FRAME_SIZE] : &scratch[fetched*CART_FRAME_SIZE];
+		fetched += run;
+		i += run;
+	}
+
+	//Fetch all the misses together, so runs on different servers overlap
+	if(nruns > 0 && (ret = cart_bus_transfer(runs, nruns, 0)) == 0){
+		for(i = 0; i < nruns; i++){
+			for(j = 0; j < runs[i].count; j++){
+				put_cart_cache(runs[i].cart, runs[i].frm+j, &runs[i].buf[j*CART_FRAME_SIZE]);	//put the frame on the cache
+			}
+		}
+		if(buf == NULL){
+			prefetchedframes += fetched;
+		}
+	}
+	free(runs);
+	free(scratch);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_store_frames
+// Description  : Write the frames in buf to the locations (batching runs of
+//                contiguous frames) and update the cache.  Frames matching
+//                another frame of the batch share it only once it is written
+//
+// Inputs       : locations - the frame locations
+//                count - the number of frames
+//                buf - the frames to write (count frames)
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_store_frames(uint32_t *locations, int count, char *buf){
+	uint16_t FM1, CT1;
+	int i = 0, run, j, nruns = 0, ret = 0;
+	int16_t dedup;
+	char *write = NULL;
+	CartBusRun *runs = malloc(count * sizeof(CartBusRun));
+
+	//Frames whose contents are already stored just take a reference to them
+	if(DedupFrames){
+		write = malloc(count);
+		for(j = 0; j < count; j++){
+			if((dedup = cart_dedup_frame(&locations[j], &buf[j*CART_FRAME_SIZE])) < 0){
+				while(j-- > 0){
+					if(write[j] == 1){
+						cart_dedup_forget(locations[j]);
+					}
+				}
+				free(write);
+				free(runs);
+				return(-1);
+			}
+			write[j] = dedup;
+		}
+	}
+
+	while(i < count){
+		file_ExtractFrame(locations[i], &FM1, &CT1);
+		if(write != NULL && write[i] != 1){
+			if(!write[i]){
+				put_cart_cache(CT1, FM1, &buf[i*CART_FRAME_SIZE]);
+			}
+			i++;
+			continue;
+		}
+		run = cart_contiguous_run(&locations[i], count - i);
+		for(j = 1; write != NULL && j < run; j++){
+			if(write[i+j] != 1){
+				run = j;
+			}
+		}
+		runs[nruns].cart = CT1;
+		runs[nruns].frm = FM1;
+		runs[nruns].count = run;
+		runs[nruns++].buf = &buf[i*CART_FRAME_SIZE];
+		i += run;
+	}
+
+	//Write all the runs together, so runs on different servers overlap
+	if(nruns > 0 && (ret = cart_bus_transfer(runs, nruns, 1)) == 0){
+		for(i = 0; i < nruns; i++){
+			for(j = 0; j < runs[i].count; j++){
+				put_cart_cache(runs[i].cart, runs[i].frm+j, &runs[i].buf[j*CART_FRAME_SIZE]);
+			}
+		}
+	}
+
+	//Frames that were written can now be shared, and the frames matching them
+	//share them.  If the write failed nothing may share the unwritten frames
+	for(j = 0; write != NULL && j < count; j++){
+		if(write[j] == 1 && FrameDigest[locations[j]] != NULL){
+			if(ret == 0){
+				FrameDigest[locations[j]]->stored = 1;
+			}else{
+				cart_dedup_forget(locations[j]);
+			}
+		}
+	}
+	for(j = 0; write != NULL && ret == 0 && j < count; j++){
+		if(write[j] == 2){
+			if(cart_dedup_frame(&locations[j], &buf[j*CART_FRAME_SIZE]) != 0){
+				logMessage(LOG_ERROR_LEVEL, "Error: frame %u lost its duplicate before sharing it\n", locations[j]);
+				ret = -1;
+				break;
+			}
+			file_ExtractFrame(locations[j], &FM1, &CT1);
+			put_cart_cache(CT1, FM1, &buf[j*CART_FRAME_SIZE]);
+		}
+	}
+	free(write);
+	free(runs);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_stripe_unit
+// Description  : Set how many frames of a file go on a server before moving
+//                to the next one (must be called before poweron)
+//
+// Inputs       : frames - the stripe unit in frames
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_stripe_unit(int frames){
+	if(frames < 1){
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad stripe unit %d \n", frames);
+		return(-1);
+	}
+	StripeUnit = frames;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_replicas
+// Description  : Set how many servers hold a copy of each frame.  The
+//                servers are split into groups of this many, files are
+//                striped over the groups (must be called before poweron)
+//
+// Inputs       : replicas - the copies of each frame
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_replicas(int replicas){
+	if(replicas < 1 || replicas > CART_MAX_SERVERS){
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad replica count %d \n", replicas);
+		return(-1);
+	}
+	Replicas = replicas;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_hedge_delay
+// Description  : Set how long a read may wait on one replica before it is
+//                also sent to another
+//
+// Inputs       : usec - the delay, 0 for twice the server's recent latency
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_hedge_delay(uint32_t usec){
+	HedgeDelay = usec;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_direct_bus
+// Description  : Send requests straight to the in-process controller
+//                (cart_io_bus) rather than a server (must be called before
+//                poweron)
+//
+// Inputs       : enable - non-zero for the in-process controller
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_direct_bus(int enable){
+	DirectBus = enable;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_sim_bus
+// Description  : Run requests on the in-process controller in virtual time
+//                instead of sending them to a server (must be called before
+//                poweron).  Each connection to the server (-C) is a
+//                lane that works through its requests in order while the
+//                others work alongside it
+//
+// Inputs       : op - nsec every request costs
+//                swtch - nsec more for an LDCART of a different cartridge
+//                byte - nsec each byte moved costs, registers included
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_sim_bus(uint32_t op, uint32_t swtch, uint32_t byte){
+	SimBus = 1;
+	SimOpNanos = op;
+	SimSwitchNanos = swtch;
+	SimByteNanos = byte;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_dedup
+// Description  : Turn content-hash frame deduplication on or off (must be
+//                called before poweron)
+//
+// Inputs       : enable - non-zero to share frames with identical contents
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_dedup(int enable){
+	DedupFrames = enable;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_coalesce
+// Description  : Turn the per-file append buffers on or off (must be called
+//                before poweron)
+//
+// Inputs       : enable - non-zero to gather appends into whole frames
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_coalesce(int enable){
+	CoalesceWrites = enable;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_log_structured
+// Description  : Write every frame at the head of a log rather than in place
+//                (must be called before poweron)
+//
+// Inputs       : cartridges - cartridges of each connection's share the log
+//                may use (capped at the share), 0 to write in place
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_log_structured(int cartridges){
+	if(cartridges < 0){
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad log size %d \n", cartridges);
+		return(-1);
+	}
+	LfsCartridges = cartridges;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_dedup_forget
+// Description  : Remove a frame from the dedup index
+//
+// Inputs       : location - the frame location
+// Outputs      : none
+
+static void cart_dedup_forget(uint32_t location){
+	dedup_entry *entry = FrameDigest[location], **link;
+	uint32_t bucket;
+
+	if(entry == NULL){
+		return;
+	}
+	memcpy(&bucket, entry->digest, sizeof(bucket));
+	link = &DedupTable[bucket & (CART_DEDUP_BUCKETS-1)];
+	while(*link != entry){
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+	FrameDigest[location] = NULL;
+	free(entry);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_dedup_release
+// Description  : Drop a reference to a frame, freeing the frame for reuse
+//                when nothing refers to it
+//
+// Inputs       : location - the frame location
+// Outputs      : none
+
+void cart_dedup_release(uint32_t location){
+	if(--FrameRefs[location] == 0){
+		cart_dedup_forget(location);
+		FreeFrames[NumFreeFrames++] = location;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_dedup_frame
+// Description  : Hash a frame about to be written to *location.  If another
+//                frame already holds the contents, *location is pointed at it
+//                and nothing needs writing.  A shared frame is never written
+//                in place, *location is moved to a fresh frame first.  If the
+//                frame with the contents is still waiting to be written,
+//                *location is left alone until it is
+//
+// Inputs       : location - the frame location (may be changed)
+//                frame - the contents to write
+// Outputs      : 1 if the frame must be written to *location, 0 if not,
+//                2 if it matches a frame not written yet, -1 if there is
+//                no fresh frame to copy it to
+
+int16_t cart_dedup_frame(uint32_t *location, char *frame){
+	char digest[CART_DEDUP_DIGEST];
+	dedup_entry *entry;
+	uint32_t bucket;
+	uint32_t fresh;
+
+	gcry_md_hash_buffer(CMPSC311_HASH_TYPE, digest, frame, CART_FRAME_SIZE);
+	memcpy(&bucket, digest, sizeof(bucket));
+	bucket &= (CART_DEDUP_BUCKETS-1);
+	for(entry = DedupTable[bucket]; entry != NULL; entry = entry->next){
+		if(memcmp(entry->digest, digest, CART_DEDUP_DIGEST) == 0){
+			break;
+		}
+	}
+
+	//Same contents as a frame in this write, wait for it to reach the cartridge
+	if(entry != NULL && !entry->stored){
+		return(2);
+	}
+
+	//Same contents as a stored frame, share it
+	if(entry != NULL){
+		if(entry->location != *location){
+			FrameRefs[entry->location]++;
+			cart_dedup_release(*location);
+			*location = entry->location;
+		}
+		dedupavoided++;
+		return(0);
+	}
+
+	//New contents, copy the frame first if others still refer to it
+	if(FrameRefs[*location] > 1){
+		fresh = cart_new_frame(cart_lane(*location >> 16, CART_CARTRIDGE_OF(*location >> 10)));
+		if(fresh == CART_NO_FRAME){
+			return(-1);
+		}
+		cart_dedup_release(*location);
+		*location = fresh;
+		dedupcopies++;
+	}
+	cart_dedup_forget(*location);
+	entry = malloc(sizeof(dedup_entry));
+	memcpy(entry->digest, digest, CART_DEDUP_DIGEST);
+	entry->location = *location;
+	entry->stored = 0;
+	entry->next = DedupTable[bucket];
+	DedupTable[bucket] = entry;
+	FrameDigest[*location] = entry;
+	return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lfs_cart
+// Description  : Find a cartridge of a connection's share, counted across
+//                servers (location >> 10)
+//
+// Inputs       : lane - the connection
+//                slot - the cartridge's place in the share
+// Outputs      : the cartridge
+
+static uint32_t cart_lfs_cart(int lane, int slot){
+	return(((lane / Connections) << 6) | (slot * Connections + lane % Connections));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lfs_frame
+// Description  : Hand out the frame at the head of a connection's log.  When
+//                the head's cartridge is full it moves on to the next one
+//                with no live frames
+//
+// Inputs       : lane - the connection
+// Outputs      : the frame location, CART_NO_FRAME if no cartridge is clean
+
+static uint32_t cart_lfs_frame(int lane){
+	uint32_t location;
+	int s, slot = LfsCart[lane];
+
+	if(LfsNext[lane] == CART_CARTRIDGE_SIZE){
+		for(s = 1; s < LfsCartridges; s++){
+			slot = (LfsCart[lane] + s) % LfsCartridges;
+			if(LiveFrames[cart_lfs_cart(lane, slot)] == 0){
+				break;
+			}
+		}
+		if(s == LfsCartridges){
+			logMessage(LOG_ERROR_LEVEL, "Error: The log of connection %d is full \n", lane);
+			return(CART_NO_FRAME);
+		}
+		LfsCart[lane] = slot;
+		LfsNext[lane] = 0;
+	}
+	location = (cart_lfs_cart(lane, slot) << 10) | LfsNext[lane]++;
+	LiveFrames[location >> 10]++;
+	NextFrame[lane]++;
+	return(location);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lfs_release
+// Description  : Mark a frame dead, its cartridge is clean once none are left
+//
+// Inputs       : location - the frame location
+// Outputs      : none
+
+static void cart_lfs_release(uint32_t location){
+	FrameOwner[location] = 0;
+	LiveFrames[location >> 10]--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lfs_relocate
+// Description  : Give frames of a file new locations at the head of the log,
+//                before they are written (in log mode, nothing otherwise)
+//
+// Inputs       : lfile - the file
+//                first - the first frame of the file
+//                count - the number of frames
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_lfs_relocate(file *lfile, uint32_t first, uint32_t count){
+	uint32_t old, fresh, i;
+
+	for(i = first; LfsCartridges && i < first + count; i++){
+		old = lfile->CartFrame[i];
+		if((fresh = cart_new_frame(cart_lane(old >> 16, CART_CARTRIDGE_OF(old >> 10)))) == CART_NO_FRAME){
+			return(-1);
+		}
+		cart_lfs_release(old);
+		FrameOwner[fresh] = ((uint64_t)(CART_FILE_INDEX(lfile) + 1) << 32) | i;
+		lfile->CartFrame[i] = fresh;
+		lfsrelocated++;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lfs_clean_lane
+// Description  : Copy the live frames of a connection's emptiest cartridges
+//                to the head of its log until it has more than
+//                CART_LFS_RESERVE clean cartridges ahead of the head
+//
+// Inputs       : lane - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+static int16_t cart_lfs_clean_lane(int lane){
+	uint32_t victim, cart, base, locations[CART_CARTRIDGE_SIZE], fresh[CART_CARTRIDGE_SIZE];
+	uint64_t owners[CART_CARTRIDGE_SIZE];
+	int slot, clean, dead, n, i, rounds;
+	char *buf;
+
+	//Each round empties one cartridge, a pass over the share is the most a call does
+	for(rounds = 0; rounds < LfsCartridges; rounds++){
+		clean = 0;
+		dead = 0;
+		victim = CART_NO_FRAME;
+		for(slot = 0; slot < LfsCartridges; slot++){
+			cart = cart_lfs_cart(lane, slot);
+			if(slot == LfsCart[lane]){
+				continue;
+			}
+			if(LiveFrames[cart] == 0){
+				clean++;
+				continue;
+			}
+			dead += CART_CARTRIDGE_SIZE - LiveFrames[cart];
+			if(victim == CART_NO_FRAME || LiveFrames[cart] < LiveFrames[victim]){
+				victim = cart;
+			}
+		}
+		//Stop when there's room, or when packing the live frames tighter
+		//couldn't free a whole cartridge (the log is nearly full)
+		if(clean > CART_LFS_RESERVE || dead < CART_CARTRIDGE_SIZE){
+			return(0);
+		}
+
+		//Read the victim's live frames and write them at the head
+		base = victim << 10;
+		for(i = 0, n = 0; i < CART_CARTRIDGE_SIZE; i++){
+			if(FrameOwner[base + i] != 0){
+				locations[n] = base + i;
+				owners[n++] = FrameOwner[base + i];
+			}
+		}
+		buf = malloc(n * CART_FRAME_SIZE);
+		if(cart_load_frames(locations, n, 0, buf) != 0){
+			free(buf);
+			return(-1);
+		}
+		for(i = 0; i < n; i++){
+			if((fresh[i] = cart_lfs_frame(lane)) == CART_NO_FRAME){
+				while(i-- > 0){
+					cart_lfs_release(fresh[i]);
+				}
+				free(buf);
+				return(-1);
+			}
+		}
+		if(cart_store_frames(fresh, n, buf) != 0){
+			logMessage(LOG_ERROR_LEVEL, "Error: Cleaning cartridge %u failed \n", victim);
+			for(i = 0; i < n; i++){
+				cart_lfs_release(fresh[i]);
+			}
+			free(buf);
+			return(-1);
+		}
+		for(i = 0; i < n; i++){
+			cart_lfs_release(locations[i]);
+			FrameOwner[fresh[i]] = owners[i];
+			files[(owners[i] >> 32) - 1].CartFrame[owners[i] & 0xFFFFFFFF] = fresh[i];
+		}
+		free(buf);
+		lfscleaned++;
+		lfsmoved += n;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lfs_clean
+// Description  : Run the cleaner on every connection that is short of clean
+//                cartridges (in log mode, nothing otherwise).  It runs after
+//                writes, when no frame is waiting to be written
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_lfs_clean(void){
+	int lane;
+
+	for(lane = 0; LfsCartridges && lane < NumLanes; lane++){
+		if(cart_lfs_clean_lane(lane) != 0){
+			return(-1);
+		}
+	}
+	return(0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : min
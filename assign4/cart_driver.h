@@ -15,9 +15,17 @@
 #include <stdint.h>
 
 // Defines
-#define CART_MAX_TOTAL_FILES 1024 // Maximum number of files ever
+#define CART_MAX_OPEN_FILES 32767 // Maximum number of files open at once
 #define CART_MAX_PATH_LENGTH 128 // Maximum length of filename length
 
+// Access advice for cart_advise
+#define CART_ADVICE_NORMAL 0      // Read ahead once reads turn out to be sequential
+#define CART_ADVICE_SEQUENTIAL 1  // Read ahead as far as possible from the first read
+#define CART_ADVICE_RANDOM 2      // Never read ahead
+#define CART_ADVICE_WILLNEED 3    // Fetch the range into the cache now
+#define CART_ADVICE_DONTNEED 4    // Drop the range from the cache
+#define CART_ADVICE_NOREUSE 5     // Each read is used once: no read ahead, evict it first
+
 //
 // Interface functions
 
@@ -39,9 +47,51 @@ int32_t cart_read(int16_t fd, void *buf, int32_t count);
 int32_t cart_write(int16_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
-int32_t cart_seek(int16_t fd, uint32_t loc);
+int32_t cart_seek(int16_t fd, uint64_t loc);
 	// Seek to specific point in the file
 
+int64_t cart_file_size(int16_t fd);
+	// Return the size of an open file in bytes
+
+int32_t cart_advise(int16_t fd, uint64_t offset, uint64_t len, int advice);
+	// Say how a range of the file (len 0 for to the end) will be read
+
+const void *cart_cached_frame(int16_t fd, uint32_t frame);
+	// Return the cache's copy of a frame of the file, NULL if it isn't cached
+
+void *cart_mmap(int16_t fd, uint64_t offset, uint32_t len);
+	// Map part of a file into memory, its pages are read on first touch
+
+int32_t cart_msync(void *addr, uint32_t len);
+	// Write back the pages of a mapping that have been stored to
+
+int32_t cart_munmap(void *addr);
+	// Sync a mapping and unmap it
+
+int32_t cart_set_stripe_unit(int frames);
+	// Set the frames of a file placed on a server before the next (before poweron)
+
+int32_t cart_set_replicas(int replicas);
+	// Set the servers holding a copy of each frame (before poweron)
+
+int32_t cart_set_hedge_delay(uint32_t usec);
+	// Set the wait before a slow read also goes to another replica, 0 to adapt
+
+int32_t cart_set_direct_bus(int enable);
+	// Use the in-process controller instead of a server (before poweron)
+
+int32_t cart_set_sim_bus(uint32_t op, uint32_t swtch, uint32_t byte);
+	// Simulate the bus in virtual time with these costs in nsec (before poweron)
+
+int32_t cart_set_dedup(int enable);
+	// Turn content-hash frame deduplication on or off (before poweron)
+
+int32_t cart_set_coalesce(int enable);
+	// Gather appends into whole frames before writing them (before poweron)
+
+int32_t cart_set_log_structured(int cartridges);
+	// Write frames at the head of a log of that many cartridges, 0 in place (before poweron)
+
 
 #endif
 
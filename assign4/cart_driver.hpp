@@ -0,0 +1,296 @@
+#ifndef CART_DRIVER_HPP_INCLUDED
+#define CART_DRIVER_HPP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_driver.hpp
+//  Description    : This is a header-only C++20 layer over cart_driver.h: a
+//                   move-only file handle that closes itself, span-based I/O
+//                   that never allocates, the frame geometry as compile-time
+//                   constants and a view that scans a file frame by frame,
+//                   reading cached frames in place.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// Project Includes
+extern "C" {
+#include <cart_controller.h>
+#include <cart_driver.h>
+}
+
+/*
+
+ Using the layer
+
+   cart::File f = cart::File::open("data");
+   std::array<std::byte, 4096> buf;
+   f.pread(buf, 8192);
+   for (std::span<const std::byte> frame : f.frames()) { ... }
+
+ Calls return what the C functions do: byte counts or 0, and -1 on failure.
+ None of them allocate; the driver's own buffers are the only ones used.  A
+ frame from frames() points into the cache when the frame is cached and into
+ the view's single frame buffer when it isn't, so it is only good until the
+ iterator moves on (or any other driver call).  The driver keeps one file
+ position, so pread and pwrite move it just as seek would.
+
+*/
+
+namespace cart {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Class        : Geometry
+// Description  : The frame, cartridge and controller sizes, and the offset
+//                arithmetic built on them
+//
+
+template <std::size_t FrameBytes, std::size_t CartridgeFrames, std::size_t Cartridges>
+struct Geometry {
+	static_assert(FrameBytes > 0 && CartridgeFrames > 0 && Cartridges > 0, "empty geometry");
+
+	static constexpr std::size_t frame_size = FrameBytes;           // Bytes in a frame
+	static constexpr std::size_t cartridge_frames = CartridgeFrames; // Frames in a cartridge
+	static constexpr std::size_t cartridges = Cartridges;           // Cartridges on a server
+	static constexpr std::size_t cartridge_size = FrameBytes * CartridgeFrames;
+
+	static constexpr std::uint32_t frame_of(std::uint64_t offset) noexcept {
+		return static_cast<std::uint32_t>(offset / FrameBytes);
+	}
+		// The frame holding a byte offset
+
+	static constexpr std::size_t offset_in_frame(std::uint64_t offset) noexcept {
+		return static_cast<std::size_t>(offset % FrameBytes);
+	}
+		// Where a byte offset falls within its frame
+
+	static constexpr std::uint32_t frames_for(std::uint64_t bytes) noexcept {
+		return static_cast<std::uint32_t>((bytes + FrameBytes - 1) / FrameBytes);
+	}
+		// Frames needed to hold a number of bytes
+};
+
+using CartGeometry = Geometry<CART_FRAME_SIZE, CART_CARTRIDGE_SIZE, CART_MAX_CARTRIDGES>;
+	// The geometry of the CART controller
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Class        : FrameView
+// Description  : A single-pass range over the frames of an open file, each
+//                a span of the file's bytes in that frame (the last may be
+//                short)
+//
+
+class FrameView {
+public:
+	using G = CartGeometry;
+
+	class iterator {
+	public:
+		using value_type = std::span<const std::byte>;
+		using difference_type = std::ptrdiff_t;
+		using iterator_concept = std::input_iterator_tag;
+
+		iterator() noexcept = default;
+		explicit iterator(FrameView *view) noexcept : view_(view) { load(); }
+
+		value_type operator*() const noexcept { return frame_; }
+		iterator &operator++() noexcept { index_++; load(); return *this; }
+		void operator++(int) noexcept { ++*this; }
+
+		friend bool operator==(const iterator &it, std::default_sentinel_t) noexcept {
+			return it.view_ == nullptr;
+		}
+
+		std::uint32_t index() const noexcept { return index_; }
+			// The frame of the file the iterator is on
+
+	private:
+		void load() noexcept {
+			if (view_ == nullptr) {
+				return;
+			}
+			std::uint64_t start = static_cast<std::uint64_t>(index_) * G::frame_size;
+			if (start >= view_->size_) {
+				view_ = nullptr;
+				return;
+			}
+			std::size_t len = static_cast<std::size_t>(
+				std::min<std::uint64_t>(G::frame_size, view_->size_ - start));
+
+			// Cached frames are read in place, others are read into the view
+			auto cached = static_cast<const std::byte *>(cart_cached_frame(view_->fd_, index_));
+			if (cached != nullptr) {
+				frame_ = value_type(cached, len);
+				return;
+			}
+			if ((cart_seek(view_->fd_, start) != 0) ||
+				(cart_read(view_->fd_, view_->frame_.data(), static_cast<std::int32_t>(len)) !=
+					static_cast<std::int32_t>(len))) {
+				view_->failed_ = true;
+				view_ = nullptr;
+				return;
+			}
+			frame_ = value_type(view_->frame_.data(), len);
+		}
+
+		FrameView *view_ = nullptr;
+		std::uint32_t index_ = 0;
+		value_type frame_;
+	};
+
+	FrameView(std::int16_t fd, std::int64_t size) noexcept
+		: fd_(fd), size_((size < 0) ? 0 : static_cast<std::uint64_t>(size)), failed_(size < 0) {}
+
+	FrameView(const FrameView &) = delete;
+	FrameView &operator=(const FrameView &) = delete;
+
+	iterator begin() noexcept { return iterator(this); }
+	std::default_sentinel_t end() const noexcept { return {}; }
+
+	std::uint32_t size() const noexcept { return G::frames_for(size_); }
+		// The frames in the file
+
+	bool failed() const noexcept { return failed_; }
+		// A frame couldn't be read, ending the scan early
+
+private:
+	std::int16_t fd_;
+	std::uint64_t size_;
+	bool failed_;
+	alignas(std::max_align_t) std::array<std::byte, G::frame_size> frame_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Class        : File
+// Description  : An open CART file, closed when the handle goes away
+//
+
+class File {
+public:
+	File() noexcept = default;
+	explicit File(std::int16_t fd) noexcept : fd_(fd) {}
+	~File() { close(); }
+
+	File(File &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+	File &operator=(File &&other) noexcept {
+		if (this != &other) {
+			close();
+			fd_ = std::exchange(other.fd_, -1);
+		}
+		return *this;
+	}
+	File(const File &) = delete;
+	File &operator=(const File &) = delete;
+
+	static File open(const char *path) noexcept {
+		return File(cart_open(const_cast<char *>(path)));
+	}
+		// Open (or create) a file, check the result with is_open()
+
+	bool is_open() const noexcept { return fd_ > 0; }
+	explicit operator bool() const noexcept { return is_open(); }
+
+	std::int16_t fd() const noexcept { return fd_; }
+		// The driver's file handle
+
+	std::int16_t release() noexcept { return std::exchange(fd_, -1); }
+		// Give up the handle without closing it
+
+	std::int32_t close() noexcept {
+		return is_open() ? cart_close(std::exchange(fd_, -1)) : 0;
+	}
+		// Close the file now rather than when the handle goes away
+
+	std::int32_t read(std::span<std::byte> buf) noexcept {
+		return cart_read(fd_, buf.data(), clamp(buf.size()));
+	}
+		// Read from the file position, returning the bytes read
+
+	std::int32_t write(std::span<const std::byte> buf) noexcept {
+		return cart_write(fd_, const_cast<std::byte *>(buf.data()), clamp(buf.size()));
+	}
+		// Write at the file position, returning the bytes written
+
+	std::int32_t pread(std::span<std::byte> buf, std::uint64_t offset) noexcept {
+		return (seek(offset) != 0) ? -1 : read(buf);
+	}
+		// Read from offset, returning the bytes read
+
+	std::int32_t pwrite(std::span<const std::byte> buf, std::uint64_t offset) noexcept {
+		std::int64_t size = cart_file_size(fd_);
+		if ((size < 0) || (offset > static_cast<std::uint64_t>(size)) || (seek(offset) != 0)) {
+			return -1;
+		}
+		return write(buf);
+	}
+		// Write at offset (at most the end of the file), returning the bytes written
+
+	template <class T, std::size_t N>
+		requires(std::is_trivially_copyable_v<T> && !std::is_const_v<T>)
+	std::int32_t read(std::span<T, N> buf) noexcept {
+		return read(std::span<std::byte>(std::as_writable_bytes(buf)));
+	}
+		// Read into a span of plain objects
+
+	template <class T, std::size_t N>
+		requires std::is_trivially_copyable_v<T>
+	std::int32_t write(std::span<T, N> buf) noexcept {
+		return write(std::span<const std::byte>(std::as_bytes(buf)));
+	}
+		// Write a span of plain objects
+
+	template <class T, std::size_t N>
+		requires(std::is_trivially_copyable_v<T> && !std::is_const_v<T>)
+	std::int32_t pread(std::span<T, N> buf, std::uint64_t offset) noexcept {
+		return pread(std::span<std::byte>(std::as_writable_bytes(buf)), offset);
+	}
+		// Read a span of plain objects from offset
+
+	template <class T, std::size_t N>
+		requires std::is_trivially_copyable_v<T>
+	std::int32_t pwrite(std::span<T, N> buf, std::uint64_t offset) noexcept {
+		return pwrite(std::span<const std::byte>(std::as_bytes(buf)), offset);
+	}
+		// Write a span of plain objects at offset
+
+	std::int32_t seek(std::uint64_t offset) noexcept { return cart_seek(fd_, offset); }
+		// Move the file position (to the end at most)
+
+	std::int32_t advise(std::uint64_t offset, std::uint64_t len, int advice) noexcept {
+		return cart_advise(fd_, offset, len, advice);
+	}
+		// Say how a range of the file (len 0 for to the end) will be read (CART_ADVICE_*)
+
+	std::int64_t size() const noexcept { return cart_file_size(fd_); }
+		// The file size in bytes, -1 if the file isn't open
+
+	FrameView frames() const noexcept { return FrameView(fd_, size()); }
+		// The frames of the file, for scanning it in place
+
+private:
+	static std::int32_t clamp(std::size_t bytes) noexcept {
+		return static_cast<std::int32_t>(
+			std::min<std::size_t>(bytes, std::numeric_limits<std::int32_t>::max()));
+	}
+
+	std::int16_t fd_ = -1;
+};
+
+}
+
+#endif
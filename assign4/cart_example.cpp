@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_example.cpp
+//  Description    : This is a small example of the C++ layer in
+//                   cart_driver.hpp.  It powers on an in-process bus, writes
+//                   a file through spans, reads it back with read, pread and
+//                   the frame view, and checks what comes back.  Building it
+//                   keeps the header compiling as the driver changes.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/19/26
+//
+
+// Include Files
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// Project Include Files
+#include <cart_driver.hpp>
+extern "C" {
+#include <cmpsc311_log.h>
+}
+
+// Defines
+#define CART_EXAMPLE_WORDS 3000   // Words written, just under 12 frames
+#define CART_EXAMPLE_PREAD 100    // Word read back with pread
+
+//
+// Functional Prototypes
+
+int example_file(void);           // Write, read back and scan a file
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the C++ layer example
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int main(void) {
+
+	// Local variables
+	int ret;
+
+	// Run over the in-process bus so no server is needed
+	cart_set_direct_bus(1);
+	if (cart_poweron() != 0) {
+		logMessage(LOG_ERROR_LEVEL, "CART example poweron failed.");
+		return(-1);
+	}
+	ret = example_file();
+	if (cart_poweroff() != 0) {
+		ret = -1;
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CART example %s.", (ret == 0) ? "successful" : "failed");
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : example_file
+// Description  : Write words to a file through a span, then read them back
+//                with read, pread and frames(), and patch the end with pwrite
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int example_file(void) {
+
+	// Local variables
+	using G = cart::CartGeometry;
+	static std::array<std::uint32_t, CART_EXAMPLE_WORDS> words, back;
+	std::array<std::uint32_t, 10> some{};
+	std::array<std::byte, 4> patch{std::byte{1}, std::byte{2}, std::byte{3}, std::byte{4}};
+	const std::int32_t bytes = sizeof(words);
+	std::size_t total = 0;
+	std::uint32_t i, frame = 0;
+
+	static_assert(G::frame_size == CART_FRAME_SIZE);
+	for (i = 0; i < words.size(); i++) {
+		words[i] = i * 2654435761u;
+	}
+
+	// Write the words, then read them all back from the start
+	cart::File f = cart::File::open("example.dat");
+	if (!f || (f.write(std::span(words)) != bytes)) {
+		logMessage(LOG_ERROR_LEVEL, "CART example write failed.");
+		return(-1);
+	}
+	if ((f.seek(0) != 0) || (f.read(std::span(back)) != bytes) || (words != back)) {
+		logMessage(LOG_ERROR_LEVEL, "CART example read back failed.");
+		return(-1);
+	}
+	if ((f.pread(std::span(some), CART_EXAMPLE_PREAD * sizeof(std::uint32_t)) != sizeof(some)) ||
+			(std::memcmp(some.data(), &words[CART_EXAMPLE_PREAD], sizeof(some)) != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "CART example pread failed.");
+		return(-1);
+	}
+
+	// Append with pwrite, writing past the end fails
+	if ((f.pwrite(std::span(patch), bytes) != sizeof(patch)) || (f.size() != bytes + sizeof(patch)) ||
+			(f.pwrite(std::span(patch), bytes + G::frame_size) != -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CART example pwrite failed.");
+		return(-1);
+	}
+
+	// The handle moves, then the frames are scanned in place
+	cart::File g = std::move(f);
+	if (f || !g || (g.advise(0, 0, CART_ADVICE_SEQUENTIAL) != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "CART example handle move failed.");
+		return(-1);
+	}
+	cart::FrameView view = g.frames();
+	for (std::span<const std::byte> data : view) {
+		if ((frame < G::frames_for(bytes) - 1) &&
+				(std::memcmp(data.data(), reinterpret_cast<const char *>(words.data()) + frame * G::frame_size, data.size()) != 0)) {
+			logMessage(LOG_ERROR_LEVEL, "CART example frame %u is wrong.", frame);
+			return(-1);
+		}
+		total += data.size();
+		frame++;
+	}
+	if (view.failed() || (total != static_cast<std::size_t>(g.size())) || (frame != G::frames_for(g.size()))) {
+		logMessage(LOG_ERROR_LEVEL, "CART example frame view failed.");
+		return(-1);
+	}
+	return(0);
+}
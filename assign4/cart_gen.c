@@ -0,0 +1,678 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_gen.c
+//  Description    : This is a synthetic workload generator for the CART
+//                   simulator.  It creates a set of source files and a
+//                   workload (text or binary trace) that builds them up
+//                   under a configurable access pattern, so cart_sim can
+//                   still validate the final contents.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+// Project Includes
+#include <cart_trace.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_GEN_ARGUMENTS "huvBn:s:w:r:a:N:S:p:o:"
+#define CART_GEN_MAX_CHUNK 1000
+#define USAGE \
+	"USAGE: cart_gen [-h] [-u] [-v] [-B] [-n <files>] [-s <sizes>] [-w <min:max>] [-r <ratio>]\n" \
+	"                [-a <pattern>] [-N <ops>] [-S <seed>] [-p <prefix>] -o <workload>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -u - run the unit tests\n" \
+	"    -v - verbose output\n" \
+	"    -B - write a binary trace instead of a text workload\n" \
+	"    -n - number of files to generate, at most 128 (default 16)\n" \
+	"    -s - file size distribution (default uniform:1024:65536)\n" \
+	"           fixed:<n> | uniform:<min>:<max> | exp:<mean> | pareto:<min>:<alpha>\n" \
+	"    -w - write chunk size range in bytes, max 1000 (default 1:256)\n" \
+	"    -r - fraction of operations that are reads (default 0.3)\n" \
+	"    -a - access pattern for picking files and offsets (default uniform)\n" \
+	"           seq | uniform | zipf[:<theta>] | hotspot[:<hot-frac>:<hot-prob>]\n" \
+	"    -N - number of operations (default 10000, files are always completed)\n" \
+	"    -S - random seed (default 1)\n" \
+	"    -p - filename prefix for the generated files (default gen)\n" \
+	"    -o - the workload file to write\n" \
+	"\n"
+
+// These are the access patterns
+typedef enum {
+	CART_GEN_SEQUENTIAL = 0,  // Walk files and offsets in order
+	CART_GEN_UNIFORM    = 1,  // Uniform random choice
+	CART_GEN_ZIPF       = 2,  // Zipfian choice over ranks
+	CART_GEN_HOTSPOT    = 3   // A hot fraction gets most accesses
+} CartGenPattern;
+
+// These are the size distributions
+typedef enum {
+	CART_GEN_FIXED   = 0,
+	CART_GEN_USIZE   = 1,
+	CART_GEN_EXP     = 2,
+	CART_GEN_PARETO  = 3
+} CartGenSizeDist;
+
+// This is a generated file
+typedef struct {
+	char     name[CART_SIM_MAX_TOKEN];  // The filename (relative to the workload dir)
+	char    *data;     // The file contents
+	int32_t  size;     // The final size of the file
+	int32_t  written;  // Bytes appended so far
+	int32_t  fp;       // The file position the workload leaves the file at
+	int32_t  cursor;   // Sequential access cursor
+} CartGenFile;
+
+// This is the generator configuration and state
+typedef struct {
+	CartGenPattern  pattern;    // The access pattern
+	double          theta;      // Zipf exponent
+	double          hotfrac;    // Hotspot: fraction of items that are hot
+	double          hotprob;    // Hotspot: probability of a hot access
+	CartGenSizeDist sizedist;   // The file size distribution
+	double          sz1, sz2;   // Size distribution parameters
+	int32_t         wmin, wmax; // Write chunk range
+	double          rratio;     // Read ratio
+	uint64_t        rng;        // PRNG state
+	double         *zcdf;       // Zipf CDF
+	int32_t         zsize;      // Number of ranks in the CDF
+	int32_t         seqfile;    // Sequential pattern file cursor
+	FILE           *out;        // Text workload output
+	CartTraceWriter wr;         // Binary trace output
+	int             binary;     // Writing a binary trace?
+	uint64_t        nops[4];    // Commands emitted, by CartSimCommand
+} CartGenerator;
+
+//
+// Functional Prototypes
+
+uint64_t gen_random(CartGenerator *gen);                       // Next 64-bit random value
+double gen_uniform(CartGenerator *gen);                        // Uniform in [0,1)
+int32_t gen_pick(CartGenerator *gen, int32_t n, int32_t *cursor); // Pick an index by pattern
+int32_t gen_file_size(CartGenerator *gen);                     // Draw a file size
+int gen_setup_zipf(CartGenerator *gen, int32_t n);             // Build the Zipf CDF
+int gen_emit(CartGenerator *gen, CartSimCommand cmd, CartGenFile *f,
+		int32_t len, int32_t off, const char *payload);       // Emit a workload command
+int gen_seek(CartGenerator *gen, CartGenFile *f, int32_t off); // Emit a seek if needed
+void gen_fill_text(CartGenerator *gen, char *buf, int32_t size); // Generate file contents
+int generate_workload(CartGenerator *gen, int32_t nfiles, int64_t nops,
+		const char *prefix);                                  // Generate the workload
+int gen_file_count(const char *arg, int32_t *nfiles);          // Parse the file count
+int cartGenUnitTest(void);                                     // Run the unit tests
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART workload generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	CartGenerator gen;
+	char *outfile = NULL, *prefix = "gen", *arg;
+	int32_t nfiles = 16;
+	int64_t nops = 10000;
+	int ch, ret;
+
+	// Setup the defaults
+	memset(&gen, 0x0, sizeof(gen));
+	gen.pattern = CART_GEN_UNIFORM;
+	gen.theta = 0.99;
+	gen.hotfrac = 0.2;
+	gen.hotprob = 0.8;
+	gen.sizedist = CART_GEN_USIZE;
+	gen.sz1 = 1024;
+	gen.sz2 = 65536;
+	gen.wmin = 1;
+	gen.wmax = 256;
+	gen.rratio = 0.3;
+	gen.rng = 1;
+	initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_GEN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'u': // Unit tests
+			return( cartGenUnitTest() );
+
+		case 'v': // Verbose Flag
+			enableLogLevels(LOG_INFO_LEVEL);
+			break;
+
+		case 'B': // Binary trace output
+			gen.binary = 1;
+			break;
+
+		case 'n': // Number of files
+			if ( gen_file_count(optarg, &nfiles) != 0 ) {
+				return( -1 );
+			}
+			break;
+
+		case 's': // File size distribution
+			if ( (strncmp(optarg, "fixed:", 6) == 0) && (sscanf(optarg+6, "%lf", &gen.sz1) == 1) ) {
+				gen.sizedist = CART_GEN_FIXED;
+			} else if ( (strncmp(optarg, "uniform:", 8) == 0) &&
+						(sscanf(optarg+8, "%lf:%lf", &gen.sz1, &gen.sz2) == 2) && (gen.sz1 <= gen.sz2) ) {
+				gen.sizedist = CART_GEN_USIZE;
+			} else if ( (strncmp(optarg, "exp:", 4) == 0) && (sscanf(optarg+4, "%lf", &gen.sz1) == 1) ) {
+				gen.sizedist = CART_GEN_EXP;
+			} else if ( (strncmp(optarg, "pareto:", 7) == 0) &&
+						(sscanf(optarg+7, "%lf:%lf", &gen.sz1, &gen.sz2) == 2) && (gen.sz2 > 0) ) {
+				gen.sizedist = CART_GEN_PARETO;
+			} else {
+				logMessage( LOG_ERROR_LEVEL, "Bad size distribution [%s]", optarg );
+				return( -1 );
+			}
+			if (gen.sz1 < 1) {
+				logMessage( LOG_ERROR_LEVEL, "File sizes must be at least one byte [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'w': // Write chunk range
+			if ( (sscanf(optarg, "%d:%d", &gen.wmin, &gen.wmax) != 2) || (gen.wmin < 1) ||
+				 (gen.wmax < gen.wmin) || (gen.wmax > CART_GEN_MAX_CHUNK) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad write chunk range [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'r': // Read ratio
+			if ( (sscanf(optarg, "%lf", &gen.rratio) != 1) || (gen.rratio < 0) || (gen.rratio > 1) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad read ratio [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'a': // Access pattern
+			arg = strchr(optarg, ':');
+			if (strncmp(optarg, "seq", 3) == 0) {
+				gen.pattern = CART_GEN_SEQUENTIAL;
+			} else if (strncmp(optarg, "uniform", 7) == 0) {
+				gen.pattern = CART_GEN_UNIFORM;
+			} else if (strncmp(optarg, "zipf", 4) == 0) {
+				gen.pattern = CART_GEN_ZIPF;
+				if ( (arg != NULL) && ((sscanf(arg+1, "%lf", &gen.theta) != 1) || (gen.theta <= 0)) ) {
+					logMessage( LOG_ERROR_LEVEL, "Bad Zipf exponent [%s]", optarg );
+					return( -1 );
+				}
+			} else if (strncmp(optarg, "hotspot", 7) == 0) {
+				gen.pattern = CART_GEN_HOTSPOT;
+				if ( (arg != NULL) && ((sscanf(arg+1, "%lf:%lf", &gen.hotfrac, &gen.hotprob) != 2) ||
+					 (gen.hotfrac <= 0) || (gen.hotfrac > 1) || (gen.hotprob < 0) || (gen.hotprob > 1)) ) {
+					logMessage( LOG_ERROR_LEVEL, "Bad hotspot parameters [%s]", optarg );
+					return( -1 );
+				}
+			} else {
+				logMessage( LOG_ERROR_LEVEL, "Unknown access pattern [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'N': // Number of operations
+			if ( (sscanf(optarg, "%ld", &nops) != 1) || (nops < 0) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad operation count [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'S': // Random seed
+			if ( sscanf(optarg, "%lu", &gen.rng) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad seed [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'p': // Filename prefix
+			prefix = optarg;
+			break;
+
+		case 'o': // Output workload
+			outfile = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+	if ( outfile == NULL ) {
+		fprintf( stderr, "Missing output workload (-o), use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Setup the output, generate, then finish
+	gen.rng = (gen.rng == 0) ? 1 : gen.rng;
+	if (gen.binary) {
+		if (cart_trace_writer_init(&gen.wr) != 0) {
+			return( -1 );
+		}
+	} else if ((gen.out = fopen(outfile, "w")) == NULL) {
+		logMessage( LOG_ERROR_LEVEL, "Failure creating workload [%s], error: %s", outfile, strerror(errno) );
+		return( -1 );
+	}
+	ret = generate_workload(&gen, nfiles, nops, prefix);
+	if (gen.binary) {
+		if (ret == 0) {
+			ret = cart_trace_writer_finish(&gen.wr, outfile);
+		} else {
+			cart_trace_writer_release(&gen.wr);
+		}
+	} else if ((fclose(gen.out) != 0) && (ret == 0)) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing workload [%s]", outfile );
+		ret = -1;
+	}
+	free(gen.zcdf);
+	if (ret == 0) {
+		logMessage( LOG_OUTPUT_LEVEL, "Generated [%s]: %d files, %lu WRITE, %lu WRITEAT, %lu READ, %lu SEEK.",
+			outfile, nfiles, gen.nops[CART_SIM_WRITE], gen.nops[CART_SIM_WRITEAT],
+			gen.nops[CART_SIM_READ], gen.nops[CART_SIM_SEEK] );
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_file_count
+// Description  : Parse the number of files, which cart_sim must be able to
+//                hold in its file table
+//
+// Inputs       : arg - the option argument
+//                nfiles - where to put the count
+// Outputs      : 0 if successful, -1 if failure
+
+int gen_file_count(const char *arg, int32_t *nfiles) {
+	int32_t n;
+
+	if ( (sscanf(arg, "%d", &n) != 1) || (n < 1) || (n > CART_SIM_MAX_OPEN_FILES) ) {
+		logMessage( LOG_ERROR_LEVEL, "Bad file count [%s], must be 1 to %d", arg, CART_SIM_MAX_OPEN_FILES );
+		return( -1 );
+	}
+	*nfiles = n;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartGenUnitTest
+// Description  : Check the file count is held to what cart_sim can open
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cartGenUnitTest(void) {
+	int32_t nfiles = 0;
+
+	if ( (gen_file_count("1", &nfiles) != 0) || (nfiles != 1) ||
+		 (gen_file_count("128", &nfiles) != 0) || (nfiles != CART_SIM_MAX_OPEN_FILES) ) {
+		logMessage( LOG_ERROR_LEVEL, "Generator unit test: a file count cart_sim can hold was refused" );
+		return( -1 );
+	}
+	if ( (gen_file_count("0", &nfiles) == 0) || (gen_file_count("129", &nfiles) == 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "Generator unit test: a file count past cart_sim's table was taken" );
+		return( -1 );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "Generator unit test completed successfully." );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : generate_workload
+// Description  : Generate the source files and the workload commands.  Every
+//                operation picks a file with the access pattern; writes to
+//                incomplete files append the next chunk, other writes re-write
+//                an existing region with its final contents, and reads read
+//                back an existing region.  Files are completed at the end.
+//
+// Inputs       : gen - the generator
+//                nfiles - the number of files
+//                nops - the number of operations
+//                prefix - the start of the source file names, which are
+//                         written to the workload directory cart_sim checks
+// Outputs      : 0 if successful, -1 if failure
+
+int generate_workload(CartGenerator *gen, int32_t nfiles, int64_t nops,
+		const char *prefix) {
+
+	// Local variables
+	CartGenFile *files;
+	CartGenFile *f;
+	char path[512];
+	FILE *fh;
+	int32_t i, len, off, maxframes = 1;
+	int64_t op;
+	int ret = 0;
+
+	// Create the files and their contents
+	files = calloc(nfiles, sizeof(CartGenFile));
+	for (i=0; (i<nfiles) && (ret==0); i++) {
+		f = &files[i];
+		snprintf(f->name, CART_SIM_MAX_TOKEN, "%s%04d.txt", prefix, i);
+		f->size = gen_file_size(gen);
+		f->data = malloc(f->size);
+		gen_fill_text(gen, f->data, f->size);
+		maxframes = (f->size/1024+1 > maxframes) ? f->size/1024+1 : maxframes;
+		snprintf(path, sizeof(path), "%s/%s", CART_WORKLOAD_DIR, f->name);
+		if ( ((fh = fopen(path, "w")) == NULL) || (fwrite(f->data, 1, f->size, fh) != f->size) ) {
+			logMessage(LOG_ERROR_LEVEL, "Failure writing source file [%s]", path);
+			ret = -1;
+		}
+		if ((fh != NULL) && (fclose(fh) != 0)) {
+			ret = -1;
+		}
+	}
+	if ( (ret == 0) && (gen->pattern == CART_GEN_ZIPF) ) {
+		ret = gen_setup_zipf(gen, (nfiles > maxframes) ? nfiles : maxframes);
+	}
+
+	// Now issue the operations
+	for (op=0; (op<nops) && (ret==0); op++) {
+		f = &files[gen_pick(gen, nfiles, &gen->seqfile)];
+
+		if ( (f->written == 0) || ((f->written < f->size) && (gen_uniform(gen) >= gen->rratio)) ) {
+
+			// Append the next chunk of an incomplete file
+			len = gen->wmin + (int32_t)(gen_random(gen) % (gen->wmax - gen->wmin + 1));
+			len = (len > f->size - f->written) ? f->size - f->written : len;
+			ret = gen_seek(gen, f, f->written);
+			if (ret == 0) ret = gen_emit(gen, CART_SIM_WRITE, f, len, 0, &f->data[f->written]);
+			f->written += len;
+			f->fp = f->written;
+
+		} else {
+
+			// Pick a region of the written part of the file (frame, then offset)
+			i = gen_pick(gen, (f->written+1023)/1024, &f->cursor);
+			off = i*1024 + (int32_t)(gen_random(gen) % 1024);
+			off = (off >= f->written) ? f->written-1 : off;
+			len = gen->wmin + (int32_t)(gen_random(gen) % (gen->wmax - gen->wmin + 1));
+			len = (len > f->written - off) ? f->written - off : len;
+
+			if (gen_uniform(gen) < gen->rratio) {
+				ret = gen_seek(gen, f, off);
+				if (ret == 0) ret = gen_emit(gen, CART_SIM_READ, f, len, 0, NULL);
+			} else {
+				ret = gen_emit(gen, CART_SIM_WRITEAT, f, len, off, &f->data[off]);
+			}
+			f->fp = off+len;
+		}
+	}
+
+	// Make sure every file is complete, so the contents can be validated
+	for (i=0; (i<nfiles) && (ret==0); i++) {
+		f = &files[i];
+		while ( (ret == 0) && (f->written < f->size) ) {
+			len = gen->wmax;
+			len = (len > f->size - f->written) ? f->size - f->written : len;
+			ret = gen_seek(gen, f, f->written);
+			if (ret == 0) ret = gen_emit(gen, CART_SIM_WRITE, f, len, 0, &f->data[f->written]);
+			f->written += len;
+			f->fp = f->written;
+		}
+	}
+
+	// Cleanup and return
+	for (i=0; i<nfiles; i++) {
+		free(files[i].data);
+	}
+	free(files);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_emit
+// Description  : Emit a single workload command (text or binary)
+//
+// Inputs       : gen - the generator
+//                cmd - the command
+//                f - the file
+//                len, off - the command fields
+//                payload - the write data (writes only)
+// Outputs      : 0 if successful, -1 if failure
+
+int gen_emit(CartGenerator *gen, CartSimCommand cmd, CartGenFile *f,
+		int32_t len, int32_t off, const char *payload) {
+
+	// Local variables
+	static const char *names[] = { "WRITEAT", "WRITE", "SEEK", "READ" };
+	char text[CART_GEN_MAX_CHUNK+1], *p;
+
+	gen->nops[cmd]++;
+	if (gen->binary) {
+		return(cart_trace_append(&gen->wr, cmd, f->name, len, off, payload));
+	}
+
+	// Text workloads carry newlines as '^'
+	text[0] = 0x0;
+	if (payload != NULL) {
+		memcpy(text, payload, len);
+		text[len] = 0x0;
+		for (p=text; (p=memchr(p, '\n', &text[len]-p)) != NULL; p++) {
+			*p = '^';
+		}
+	}
+	if (fprintf(gen->out, "%s %s %d %d :%s\n", f->name, names[cmd], len, off, text) < 0) {
+		logMessage(LOG_ERROR_LEVEL, "Failure writing workload command.");
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_seek
+// Description  : Emit a seek if the file is not already at the position
+//
+// Inputs       : gen - the generator
+//                f - the file
+//                off - the position needed
+// Outputs      : 0 if successful, -1 if failure
+
+int gen_seek(CartGenerator *gen, CartGenFile *f, int32_t off) {
+	if (f->fp == off) {
+		return(0);
+	}
+	f->fp = off;
+	return(gen_emit(gen, CART_SIM_SEEK, f, 0, off, NULL));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_pick
+// Description  : Pick an index in [0,n) using the access pattern
+//
+// Inputs       : gen - the generator
+//                n - the number of items
+//                cursor - the sequential cursor for these items
+// Outputs      : the index
+
+int32_t gen_pick(CartGenerator *gen, int32_t n, int32_t *cursor) {
+
+	// Local variables
+	int32_t lo, hi, mid, nhot;
+	double u;
+
+	switch (gen->pattern) {
+	case CART_GEN_SEQUENTIAL:
+		*cursor = (*cursor + 1) % n;
+		return(*cursor);
+
+	case CART_GEN_ZIPF:
+		// Binary search the CDF, folding ranks past n back into range
+		u = gen_uniform(gen);
+		lo = 0;
+		hi = gen->zsize-1;
+		while (lo < hi) {
+			mid = (lo+hi)/2;
+			if (gen->zcdf[mid] < u) lo = mid+1; else hi = mid;
+		}
+		return(lo % n);
+
+	case CART_GEN_HOTSPOT:
+		nhot = (int32_t)(n * gen->hotfrac);
+		nhot = (nhot < 1) ? 1 : nhot;
+		if ( (nhot >= n) || (gen_uniform(gen) < gen->hotprob) ) {
+			return((int32_t)(gen_random(gen) % nhot));
+		}
+		return(nhot + (int32_t)(gen_random(gen) % (n-nhot)));
+
+	default:
+		return((int32_t)(gen_random(gen) % n));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_setup_zipf
+// Description  : Build the cumulative distribution for Zipfian picks
+//
+// Inputs       : gen - the generator
+//                n - the number of ranks
+// Outputs      : 0 if successful, -1 if failure
+
+int gen_setup_zipf(CartGenerator *gen, int32_t n) {
+
+	// Local variables
+	double sum = 0;
+	int32_t i;
+
+	if ((gen->zcdf = malloc(n*sizeof(double))) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Failure allocating Zipf table.");
+		return(-1);
+	}
+	for (i=0; i<n; i++) {
+		sum += 1.0/pow(i+1, gen->theta);
+		gen->zcdf[i] = sum;
+	}
+	for (i=0; i<n; i++) {
+		gen->zcdf[i] /= sum;
+	}
+	gen->zsize = n;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_file_size
+// Description  : Draw a file size from the size distribution
+//
+// Inputs       : gen - the generator
+// Outputs      : the size in bytes (at least 1)
+
+int32_t gen_file_size(CartGenerator *gen) {
+
+	// Local variables
+	double sz;
+
+	switch (gen->sizedist) {
+	case CART_GEN_FIXED:
+		sz = gen->sz1;
+		break;
+	case CART_GEN_EXP:
+		sz = -gen->sz1 * log(1.0 - gen_uniform(gen));
+		break;
+	case CART_GEN_PARETO:
+		sz = gen->sz1 / pow(1.0 - gen_uniform(gen), 1.0/gen->sz2);
+		break;
+	default:
+		sz = gen->sz1 + gen_uniform(gen)*(gen->sz2 - gen->sz1 + 1);
+		break;
+	}
+
+	// Keep the size within what the driver addresses
+	if (sz < 1) sz = 1;
+	if (sz > (1<<24)) sz = (1<<24);
+	return((int32_t)sz);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_fill_text
+// Description  : Generate text-like file contents (no '^' or NUL bytes)
+//
+// Inputs       : gen - the generator
+//                buf - the buffer to fill
+//                size - the number of bytes
+// Outputs      : none
+
+void gen_fill_text(CartGenerator *gen, char *buf, int32_t size) {
+
+	// Local variables
+	static const char *words[] = { "the", "cartridge", "frame", "of", "and", "memory",
+		"driver", "a", "to", "cache", "bus", "controller", "in", "is", "read", "write",
+		"system", "file", "data", "that", "with", "for", "server", "block" };
+	const int nwords = sizeof(words)/sizeof(words[0]);
+	int32_t pos = 0, col = 0, wlen;
+	const char *w;
+
+	while (pos < size) {
+		w = words[gen_random(gen) % nwords];
+		wlen = strlen(w);
+		if (col + wlen > 72) {
+			buf[pos++] = '\n';
+			col = 0;
+			continue;
+		}
+		while ((*w) && (pos < size)) {
+			buf[pos++] = *w++;
+		}
+		if (pos < size) {
+			buf[pos++] = ' ';
+		}
+		col += wlen+1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_random
+// Description  : Next value from the (seeded, repeatable) xorshift64* PRNG
+//
+// Inputs       : gen - the generator
+// Outputs      : the random value
+
+uint64_t gen_random(CartGenerator *gen) {
+	gen->rng ^= gen->rng >> 12;
+	gen->rng ^= gen->rng << 25;
+	gen->rng ^= gen->rng >> 27;
+	return(gen->rng * 2685821657736338717ULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gen_uniform
+// Description  : Uniform random value in [0,1)
+//
+// Inputs       : gen - the generator
+// Outputs      : the random value
+
+double gen_uniform(CartGenerator *gen) {
+	return((gen_random(gen) >> 11) * (1.0/9007199254740992.0));
+}
@@ -0,0 +1,571 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_log.c
+//  Description    : This is the asynchronous logging backend of the CART
+//                   client: per-thread rings of binary records, formatted
+//                   and handed to the cmpsc311 log by a writer thread.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Project Includes
+#include <cart_log.h>
+
+// Defines
+#define CART_LOG_SPEC_SIZE 32            // Longest conversion spec kept
+
+// A record, the arguments follow the header in the order of the format
+typedef struct {
+	uint64_t seq;                        // Global order of the record
+	unsigned long lvl;                   // The level
+	const char *fmt;                     // The format (a literal)
+	uint64_t stamp;                      // When it was logged (nsec, realtime)
+	uint16_t used;                       // Bytes of args used
+	char args[CART_LOG_RECORD_SIZE - 48] __attribute__((aligned(16)));
+} CartLogRecord;
+
+// A thread's ring, the thread is the only producer and the writer the only consumer
+typedef struct {
+	_Atomic uint32_t head;               // Next record to fill
+	_Atomic uint32_t tail;               // Next record to log
+	_Atomic int owned;                   // A live thread logs into the ring
+	_Atomic uint32_t waiting;            // The thread is waiting for room
+	CartLogRecord records[CART_LOG_RING_SIZE];
+} CartLogRing;
+
+//
+// Global data
+
+CartLogRing *LogRings[CART_LOG_MAX_RINGS];   // Rings handed out so far
+_Atomic int LogNumRings;                     // Entries of LogRings in use
+pthread_mutex_t LogRingLock = PTHREAD_MUTEX_INITIALIZER; // Guards handing out rings
+pthread_key_t LogRingKey;                    // Gives a ring back when its thread exits
+_Atomic uint64_t LogSeq;                     // Next record sequence number
+uint64_t LogNextSeq;                         // Sequence number the writer logs next
+_Atomic int LogRunning;                      // The writer thread is running
+_Atomic int LogSleeping;                     // The writer is asleep, wake it after recording
+_Atomic uint32_t LogWake;                    // Bumped (with a futex wake) to wake the writer
+int LogStarted;                              // The writer has been started
+pthread_t LogWriter;                         // The writer thread
+static __thread CartLogRing *LogRing;        // The calling thread's ring
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_wake
+// Description  : Wake the writer thread
+//
+// Inputs       : none
+// Outputs      : none
+
+static void cart_log_wake(void) {
+	atomic_fetch_add(&LogWake, 1);
+	syscall(SYS_futex, &LogWake, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_release
+// Description  : Give a ring back when its thread exits, the writer still
+//                drains it and another thread may then take it
+//
+// Inputs       : ring - the ring
+// Outputs      : none
+
+static void cart_log_release(void *ring) {
+	atomic_store(&((CartLogRing *)ring)->owned, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_ring
+// Description  : Get the calling thread's ring, taking a free one (or a new
+//                one) the first time
+//
+// Inputs       : none
+// Outputs      : the ring, NULL if none is left
+
+static CartLogRing *cart_log_ring(void) {
+	int i, free_ring;
+
+	if (LogRing != NULL) {
+		return(LogRing);
+	}
+	pthread_mutex_lock(&LogRingLock);
+	for (i = 0; i < atomic_load(&LogNumRings); i++) {
+		free_ring = 0;
+		if (atomic_compare_exchange_strong(&LogRings[i]->owned, &free_ring, 1)) {
+			LogRing = LogRings[i];
+			break;
+		}
+	}
+	if ((LogRing == NULL) && (i < CART_LOG_MAX_RINGS) &&
+		((LogRing = calloc(1, sizeof(CartLogRing))) != NULL)) {
+		atomic_store(&LogRing->owned, 1);
+		LogRings[i] = LogRing;
+		atomic_store(&LogNumRings, i+1);
+	}
+	pthread_mutex_unlock(&LogRingLock);
+	if (LogRing != NULL) {
+		pthread_setspecific(LogRingKey, LogRing);
+	}
+	return(LogRing);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_spec
+// Description  : Parse a conversion spec, from the '%' to the conversion
+//
+// Inputs       : fmt - the '%' starting the spec
+//                stars - where to put the number of '*' width/precisions
+//                length - where to put the length modifier ('H' for hh,
+//                         'q' for ll, 0 for none)
+// Outputs      : a pointer to the conversion character
+
+static const char *cart_log_spec(const char *fmt, int *stars, char *length) {
+	*stars = 0;
+	*length = 0;
+	fmt++;
+	fmt += strspn(fmt, "-+ #0'");
+	while ((*fmt == '*') || ((*fmt >= '0') && (*fmt <= '9')) || (*fmt == '.')) {
+		*stars += (*fmt++ == '*');
+	}
+	if ((fmt[0] == 'h' && fmt[1] == 'h') || (fmt[0] == 'l' && fmt[1] == 'l')) {
+		*length = (fmt[0] == 'h') ? 'H' : 'q';
+		fmt += 2;
+	} else if ((*fmt != 0) && (strchr("hlqjztL", *fmt) != NULL)) {
+		*length = *fmt++;
+	}
+	return(fmt);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_capture
+// Description  : Copy the arguments of a format into a record
+//
+// Inputs       : rec - the record (fmt set)
+//                args - the arguments
+// Outputs      : none
+
+static void cart_log_capture(CartLogRecord *rec, va_list args) {
+
+	// Local variables
+	const char *fmt = rec->fmt, *s;
+	char length, *out = rec->args, *end = rec->args + sizeof(rec->args);
+	int stars, i;
+	long long ival;
+	size_t len;
+
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		if (fmt[1] == '%') {
+			fmt += 2;
+			continue;
+		}
+		fmt = cart_log_spec(fmt, &stars, &length);
+		for (i = 0; i < stars; i++) {
+			ival = va_arg(args, int);
+			memcpy(out, &ival, sizeof(ival));
+			out += sizeof(ival);
+		}
+
+		// Integers are widened the way printf would narrow them
+		switch (*fmt) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+			switch (length) {
+			case 'l': ival = (*fmt == 'd' || *fmt == 'i') ? va_arg(args, long) : (long long)va_arg(args, unsigned long); break;
+			case 'q': ival = va_arg(args, long long); break;
+			case 'j': ival = va_arg(args, intmax_t); break;
+			case 'z': ival = va_arg(args, size_t); break;
+			case 't': ival = va_arg(args, ptrdiff_t); break;
+			default:  ival = (*fmt == 'd' || *fmt == 'i') ? va_arg(args, int) : (long long)va_arg(args, unsigned int); break;
+			}
+			if (length == 'h') {
+				ival = (*fmt == 'd' || *fmt == 'i') ? (short)ival : (unsigned short)ival;
+			} else if (length == 'H') {
+				ival = (*fmt == 'd' || *fmt == 'i') ? (signed char)ival : (unsigned char)ival;
+			}
+			memcpy(out, &ival, sizeof(ival));
+			out += sizeof(ival);
+			break;
+
+		case 'c':
+			ival = va_arg(args, int);
+			memcpy(out, &ival, sizeof(ival));
+			out += sizeof(ival);
+			break;
+
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			if (length == 'L') {
+				long double ld = va_arg(args, long double);
+				memcpy(out, &ld, sizeof(ld));
+				out += sizeof(ld);
+			} else {
+				double d = va_arg(args, double);
+				memcpy(out, &d, sizeof(d));
+				out += sizeof(d);
+			}
+			break;
+
+		case 's':
+			// Keep the string, or as much as fits
+			s = va_arg(args, const char *);
+			s = (s == NULL) ? "(null)" : s;
+			len = strnlen(s, (size_t)(end - out - 1));
+			memcpy(out, s, len);
+			out[len] = 0;
+			out += len + 1;
+			break;
+
+		case 'p': {
+			void *p = va_arg(args, void *);
+			memcpy(out, &p, sizeof(p));
+			out += sizeof(p);
+			break;
+		}
+
+		default:
+			// Anything else (%n, or a bad spec) takes no argument we can keep
+			break;
+		}
+		if (*fmt != 0) {
+			fmt++;
+		}
+
+		// Leave room for the largest spec, two '*'s and a long double
+		if (end - out < (ptrdiff_t)(2*sizeof(long long) + sizeof(long double))) {
+			break;
+		}
+	}
+	rec->used = (uint16_t)(out - rec->args);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_format
+// Description  : Format a record, one conversion at a time
+//
+// Inputs       : rec - the record
+//                text, size - where to put the message
+// Outputs      : none
+
+static void cart_log_format(CartLogRecord *rec, char *text, size_t size) {
+
+	// Local variables
+	const char *fmt = rec->fmt, *conv, *pct;
+	char spec[CART_LOG_SPEC_SIZE*2], length, *in = rec->args, *in_end = rec->args + rec->used;
+	size_t pos = 0, n;
+	int stars, i, w;
+	long long ival;
+
+	while ((pos < size - 1) && (pct = strchr(fmt, '%')) != NULL) {
+		n = (size_t)(pct - fmt);
+		n = (n < size - 1 - pos) ? n : size - 1 - pos;
+		memcpy(&text[pos], fmt, n);
+		pos += n;
+		if (pct[1] == '%') {
+			text[pos++] = '%';
+			fmt = pct + 2;
+			continue;
+		}
+		conv = cart_log_spec(pct, &stars, &length);
+		if ((*conv == 0) || (conv - pct >= CART_LOG_SPEC_SIZE) || (in >= in_end)) {
+			fmt = pct;
+			break;
+		}
+
+		// Rebuild the spec with any '*' filled in and integers widened to ll
+		w = 0;
+		for (i = 0; pct + i < conv; i++) {
+			if ((pct[i] == '*') && (in < in_end)) {
+				memcpy(&ival, in, sizeof(ival));
+				in += sizeof(ival);
+				w += snprintf(&spec[w], sizeof(spec) - w, "%d", (int)ival);
+			} else if (strchr("hlqjzt", pct[i]) == NULL || i == 0) {
+				spec[w++] = pct[i];
+			}
+		}
+		if (strchr("diuoxX", *conv) != NULL) {
+			spec[w++] = 'l';
+			spec[w++] = 'l';
+		}
+		spec[w++] = *conv;
+		spec[w] = 0;
+
+		switch (*conv) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			memcpy(&ival, in, sizeof(ival));
+			in += sizeof(ival);
+			n = (*conv == 'c') ? snprintf(&text[pos], size - pos, spec, (int)ival)
+							   : snprintf(&text[pos], size - pos, spec, ival);
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			if (length == 'L') {
+				long double ld;
+				memcpy(&ld, in, sizeof(ld));
+				in += sizeof(ld);
+				n = snprintf(&text[pos], size - pos, spec, ld);
+			} else {
+				double d;
+				memcpy(&d, in, sizeof(d));
+				in += sizeof(d);
+				n = snprintf(&text[pos], size - pos, spec, d);
+			}
+			break;
+		case 's':
+			n = snprintf(&text[pos], size - pos, spec, in);
+			in += strlen(in) + 1;
+			break;
+		case 'p': {
+			void *p;
+			memcpy(&p, in, sizeof(p));
+			in += sizeof(p);
+			n = snprintf(&text[pos], size - pos, spec, p);
+			break;
+		}
+		default:
+			n = 0;
+			break;
+		}
+		pos += (n < size - pos) ? n : size - 1 - pos;
+		fmt = conv + 1;
+	}
+
+	// The rest of the format (or what didn't fit in the record)
+	snprintf(&text[pos], size - pos, "%s", fmt);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_drain
+// Description  : Log the records in the rings in sequence order.  A record
+//                waits while an earlier sequence number is still being
+//                filled in, unless forced (at stop, when nothing else will
+//                be published)
+//
+// Inputs       : force - log what is published even if records are missing
+// Outputs      : the number of records logged
+
+static int cart_log_drain(int force) {
+
+	// Local variables
+	char text[MAX_LOG_MESSAGE_SIZE];
+	CartLogRing *ring, *oldest;
+	CartLogRecord *rec;
+	struct tm when;
+	time_t secs;
+	uint32_t tail;
+	size_t len;
+	int i, count = 0;
+
+	while (1) {
+		// Find the ring whose next record came first
+		oldest = NULL;
+		for (i = 0; i < atomic_load(&LogNumRings); i++) {
+			ring = LogRings[i];
+			tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+			if ((atomic_load_explicit(&ring->head, memory_order_acquire) != tail) &&
+				((oldest == NULL) ||
+				 (ring->records[tail & (CART_LOG_RING_SIZE-1)].seq <
+				  oldest->records[atomic_load_explicit(&oldest->tail, memory_order_relaxed) & (CART_LOG_RING_SIZE-1)].seq))) {
+				oldest = ring;
+			}
+		}
+		if (oldest == NULL) {
+			return(count);
+		}
+		tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+		rec = &oldest->records[tail & (CART_LOG_RING_SIZE-1)];
+		if ((rec->seq != LogNextSeq) && !force) {
+			return(count);
+		}
+		LogNextSeq = rec->seq + 1;
+
+		// Format it behind the time it was logged, the library adds the level
+		secs = (time_t)(rec->stamp / 1000000000);
+		localtime_r(&secs, &when);
+		len = strftime(text, sizeof(text), "[%H:%M:%S", &when);
+		len += snprintf(&text[len], sizeof(text) - len, ".%06lu] ", (unsigned long)(rec->stamp % 1000000000) / 1000);
+		cart_log_format(rec, &text[len], sizeof(text) - len);
+		(logMessage)(rec->lvl, "%s", text);
+		atomic_store_explicit(&oldest->tail, tail+1, memory_order_seq_cst);
+		if (atomic_load(&oldest->waiting)) {
+			atomic_store(&oldest->waiting, 0);
+			syscall(SYS_futex, &oldest->tail, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		}
+		count++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_writer
+// Description  : The writer thread, logs records until stopped
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *cart_log_writer(void *arg) {
+	struct timespec idle = { 0, CART_LOG_IDLE_US * 1000L };
+	uint32_t wake;
+
+	while (atomic_load(&LogRunning)) {
+		if (cart_log_drain(0) > 0) {
+			continue;
+		}
+
+		// Say we are going to sleep, then look once more so a record
+		// posted between the two can't be missed
+		wake = atomic_load(&LogWake);
+		atomic_store(&LogSleeping, 1);
+		if ((cart_log_drain(0) == 0) && atomic_load(&LogRunning)) {
+			syscall(SYS_futex, &LogWake, FUTEX_WAIT, wake, &idle, NULL, 0);
+		}
+		atomic_store(&LogSleeping, 0);
+	}
+	cart_log_drain(0);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_record
+// Description  : Record a message in the calling thread's ring for the
+//                writer, or log it now if there is no writer (or no ring)
+//
+// Inputs       : lvl - the level
+//                fmt - the format, a string literal
+//                ... - the arguments
+// Outputs      : 0 if recorded, what logMessage returns otherwise
+
+int cart_log_record(unsigned long lvl, const char *fmt, ...) {
+
+	// Local variables
+	struct timespec wait = { 0, CART_LOG_IDLE_US * 1000L }, now;
+	CartLogRing *ring;
+	CartLogRecord *rec;
+	uint32_t head, tail;
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	if (!atomic_load_explicit(&LogRunning, memory_order_relaxed) || ((ring = cart_log_ring()) == NULL)) {
+		ret = vlogMessage(lvl, fmt, args);
+		va_end(args);
+		return(ret);
+	}
+
+	// Wait for the writer if the ring is full
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= CART_LOG_RING_SIZE) {
+		atomic_store(&ring->waiting, 1);
+		cart_log_wake();
+		tail = atomic_load(&ring->tail);
+		if (head - tail >= CART_LOG_RING_SIZE) {
+			syscall(SYS_futex, &ring->tail, FUTEX_WAIT, tail, &wait, NULL, 0);
+		}
+	}
+	// Stamp it as it takes its place in the order, a wait for room counts as logging
+	rec = &ring->records[head & (CART_LOG_RING_SIZE-1)];
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec->seq = atomic_fetch_add_explicit(&LogSeq, 1, memory_order_relaxed);
+	rec->stamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	rec->lvl = lvl;
+	rec->fmt = fmt;
+	cart_log_capture(rec, args);
+	va_end(args);
+	atomic_store_explicit(&ring->head, head+1, memory_order_seq_cst);
+	if (atomic_load(&LogSleeping)) {
+		cart_log_wake();
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_start
+// Description  : Start the writer thread, and stop it (draining the rings)
+//                when the program exits
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_log_start(void) {
+	if (LogStarted) {
+		return(0);
+	}
+	if (pthread_key_create(&LogRingKey, cart_log_release) != 0) {
+		return(-1);
+	}
+	atomic_store(&LogRunning, 1);
+	if (pthread_create(&LogWriter, NULL, cart_log_writer, NULL) != 0) {
+		atomic_store(&LogRunning, 0);
+		(logMessage)(LOG_ERROR_LEVEL, "Unable to start the log writer, logging synchronously");
+		return(-1);
+	}
+	LogStarted = 1;
+	atexit(cart_log_stop);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_flush
+// Description  : Wait until the writer has logged every record so far
+//
+// Inputs       : none
+// Outputs      : none
+
+void cart_log_flush(void) {
+	struct timespec wait = { 0, 100000L };
+	int i, pending = 1;
+
+	while (atomic_load(&LogRunning) && pending) {
+		pending = 0;
+		for (i = 0; i < atomic_load(&LogNumRings); i++) {
+			pending |= (atomic_load(&LogRings[i]->head) != atomic_load(&LogRings[i]->tail));
+		}
+		if (pending) {
+			nanosleep(&wait, NULL);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_log_stop
+// Description  : Drain the rings and stop the writer, later messages are
+//                logged synchronously
+//
+// Inputs       : none
+// Outputs      : none
+
+void cart_log_stop(void) {
+	if (!LogStarted) {
+		return;
+	}
+	atomic_store(&LogRunning, 0);
+	cart_log_wake();
+	pthread_join(LogWriter, NULL);
+	cart_log_drain(1);
+	LogStarted = 0;
+}
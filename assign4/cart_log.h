@@ -0,0 +1,77 @@
+#ifndef CART_LOG_INCLUDED
+#define CART_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_log.h
+//  Description    : This is the header file for the asynchronous logging
+//                   backend of the CART client.  Including it after
+//                   cmpsc311_log.h turns logMessage into a macro that checks
+//                   the level before its arguments are evaluated and, once
+//                   cart_log_start has run, records them in binary for a
+//                   writer thread to format and log.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdint.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+
+// Defines
+#ifndef CART_LOG_LEVELS
+#define CART_LOG_LEVELS (~0UL)       // Levels compiled in, build with e.g. -DCART_LOG_LEVELS=3
+#endif
+#define CART_LOG_RING_SIZE 256       // Records in each thread's ring, must be a power of 2
+#define CART_LOG_RECORD_SIZE 512     // Bytes in a record (header and arguments)
+#define CART_LOG_MAX_RINGS 128       // Threads that can log at once
+#define CART_LOG_IDLE_US 1000        // Longest sleep before looking at the rings again
+
+/*
+
+ Records
+
+ A record holds the level, the format (which must be a string literal, as
+ every call in the client is) and the arguments, copied out of the va_list
+ by walking the conversions in the format.  Strings are copied into the
+ record, truncated if the record fills.  Each thread logs into its own ring,
+ which only it writes and only the writer thread reads, so neither takes a
+ lock.  A global sequence number lets the writer put the rings back in order,
+ it holds back a record until every earlier number has been published.  The
+ time is taken when the message is logged and written at the front of it.
+ The writer sleeps on a futex when the rings are empty and the next record
+ wakes it.  A thread that finds its ring full waits for the writer, records
+ are never dropped.
+
+ Before cart_log_start (and in programs that never call it) logMessage just
+ calls the library.
+
+*/
+
+//
+// Interface
+
+#define logMessage(lvl, ...) ({ \
+	int cart_log_ret = 0; \
+	if (((lvl) & CART_LOG_LEVELS) && levelEnabled(lvl)) { \
+		cart_log_ret = cart_log_record((lvl), __VA_ARGS__); \
+	} \
+	cart_log_ret; })
+	// Log a "printf"-style message, the arguments aren't evaluated unless the level is on
+
+int cart_log_record(unsigned long lvl, const char *fmt, ...);
+	// Record a message for the writer (or log it now if there is no writer)
+
+int cart_log_start(void);
+	// Start the writer thread, it is stopped (and the rings drained) at exit
+
+void cart_log_flush(void);
+	// Wait until every message recorded so far has been logged
+
+void cart_log_stop(void);
+	// Drain the rings and stop the writer thread
+
+#endif
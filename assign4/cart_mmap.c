@@ -0,0 +1,561 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_mmap.c
+//  Description    : This is the implementation of the memory mappings of
+//                   CART files, demand paged with userfaultfd.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/userfaultfd.h>
+
+// Project Includes
+#include <cart_mmap.h>
+#include <cart_driver.h>
+#include <cart_controller.h>
+#include <cart_support.h>
+#include <cmpsc311_log.h>
+#include <cart_log.h>
+#include <cart_timeline.h>
+#include <cmpsc311_util.h>
+
+// A mapping of part of a file
+typedef struct {
+	char *addr;                          // Start of the mapping, NULL if the slot is free
+	size_t len;                          // Bytes mapped (whole pages)
+	uint32_t file;                       // The file's place in the table
+	uint64_t offset;                     // File offset of the first page
+	uint32_t pages;                      // Pages mapped
+	char *resident;                      // Pages filled, one byte each
+	char *dirty;                         // Pages stored to since they were last synced
+	uint32_t next;                       // The page after the last one filled
+	uint32_t window;                     // Pages the last fault filled
+	int failed;                          // A page couldn't be read and was filled with zeros
+} CartMapping;
+
+//
+// Global data
+
+CartMapping Mappings[CART_MMAP_MAX];     // The open mappings
+pthread_mutex_t MmapLock = PTHREAD_MUTEX_INITIALIZER; // Guards the mappings against the fault thread
+pthread_t MmapThread;                    // The fault thread
+int MmapFd = -1;                         // The userfaultfd, -1 until the first mapping
+int MmapStop = -1;                       // Eventfd telling the fault thread to exit
+int MmapWriteProtect;                    // Write-protect faults track the dirty pages
+size_t MmapPageSize;                     // Bytes in a page
+int mmapfaults;                          // Faults that filled pages
+int mmapprefetched;                      // Pages filled ahead of the page that faulted
+int mmapwritten;                         // Pages written back by cart_msync
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_protect
+// Description  : Write-protect pages of a mapping, or lift the protection
+//                (which wakes the threads waiting on them)
+//
+// Inputs       : map - the mapping
+//                page, count - the pages
+//                protect - 1 to protect, 0 to lift
+// Outputs      : 0 if successful, -1 if failure
+
+static int cart_mmap_protect(CartMapping *map, uint32_t page, uint32_t count, int protect) {
+	struct uffdio_writeprotect wp;
+
+	wp.range.start = (uintptr_t)map->addr + (size_t)page * MmapPageSize;
+	wp.range.len = (size_t)count * MmapPageSize;
+	wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+	if (ioctl(MmapFd, UFFDIO_WRITEPROTECT, &wp) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to write-protect mapped pages [%s]", strerror(errno));
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_fill
+// Description  : Fill the page that faulted and, if the faults are running
+//                forward, the pages after it
+//
+// Inputs       : map - the mapping
+//                page - the page that faulted
+//                write - the fault was a store
+// Outputs      : 0 if successful, -1 if failure
+
+static int cart_mmap_fill(CartMapping *map, uint32_t page, int write) {
+	struct uffdio_copy copy;
+	uint32_t count, frame, frames, have, per = MmapPageSize / CART_FRAME_SIZE;
+	file *mfile = &files[map->file];
+	uint64_t span = CART_TIMELINE_BEGIN();
+	char *buf;
+	int ret = 0;
+
+	// Faults that pick up where the last one ended double the window
+	map->window = (page == map->next) ? min(map->window * 2, CART_MMAP_PREFETCH_MAX) : 1;
+	for (count = 1; (count < map->window) && (page + count < map->pages) && !map->resident[page + count]; count++);
+	if ((buf = calloc(count, MmapPageSize)) == NULL) {
+		return(-1);
+	}
+
+	// Read the frames the file has, past its end stays zero
+	frame = (map->offset / CART_FRAME_SIZE) + page * per;
+	have = (frame < mfile->NumberOfFrames) ? mfile->NumberOfFrames - frame : 0;
+	frames = min(count * per, have);
+	if ((frames > 0) && ((cart_flush_file(mfile) != 0) ||
+			(cart_load_frames(&mfile->CartFrame[frame], frames, 0, buf) != 0))) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to read frames %u-%u of mapped file [%s], filling with zeros",
+			frame, frame + frames - 1, mfile->path);
+		memset(buf, 0x0, count * MmapPageSize);
+		map->failed = 1;
+		ret = -1;
+	}
+
+	// Copy the pages in, write-protected so the first store is seen
+	copy.dst = (uintptr_t)map->addr + (size_t)page * MmapPageSize;
+	copy.src = (uintptr_t)buf;
+	copy.len = (size_t)count * MmapPageSize;
+	copy.mode = (MmapWriteProtect && !write) ? UFFDIO_COPY_MODE_WP : 0;
+	if ((ioctl(MmapFd, UFFDIO_COPY, &copy) != 0) && (errno != EEXIST)) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to fill mapped pages [%s]", strerror(errno));
+		free(buf);
+		return(-1);
+	}
+	if (MmapWriteProtect && write && (count > 1)) {
+		cart_mmap_protect(map, page + 1, count - 1, 1);
+	}
+	memset(&map->resident[page], 1, count);
+	map->dirty[page] |= write;
+	map->next = page + count;
+	mmapfaults++;
+	mmapprefetched += count - 1;
+	free(buf);
+	CART_TIMELINE_END("driver", "mmap_fault", cart_timeline_track(), span, "file,page,pages",
+		map->file, page, count);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_handler
+// Description  : The fault thread, filling missing pages and marking
+//                protected ones dirty until it is told to stop
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+static void *cart_mmap_handler(void *arg) {
+	struct pollfd fds[2] = { { .fd = MmapFd, .events = POLLIN }, { .fd = MmapStop, .events = POLLIN } };
+	struct uffd_msg msg;
+	struct uffdio_range wake;
+	CartMapping *map;
+	uint32_t page;
+	uintptr_t addr;
+	int i;
+
+	while (1) {
+		if ((poll(fds, 2, -1) < 0) && (errno != EINTR)) {
+			logMessage(LOG_ERROR_LEVEL, "Mapping fault thread poll failed [%s]", strerror(errno));
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			break;
+		}
+		if (!(fds[0].revents & POLLIN) || (read(MmapFd, &msg, sizeof(msg)) != sizeof(msg)) ||
+				(msg.event != UFFD_EVENT_PAGEFAULT)) {
+			continue;
+		}
+
+		// Find the mapping and page that faulted
+		addr = (uintptr_t)msg.arg.pagefault.address;
+		pthread_mutex_lock(&MmapLock);
+		for (i = 0, map = NULL; (i < CART_MMAP_MAX) && (map == NULL); i++) {
+			if ((Mappings[i].addr != NULL) && (addr >= (uintptr_t)Mappings[i].addr) &&
+					(addr < (uintptr_t)Mappings[i].addr + Mappings[i].len)) {
+				map = &Mappings[i];
+			}
+		}
+		if (map == NULL) {
+			pthread_mutex_unlock(&MmapLock);
+			continue;
+		}
+		page = (addr - (uintptr_t)map->addr) / MmapPageSize;
+
+		if (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {
+			// First store since the page was filled or synced
+			map->dirty[page] = 1;
+			cart_mmap_protect(map, page, 1, 0);
+		} else if (map->resident[page]) {
+			// Another thread faulted on it too, it only needs waking
+			wake.start = (uintptr_t)map->addr + (size_t)page * MmapPageSize;
+			wake.len = MmapPageSize;
+			ioctl(MmapFd, UFFDIO_WAKE, &wake);
+		} else {
+			cart_mmap_fill(map, page, (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) != 0);
+		}
+		pthread_mutex_unlock(&MmapLock);
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_start
+// Description  : Open the userfaultfd and start the fault thread
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int cart_mmap_start(void) {
+	struct uffdio_api api;
+
+	MmapPageSize = sysconf(_SC_PAGESIZE);
+	if (MmapPageSize % CART_FRAME_SIZE != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Pages of %lu bytes don't hold whole frames", MmapPageSize);
+		return(-1);
+	}
+
+	// Without the privilege for kernel faults, user faults are all mappings need
+	if (((MmapFd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK)) < 0) &&
+			((MmapFd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY)) < 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to open a userfaultfd [%s]", strerror(errno));
+		return(-1);
+	}
+	api.api = UFFD_API;
+	api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+	if (ioctl(MmapFd, UFFDIO_API, &api) != 0) {
+		api.features = 0;
+		if (ioctl(MmapFd, UFFDIO_API, &api) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Unable to set up the userfaultfd [%s]", strerror(errno));
+			close(MmapFd);
+			MmapFd = -1;
+			return(-1);
+		}
+	}
+	MmapWriteProtect = (api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) != 0;
+	if (!MmapWriteProtect) {
+		logMessage(LOG_WARNING_LEVEL, "No write-protect faults, every filled page is written back at sync");
+	}
+	if (((MmapStop = eventfd(0, EFD_CLOEXEC)) < 0) ||
+			(pthread_create(&MmapThread, NULL, cart_mmap_handler, NULL) != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to start the mapping fault thread");
+		if (MmapStop >= 0) {
+			close(MmapStop);
+		}
+		close(MmapFd);
+		MmapFd = MmapStop = -1;
+		return(-1);
+	}
+	mmapfaults = 0;
+	mmapprefetched = 0;
+	mmapwritten = 0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap
+// Description  : Map part of an open file into memory, its pages are read
+//                when they are first touched
+//
+// Inputs       : fd - the file handle
+//                offset - file offset of the mapping, a multiple of the page size
+//                len - bytes to map
+// Outputs      : the address of the mapping, NULL if failure
+
+void *cart_mmap(int16_t fd, uint64_t offset, uint32_t len) {
+	struct uffdio_register reg;
+	CartMapping *map = NULL;
+	file *mfile = cart_handle_file(fd);
+	int i;
+
+	if (mfile == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad file handle. \n");
+		return(NULL);
+	}
+	pthread_mutex_lock(&MmapLock);
+	if ((MmapFd < 0) && (cart_mmap_start() != 0)) {
+		pthread_mutex_unlock(&MmapLock);
+		return(NULL);
+	}
+	if ((len == 0) || (offset % MmapPageSize != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Error: Bad mapping of %u bytes at %lu \n", len, (unsigned long)offset);
+		pthread_mutex_unlock(&MmapLock);
+		return(NULL);
+	}
+	for (i = 0; (i < CART_MMAP_MAX) && (map == NULL); i++) {
+		if (Mappings[i].addr == NULL) {
+			map = &Mappings[i];
+		}
+	}
+	if (map == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Error: All %d mappings in use \n", CART_MMAP_MAX);
+		pthread_mutex_unlock(&MmapLock);
+		return(NULL);
+	}
+
+	// Reserve the pages and have their faults sent to the fault thread
+	memset(map, 0x0, sizeof(CartMapping));
+	map->pages = (len + MmapPageSize - 1) / MmapPageSize;
+	map->len = (size_t)map->pages * MmapPageSize;
+	map->file = CART_FILE_INDEX(mfile);
+	map->offset = offset;
+	map->next = (uint32_t)-1;
+	map->addr = mmap(NULL, map->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map->addr == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to reserve %lu bytes for a mapping [%s]", map->len, strerror(errno));
+		map->addr = NULL;
+		pthread_mutex_unlock(&MmapLock);
+		return(NULL);
+	}
+	reg.range.start = (uintptr_t)map->addr;
+	reg.range.len = map->len;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING | (MmapWriteProtect ? UFFDIO_REGISTER_MODE_WP : 0);
+	map->resident = calloc(map->pages, 1);
+	map->dirty = calloc(map->pages, 1);
+	if (ioctl(MmapFd, UFFDIO_REGISTER, &reg) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to register a mapping [%s]", strerror(errno));
+		munmap(map->addr, map->len);
+		free(map->resident);
+		free(map->dirty);
+		map->addr = NULL;
+		pthread_mutex_unlock(&MmapLock);
+		return(NULL);
+	}
+	pthread_mutex_unlock(&MmapLock);
+	return(map->addr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_find
+// Description  : Find the mapping starting at an address (the lock is held)
+//
+// Inputs       : addr - the address cart_mmap returned
+// Outputs      : the mapping, NULL if there isn't one
+
+static CartMapping *cart_mmap_find(void *addr) {
+	int i;
+
+	for (i = 0; i < CART_MMAP_MAX; i++) {
+		if ((Mappings[i].addr != NULL) && (Mappings[i].addr == addr)) {
+			return(&Mappings[i]);
+		}
+	}
+	logMessage(LOG_ERROR_LEVEL, "Error: %p is not a mapping \n", addr);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_sync
+// Description  : Write the dirty pages of part of a mapping back to their
+//                frames (the lock is held)
+//
+// Inputs       : map - the mapping
+//                first, last - the pages to sync
+// Outputs      : 0 if successful, -1 if failure
+
+static int cart_mmap_sync(CartMapping *map, uint32_t first, uint32_t last) {
+	uint32_t page, run, frame, frames, per = MmapPageSize / CART_FRAME_SIZE;
+	file *mfile;
+
+	if (map->failed) {
+		logMessage(LOG_ERROR_LEVEL, "Error: Mapping of file [%s] has unread pages, not syncing \n", files[map->file].path);
+		return(-1);
+	}
+	mfile = &files[map->file];
+	if (cart_flush_file(mfile) != 0) {
+		return(-1);
+	}
+	for (page = first; page < last; page += run) {
+		for (run = 0; (page + run < last) && (MmapWriteProtect ? map->dirty[page + run] : map->resident[page + run]); run++);
+		if (run == 0) {
+			run = 1;
+			continue;
+		}
+
+		// Protect the pages before reading them so stores during the write fault again
+		if (MmapWriteProtect && (cart_mmap_protect(map, page, run, 1) != 0)) {
+			return(-1);
+		}
+		memset(&map->dirty[page], 0x0, run);
+		frame = (map->offset / CART_FRAME_SIZE) + page * per;
+		if (frame >= mfile->NumberOfFrames) {
+			break;
+		}
+		frames = min(run * per, mfile->NumberOfFrames - frame);
+		if ((cart_lfs_relocate(mfile, frame, frames) != 0) ||
+				(cart_store_frames(&mfile->CartFrame[frame], frames, map->addr + (size_t)page * MmapPageSize) != 0)) {
+			logMessage(LOG_ERROR_LEVEL, "Error: Writing back mapped frames %u-%u failed \n", frame, frame + frames - 1);
+			memset(&map->dirty[page], 1, run);
+			return(-1);
+		}
+		mmapwritten += run;
+	}
+	return(cart_lfs_clean());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_msync
+// Description  : Write back the pages of a mapping stored to since they
+//                were filled or last synced
+//
+// Inputs       : addr - the address cart_mmap returned
+//                len - bytes from the start to sync, 0 for the whole mapping
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_msync(void *addr, uint32_t len) {
+	CartMapping *map;
+	uint32_t last;
+	int ret = -1;
+
+	pthread_mutex_lock(&MmapLock);
+	if ((map = cart_mmap_find(addr)) != NULL) {
+		last = (len == 0) ? map->pages : min((len + MmapPageSize - 1) / MmapPageSize, map->pages);
+		ret = cart_mmap_sync(map, 0, last);
+	}
+	pthread_mutex_unlock(&MmapLock);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_munmap
+// Description  : Sync a mapping and give its memory back
+//
+// Inputs       : addr - the address cart_mmap returned
+// Outputs      : 0 if successful, -1 if failure (the mapping is gone either way)
+
+int32_t cart_munmap(void *addr) {
+	struct uffdio_range range;
+	CartMapping *map;
+	int ret = -1;
+
+	pthread_mutex_lock(&MmapLock);
+	if ((map = cart_mmap_find(addr)) != NULL) {
+		ret = cart_mmap_sync(map, 0, map->pages);
+		range.start = (uintptr_t)map->addr;
+		range.len = map->len;
+		ioctl(MmapFd, UFFDIO_UNREGISTER, &range);
+		munmap(map->addr, map->len);
+		free(map->resident);
+		free(map->dirty);
+		map->addr = NULL;
+	}
+	pthread_mutex_unlock(&MmapLock);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_mmap_close_all
+// Description  : Sync and unmap every mapping still open and stop the fault
+//                thread
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if a mapping failed to sync
+
+int cart_mmap_close_all(void) {
+	uint64_t one = 1;
+	int i, ret = 0;
+
+	if (MmapFd < 0) {
+		return(0);
+	}
+	for (i = 0; i < CART_MMAP_MAX; i++) {
+		if ((Mappings[i].addr != NULL) && (cart_munmap(Mappings[i].addr) != 0)) {
+			ret = -1;
+		}
+	}
+	if (write(MmapStop, &one, sizeof(one)) == sizeof(one)) {
+		pthread_join(MmapThread, NULL);
+	}
+	close(MmapStop);
+	close(MmapFd);
+	MmapFd = MmapStop = -1;
+	logMessage(LOG_OUTPUT_LEVEL, "Mapping Faults:%d\nMapping Pages Prefetched:%d\nMapping Pages Written:%d\n",
+		mmapfaults, mmapprefetched, mmapwritten);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartMmapUnitTest
+// Description  : Write a file on the in-process controller, map it, scan
+//                and change it through the mapping and read it back.  It
+//                is skipped where user faults can't be had (a seccomp
+//                profile, or vm.unprivileged_userfaultfd=0)
+//
+// Inputs       : none
+// Outputs      : 0 if successful or skipped, -1 if failure
+
+int cartMmapUnitTest(void) {
+	uint32_t size = 40 * CART_FRAME_SIZE + 100, i;
+	char *data = malloc(size), *back = malloc(size), *map;
+	int16_t fd;
+	int ret = -1, skipped = 0;
+
+	logMessage(LOG_OUTPUT_LEVEL, "Mapping unit test on the in-process controller");
+	cart_set_direct_bus(1);
+	if (cart_poweron() != 0) {
+		free(data);
+		free(back);
+		return(-1);
+	}
+	getRandomData(data, size);
+	fd = cart_open("mmap_test");
+	if (cart_write(fd, data, size) != size) {
+		logMessage(LOG_ERROR_LEVEL, "Mapping unit test: unable to write the file");
+	} else if ((MmapFd < 0) && (cart_mmap_start() != 0)) {
+		logMessage(LOG_WARNING_LEVEL, "Mapping unit test skipped, the fault thread can't be started here");
+		skipped = 1;
+		ret = 0;
+	} else if ((map = cart_mmap(fd, 0, size)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Mapping unit test: unable to map the file");
+	} else if (memcmp(map, data, size) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Mapping unit test: mapped bytes differ from the file");
+	} else if (mmapfaults >= (int)((size + MmapPageSize - 1) / MmapPageSize)) {
+		logMessage(LOG_ERROR_LEVEL, "Mapping unit test: a scan took %d faults, nothing was prefetched", mmapfaults);
+	} else {
+		// Store into a few pages, sync and read them back through the driver
+		for (i = 0; i < size; i += 3 * MmapPageSize + 17) {
+			map[i] = data[i] = (char)(i * 7);
+		}
+		map[size - 1] = data[size - 1] = 'z';
+		if ((cart_msync(map, 0) != 0) || (cart_seek(fd, 0) != 0) || (cart_read(fd, back, size) != size)) {
+			logMessage(LOG_ERROR_LEVEL, "Mapping unit test: unable to sync and read back the file");
+		} else if (memcmp(back, data, size) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Mapping unit test: synced stores are missing from the file");
+		} else if (MmapWriteProtect && (mmapwritten == (int)((size + MmapPageSize - 1) / MmapPageSize))) {
+			logMessage(LOG_ERROR_LEVEL, "Mapping unit test: clean pages were written back");
+		} else {
+			ret = cart_munmap(map);
+		}
+	}
+	if (cart_close(fd) != 0 || cart_poweroff() != 0) {
+		ret = -1;
+	}
+	free(data);
+	free(back);
+	if ((ret == 0) && !skipped) {
+		logMessage(LOG_OUTPUT_LEVEL, "Mapping unit test completed successfully.");
+	}
+	return(ret);
+}
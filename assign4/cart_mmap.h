@@ -0,0 +1,60 @@
+#ifndef CART_MMAP_INCLUDED
+#define CART_MMAP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_mmap.h
+//  Description    : This is the header file for the memory mappings of CART
+//                   files: regions of anonymous memory whose pages are
+//                   filled from the cache or the bus on first touch by a
+//                   userfaultfd thread and written back with cart_msync.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define CART_MMAP_MAX 16                 // Mappings that can be open at once
+#define CART_MMAP_PREFETCH_MAX 16        // Most pages filled by one fault
+
+/*
+
+ Mappings
+
+ cart_mmap reserves the pages of the mapping and registers them with a
+ userfaultfd.  Nothing is read until a page is touched: the fault thread
+ then reads the frames of the page (the cache first, then the bus) and
+ copies them in.  A fault on the page after the last one filled doubles the
+ pages filled, up to CART_MMAP_PREFETCH_MAX, so a scan takes a few faults
+ rather than one a page; any other fault starts over at one page.
+
+ Pages are filled write-protected, so the first store to each one faults
+ again and marks it dirty.  cart_msync protects the dirty pages again and
+ writes their frames with cart_store_frames (WRFRME/WRFRMS, keeping the
+ cache and dedup up to date).  Kernels without write-protect faults get
+ every filled page written back instead.
+
+ The offset must be a multiple of the page size.  Bytes past the end of
+ the file read as zeros and the mapping can't grow the file, so stores to
+ them are not part of it.  Pages already filled don't see later cart_write
+ calls, and cart_read doesn't see stores until they are synced.  The driver
+ is single threaded: the fault thread makes its driver calls while the
+ thread that faulted waits, so mapped memory mustn't be passed to the
+ driver itself (as a cart_write buffer, say).  Mappings still open at
+ poweroff are synced and unmapped.
+
+*/
+
+//
+// Functional Prototypes
+
+int cart_mmap_close_all(void);
+	// Sync and unmap every mapping and stop the fault thread (at poweroff)
+
+int cartMmapUnitTest(void);
+	// Map a file on the in-process controller and check faults and write-back
+
+#endif
@@ -20,11 +20,17 @@
 #define CART_NET_HEADER_SIZE sizeof(CartXferRegister)
 #define CART_DEFAULT_IP "127.0.0.1"
 #define CART_DEFAULT_PORT 21785
+#define CART_MAX_SERVERS 8   // Servers frames can be striped over (ports port..port+7)
+#define CART_MAX_CONNECTIONS 8  // Connections to each server, sharing out its cartridges
+#define CART_MAX_LANES (CART_MAX_SERVERS*CART_MAX_CONNECTIONS)
 
 // Global data
 extern int            cart_network_shutdown; // Flag indicating shutdown
 extern unsigned char *cart_network_address;  // Address of CART server
 extern unsigned short cart_network_port;     // Port of CART server
+extern int            cart_network_shm;      // Use shared memory, not TCP
+extern int            cart_network_servers;  // Servers the frames are striped over
+extern int            cart_network_connections; // Connections to each server
 
 //
 // Functional Prototypes
@@ -32,6 +38,15 @@ extern unsigned short cart_network_port;     // Port of CART server
 CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf);
 	// This is the implementation of the client operation (cart_client.c)
 
+int client_cart_bus_send(int conn, CartXferRegister reg, void *buf);
+	// Send a request on one of the connections without waiting (cart_client.c)
+
+CartXferRegister client_cart_bus_recv(int conn, CartXferRegister reg, void *buf);
+	// Receive the response to the oldest request sent on a connection (cart_client.c)
+
+int client_cart_bus_wait(int *conns, int count, int64_t timeout);
+	// Wait up to timeout usec (-1 for ever) for a connection to respond (cart_client.c)
+
 int cart_server( void );
 	// This is the implementation of the server application (cart_server.c)
 
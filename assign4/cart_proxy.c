@@ -0,0 +1,752 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_proxy.c
+//  Description    : This is a TCP proxy that sits between cart_client and a
+//                   CART server and makes localhost look like a WAN.  It
+//                   reads whole messages in the CART framing (8-byte network
+//                   order register, then any frames) and holds each one back
+//                   for a one-way delay plus jitter, behind a bandwidth limit
+//                   shared by every connection in that direction.  LDCART
+//                   responses can cost extra, like a slow cartridge load.
+//                   Messages are held, not the connection, so requests a
+//                   client pipelines stay in flight together.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cart_support.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CART_PROXY_DEFAULT_PORT (CART_DEFAULT_PORT + CART_MAX_SERVERS) // Clear of the servers' ports
+#define CART_PROXY_ARGUMENTS "hvl:p:i:u:S:d:j:b:L:"
+#define USAGE \
+	"USAGE: cart_proxy [-h] [-v] [-l <logfile>] [-p <port>] [-i <ip>] [-u <port>] [-S <n>] [-d <usec>] [-j <usec>] [-b <KB/s>] [-L <usec>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on (default 21793)\n" \
+	"    -i - IP address of the server to forward to\n" \
+	"    -u - port number of the server to forward to\n" \
+	"    -S - forward <n> consecutive ports, for a client striping over <n> servers\n" \
+	"    -d - delay every message by <usec> each way (a round trip costs twice this)\n" \
+	"    -j - add up to <usec> more at random to each message\n" \
+	"    -b - limit each direction to <KB/s>, shared by all connections\n" \
+	"    -L - add <usec> to every LDCART response\n" \
+	"\n"
+
+// A message held by the proxy, or a response one is waiting for
+typedef struct proxy_msg {
+	struct proxy_msg *next;
+	uint64_t          due;     // When to pass it on (nsec, monotonic)
+	uint8_t           op;      // The request opcode
+	size_t            len;     // Bytes of data (or of response payload expected)
+	char              data[];  // The register and frames
+} proxy_msg;
+
+// A queue of messages between two threads of a connection
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  ready;
+	proxy_msg      *head, *tail;
+	uint64_t        last;      // Due time of the last message, they leave in order
+	int             closed;    // No more messages will be added
+} proxy_queue;
+
+// One direction of the link, shared by every connection
+typedef struct {
+	pthread_mutex_t lock;
+	uint64_t        free;      // When the link has sent everything given to it
+	uint64_t        messages, bytes;
+} proxy_link;
+
+// A proxied client connection
+typedef struct {
+	int           client, server;
+	proxy_queue   up;          // Requests on their way to the server
+	proxy_queue   pending;     // Requests waiting for a response
+	proxy_queue   down;        // Responses on their way to the client
+	unsigned int  seed;        // Jitter for requests
+	unsigned int  seed_down;   // Jitter for responses
+} proxy_conn;
+
+// A port being forwarded
+typedef struct {
+	unsigned short listen;     // Where clients connect
+	unsigned short upstream;   // Where the server is
+} proxy_port;
+
+//
+// Global data
+int                cart_network_shutdown = 0;    // Flag indicating shutdown
+unsigned char     *cart_network_address = NULL;  // Address of CART server
+unsigned short     cart_network_port = 0;        // Port of CART server
+unsigned long      proxy_delay = 0;              // One-way delay of every message (usec)
+unsigned long      proxy_jitter = 0;             // Most random delay added (usec)
+unsigned long      proxy_bandwidth = 0;          // Each direction's limit (KB/s), 0 for none
+unsigned long      proxy_ldcart = 0;             // Extra delay of an LDCART response (usec)
+proxy_link         proxy_uplink = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };   // Client to server
+proxy_link         proxy_downlink = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 }; // Server to client
+
+//
+// Functional Prototypes
+
+void *proxy_listen(void *arg);                                 // Accept and proxy clients on a port
+void *proxy_session(void *arg);                                // Proxy one client connection
+void *proxy_forward(void *arg);                                // Read requests, hold them for the server
+void *proxy_deliver_up(void *arg);                             // Pass requests on to the server
+void *proxy_backward(void *arg);                               // Read responses, hold them for the client
+void *proxy_deliver_down(void *arg);                           // Pass responses on to the client
+uint64_t proxy_due(proxy_link *link, proxy_queue *queue, size_t len, uint64_t extra, unsigned int *seed); // When a message arrives
+void proxy_queue_init(proxy_queue *queue);                     // Set up an empty queue
+void proxy_queue_push(proxy_queue *queue, proxy_msg *msg);     // Add a message
+proxy_msg *proxy_queue_pop(proxy_queue *queue);                // Take the oldest message, NULL once closed
+void proxy_queue_close(proxy_queue *queue);                    // Add no more messages
+void proxy_queue_free(proxy_queue *queue);                     // Free what is left
+uint64_t proxy_now(void);                                      // The monotonic clock (nsec)
+int proxy_recv(int sock, void *buf, size_t len);               // Read exactly len bytes
+int proxy_send(int sock, void *buf, size_t len);               // Write exactly len bytes
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART proxy
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, log_initialized = 0, servers = 1, i;
+	unsigned short port = CART_PROXY_DEFAULT_PORT;
+	proxy_port ports[CART_MAX_SERVERS];
+	pthread_t thread;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_PROXY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			enableLogLevels(LOG_INFO_LEVEL);
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the port to listen on
+			if ( sscanf(optarg, "%hu", &port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'i': // Set the IP address of the server
+			cart_network_address = (unsigned char *)optarg;
+			break;
+
+		case 'u': // Set the port of the server
+			if ( sscanf(optarg, "%hu", &cart_network_port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'S': // Forward consecutive ports to consecutive servers
+			if ( (sscanf(optarg, "%d", &servers) != 1) || (servers < 1) || (servers > CART_MAX_SERVERS) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad server count [%s], 1 to %d", optarg, CART_MAX_SERVERS );
+				return(-1);
+			}
+			break;
+
+		case 'd': // Delay each message
+			if ( sscanf(optarg, "%lu", &proxy_delay) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad delay [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'j': // Jitter
+			if ( sscanf(optarg, "%lu", &proxy_jitter) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad jitter [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'b': // Bandwidth limit
+			if ( sscanf(optarg, "%lu", &proxy_bandwidth) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad bandwidth [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'L': // Cartridge load cost
+			if ( sscanf(optarg, "%lu", &proxy_ldcart) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad load delay [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( cart_network_port == 0 ) {
+		cart_network_port = CART_DEFAULT_PORT;
+	}
+	signal(SIGPIPE, SIG_IGN);  // A peer that goes away is seen as a failed write
+	logMessage(LOG_INFO_LEVEL, "Proxy delay %lu usec, jitter %lu usec, bandwidth %lu KB/s, LDCART %lu usec",
+		proxy_delay, proxy_jitter, proxy_bandwidth, proxy_ldcart);
+
+	// Listen on each port, the last on this thread
+	for (i = 0; i < servers; i++) {
+		ports[i].listen = port + i;
+		ports[i].upstream = cart_network_port + i;
+		if (i < servers - 1) {
+			if (pthread_create(&thread, NULL, proxy_listen, &ports[i]) != 0) {
+				logMessage(LOG_ERROR_LEVEL, "Proxy listener thread failed");
+				return(-1);
+			}
+			pthread_detach(thread);
+		}
+	}
+	return( (proxy_listen(&ports[servers - 1]) == NULL) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_listen
+// Description  : Accept clients on a port and proxy each to the server on
+//                its own threads, until shutdown
+//
+// Inputs       : arg - the proxy_port
+// Outputs      : NULL if successful, the arg if the port couldn't be set up
+
+void *proxy_listen(void *arg) {
+
+	// Local variables
+	proxy_port *port = arg;
+	struct sockaddr_in saddr, caddr;
+	socklen_t clen;
+	int server, client, upstream, one = 1;
+	proxy_conn *conn;
+	pthread_t thread;
+
+	// Create, bind and listen on the proxy socket
+	memset(&saddr, 0x0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons(port->listen);
+	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if ( ((server = socket(PF_INET, SOCK_STREAM, 0)) == -1) ||
+		 (setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) ||
+		 (bind(server, (struct sockaddr *)&saddr, sizeof(saddr)) != 0) ||
+		 (listen(server, CART_MAX_BACKLOG) != 0) ) {
+		logMessage(LOG_ERROR_LEVEL, "Proxy setup failed on port %d [%s]", port->listen, strerror(errno));
+		return(arg);
+	}
+	logMessage(LOG_INFO_LEVEL, "Proxy listening on port [%d] for [%s/%d]", port->listen,
+		(cart_network_address == NULL) ? CART_DEFAULT_IP : (char *)cart_network_address, port->upstream);
+
+	// Connect each client to the server
+	memset(&saddr, 0x0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons(port->upstream);
+	if ( inet_aton((cart_network_address == NULL) ? CART_DEFAULT_IP : (char *)cart_network_address,
+			&saddr.sin_addr) == 0 ) {
+		logMessage(LOG_ERROR_LEVEL, "Proxy server address is bad [%s]", cart_network_address);
+		close(server);
+		return(arg);
+	}
+	while (!cart_network_shutdown) {
+		clen = sizeof(caddr);
+		if ((client = accept(server, (struct sockaddr *)&caddr, &clen)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "Proxy accept failed [%s]", strerror(errno));
+			continue;
+		}
+		if ( ((upstream = socket(PF_INET, SOCK_STREAM, 0)) == -1) ||
+			 (connect(upstream, (struct sockaddr *)&saddr, sizeof(saddr)) != 0) ) {
+			logMessage(LOG_ERROR_LEVEL, "Proxy connect to port %d failed [%s]", port->upstream, strerror(errno));
+			if (upstream != -1) {
+				close(upstream);
+			}
+			close(client);
+			continue;
+		}
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		setsockopt(upstream, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		logMessage(LOG_INFO_LEVEL, "Proxy client connection [%s/%d]",
+			inet_ntoa(caddr.sin_addr), ntohs(caddr.sin_port));
+
+		conn = calloc(1, sizeof(proxy_conn));
+		conn->client = client;
+		conn->server = upstream;
+		conn->seed = (unsigned int)proxy_now();
+		conn->seed_down = conn->seed ^ 0x5bd1e995;
+		if (pthread_create(&thread, NULL, proxy_session, conn) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Proxy session thread failed");
+			close(client);
+			close(upstream);
+			free(conn);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	close(server);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_session
+// Description  : Proxy one client connection until both sides are done:
+//                a thread reads each direction and another delivers it
+//
+// Inputs       : arg - the proxy_conn, freed when the session ends
+// Outputs      : NULL
+
+void *proxy_session(void *arg) {
+
+	// Local variables
+	proxy_conn *conn = arg;
+	pthread_t threads[3];
+	int started = 0;
+
+	proxy_queue_init(&conn->up);
+	proxy_queue_init(&conn->pending);
+	proxy_queue_init(&conn->down);
+	if ( (pthread_create(&threads[started], NULL, proxy_deliver_up, conn) == 0) && (++started) &&
+		 (pthread_create(&threads[started], NULL, proxy_backward, conn) == 0) && (++started) &&
+		 (pthread_create(&threads[started], NULL, proxy_deliver_down, conn) == 0) && (++started) ) {
+		proxy_forward(conn);
+	} else {
+		logMessage(LOG_ERROR_LEVEL, "Proxy connection threads failed");
+		shutdown(conn->client, SHUT_RDWR);
+		shutdown(conn->server, SHUT_RDWR);
+		proxy_queue_close(&conn->up);
+		proxy_queue_close(&conn->pending);
+		proxy_queue_close(&conn->down);
+	}
+
+	while (started > 0) {
+		pthread_join(threads[--started], NULL);
+	}
+	close(conn->client);
+	close(conn->server);
+	proxy_queue_free(&conn->up);
+	proxy_queue_free(&conn->pending);
+	proxy_queue_free(&conn->down);
+	free(conn);
+	logMessage(LOG_INFO_LEVEL, "Proxy connection closed, %lu requests (%lu bytes) and %lu responses (%lu bytes) so far",
+		proxy_uplink.messages, proxy_uplink.bytes, proxy_downlink.messages, proxy_downlink.bytes);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_forward
+// Description  : Read requests from the client, working out from the
+//                register how many bytes follow it, and queue each for the
+//                server, noting the response it will get
+//
+// Inputs       : arg - the proxy_conn
+// Outputs      : NULL
+
+void *proxy_forward(void *arg) {
+
+	// Local variables
+	proxy_conn *conn = arg;
+	CartXferRegister wire, reg;
+	proxy_msg *msg, *expect;
+	size_t inlen, outlen, count;
+	uint8_t op;
+
+	while (proxy_recv(conn->client, &wire, sizeof(wire)) == 0) {
+
+		// Work out how many frames travel with the request and the response
+		reg = ntohll64(wire);
+		op = (reg & KY1_MASK) >> 56;
+		count = ((op == CART_OP_RDFRMS) || (op == CART_OP_WRFRMS)) ? (reg & CNT_MASK) : 1;
+		if (op == CART_OP_WRPART) {
+			count = reg & CNT_MASK;
+			if (count > CART_FRAME_SIZE) {
+				logMessage(LOG_ERROR_LEVEL, "Proxy partial write too large [%lu bytes]", count);
+				break;
+			}
+		} else if (count > CART_MAX_XFER_FRAMES) {
+			logMessage(LOG_ERROR_LEVEL, "Proxy transfer too large [%lu frames]", count);
+			break;
+		}
+		inlen = ((op == CART_OP_WRFRME) || (op == CART_OP_WRFRMS)) ? count*CART_FRAME_SIZE : 0;
+		if ((op == CART_OP_WRPART) && (count > 0)) {
+			inlen = CART_PARTIAL_HEADER_SIZE + count;
+		}
+		outlen = ((op == CART_OP_RDFRME) || (op == CART_OP_RDFRMS)) ? count*CART_FRAME_SIZE : 0;
+
+		// Read the payload, then hold the request for the delay
+		msg = malloc(sizeof(proxy_msg) + sizeof(wire) + inlen);
+		memcpy(msg->data, &wire, sizeof(wire));
+		if ((inlen > 0) && (proxy_recv(conn->client, msg->data + sizeof(wire), inlen) != 0)) {
+			free(msg);
+			break;
+		}
+		msg->op = op;
+		msg->len = sizeof(wire) + inlen;
+		msg->due = proxy_due(&proxy_uplink, &conn->up, msg->len, 0, &conn->seed);
+		expect = malloc(sizeof(proxy_msg));
+		expect->due = 0;
+		expect->op = op;
+		expect->len = outlen;
+		proxy_queue_push(&conn->pending, expect);
+		proxy_queue_push(&conn->up, msg);
+	}
+
+	// The client is done (or gone), let the rest drain
+	proxy_queue_close(&conn->up);
+	proxy_queue_close(&conn->pending);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_deliver_up
+// Description  : Send each request to the server when it is due, then tell
+//                the server there are no more
+//
+// Inputs       : arg - the proxy_conn
+// Outputs      : NULL
+
+void *proxy_deliver_up(void *arg) {
+
+	// Local variables
+	proxy_conn *conn = arg;
+	proxy_msg *msg;
+	int failed = 0;
+
+	while ((msg = proxy_queue_pop(&conn->up)) != NULL) {
+		if (!failed && (proxy_send(conn->server, msg->data, msg->len) != 0)) {
+			logMessage(LOG_ERROR_LEVEL, "Proxy lost the server [%s]", strerror(errno));
+			shutdown(conn->client, SHUT_RD);
+			failed = 1;
+		}
+		free(msg);
+	}
+	shutdown(conn->server, SHUT_WR);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_backward
+// Description  : Read the response to each request in turn from the server
+//                and queue it for the client, LDCART responses carrying the
+//                extra load cost
+//
+// Inputs       : arg - the proxy_conn
+// Outputs      : NULL
+
+void *proxy_backward(void *arg) {
+
+	// Local variables
+	proxy_conn *conn = arg;
+	proxy_msg *expect, *msg;
+	CartXferRegister wire;
+	size_t outlen;
+
+	while ((expect = proxy_queue_pop(&conn->pending)) != NULL) {
+		if (proxy_recv(conn->server, &wire, sizeof(wire)) != 0) {
+			free(expect);
+			break;
+		}
+
+		// Frames only come back with a read that worked
+		outlen = ((ntohll64(wire) & RT_MASK) == 0) ? expect->len : 0;
+		msg = malloc(sizeof(proxy_msg) + sizeof(wire) + outlen);
+		memcpy(msg->data, &wire, sizeof(wire));
+		if ((outlen > 0) && (proxy_recv(conn->server, msg->data + sizeof(wire), outlen) != 0)) {
+			free(msg);
+			free(expect);
+			break;
+		}
+		msg->op = expect->op;
+		msg->len = sizeof(wire) + outlen;
+		msg->due = proxy_due(&proxy_downlink, &conn->down, msg->len,
+			(msg->op == CART_OP_LDCART) ? proxy_ldcart*1000 : 0, &conn->seed_down);
+		proxy_queue_push(&conn->down, msg);
+		free(expect);
+	}
+
+	proxy_queue_close(&conn->down);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_deliver_down
+// Description  : Send each response to the client when it is due
+//
+// Inputs       : arg - the proxy_conn
+// Outputs      : NULL
+
+void *proxy_deliver_down(void *arg) {
+
+	// Local variables
+	proxy_conn *conn = arg;
+	proxy_msg *msg;
+	int failed = 0;
+
+	while ((msg = proxy_queue_pop(&conn->down)) != NULL) {
+		if (!failed && (proxy_send(conn->client, msg->data, msg->len) != 0)) {
+			logMessage(LOG_ERROR_LEVEL, "Proxy lost the client [%s]", strerror(errno));
+			shutdown(conn->server, SHUT_RD);
+			failed = 1;
+		}
+		free(msg);
+	}
+	shutdown(conn->client, SHUT_WR);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_due
+// Description  : Work out when a message read now arrives: it waits for the
+//                link to send what is ahead of it, takes len at the
+//                bandwidth, then the delay, jitter and any extra.  It never
+//                arrives before the message ahead of it on the connection
+//
+// Inputs       : link - the direction it travels
+//                queue - the connection's queue it goes on
+//                len - its size in bytes
+//                extra - more delay for this message (nsec)
+//                seed - the connection's jitter generator
+// Outputs      : when to pass it on (nsec, monotonic)
+
+uint64_t proxy_due(proxy_link *link, proxy_queue *queue, size_t len, uint64_t extra, unsigned int *seed) {
+
+	// Local variables
+	uint64_t now = proxy_now(), sent = now, due;
+
+	pthread_mutex_lock(&link->lock);
+	if (proxy_bandwidth > 0) {
+		// KB/s is bytes per msec
+		sent = ((link->free > now) ? link->free : now) + (uint64_t)len*1000000/proxy_bandwidth;
+		link->free = sent;
+	}
+	link->messages++;
+	link->bytes += len;
+	pthread_mutex_unlock(&link->lock);
+
+	due = sent + (uint64_t)proxy_delay*1000 + extra;
+	if (proxy_jitter > 0) {
+		due += (uint64_t)(rand_r(seed) % (proxy_jitter + 1))*1000;
+	}
+	pthread_mutex_lock(&queue->lock);
+	if (due < queue->last) {
+		due = queue->last;
+	}
+	queue->last = due;
+	pthread_mutex_unlock(&queue->lock);
+	return(due);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_queue_init
+// Description  : Set up an empty queue
+//
+// Inputs       : queue - the queue
+// Outputs      : none
+
+void proxy_queue_init(proxy_queue *queue) {
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->ready, NULL);
+	queue->head = queue->tail = NULL;
+	queue->last = 0;
+	queue->closed = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_queue_push
+// Description  : Add a message to the end of a queue
+//
+// Inputs       : queue - the queue
+//                msg - the message
+// Outputs      : none
+
+void proxy_queue_push(proxy_queue *queue, proxy_msg *msg) {
+	msg->next = NULL;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->tail == NULL) {
+		queue->head = msg;
+	} else {
+		queue->tail->next = msg;
+	}
+	queue->tail = msg;
+	pthread_cond_signal(&queue->ready);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_queue_pop
+// Description  : Wait for the oldest message of a queue and take it once it
+//                is due (messages with no due time are taken at once)
+//
+// Inputs       : queue - the queue
+// Outputs      : the message, NULL once the queue is closed and empty
+
+proxy_msg *proxy_queue_pop(proxy_queue *queue) {
+
+	// Local variables
+	proxy_msg *msg;
+	struct timespec until;
+
+	pthread_mutex_lock(&queue->lock);
+	while ((queue->head == NULL) && !queue->closed) {
+		pthread_cond_wait(&queue->ready, &queue->lock);
+	}
+	if ((msg = queue->head) != NULL) {
+		queue->head = msg->next;
+		if (queue->head == NULL) {
+			queue->tail = NULL;
+		}
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	// Only this thread takes from the queue, so nothing can pass the message
+	if ((msg != NULL) && (msg->due > proxy_now())) {
+		until.tv_sec = msg->due / 1000000000;
+		until.tv_nsec = msg->due % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+	}
+	return(msg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_queue_close
+// Description  : Mark a queue as getting no more messages, waking its reader
+//
+// Inputs       : queue - the queue
+// Outputs      : none
+
+void proxy_queue_close(proxy_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->ready);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_queue_free
+// Description  : Free any messages left on a queue
+//
+// Inputs       : queue - the queue
+// Outputs      : none
+
+void proxy_queue_free(proxy_queue *queue) {
+	proxy_msg *msg;
+	while ((msg = queue->head) != NULL) {
+		queue->head = msg->next;
+		free(msg);
+	}
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->ready);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_now
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in nsec
+
+uint64_t proxy_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec*1000000000 + now.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_recv
+// Description  : Read exactly len bytes from the socket
+//
+// Inputs       : sock - the socket
+//                buf, len - where to put the bytes and how many
+// Outputs      : 0 if successful, -1 if failure
+
+int proxy_recv(int sock, void *buf, size_t len) {
+	ssize_t got;
+	while (len > 0) {
+		if ((got = read(sock, buf, len)) <= 0) {
+			return(-1);
+		}
+		buf = (char *)buf + got;
+		len -= got;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_send
+// Description  : Write exactly len bytes to the socket
+//
+// Inputs       : sock - the socket
+//                buf, len - the bytes to send
+// Outputs      : 0 if successful, -1 if failure
+
+int proxy_send(int sock, void *buf, size_t len) {
+	ssize_t sent;
+	while (len > 0) {
+		if ((sent = write(sock, buf, len)) <= 0) {
+			return(-1);
+		}
+		buf = (char *)buf + sent;
+		len -= sent;
+	}
+	return(0);
+}
@@ -0,0 +1,233 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_shm.c
+//  Description    : This is the shared memory transport between cart_client
+//                   and a CART server on the same host: a POSIX shm segment
+//                   holding a request ring, a response ring and a frame slab.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/19/26
+//
+
+// Include Files
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Project Include Files
+#include <cart_shm.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#if defined(__x86_64__) || defined(__i386__)
+#define CART_SHM_RELAX() __builtin_ia32_pause()
+#else
+#define CART_SHM_RELAX() do { } while (0)
+#endif
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_map
+// Description  : Open and map the segment for the server on port
+//
+// Inputs       : port - the server port (names the segment)
+//                create - non-zero to create the segment if needed
+// Outputs      : the mapped segment, NULL if failure
+
+static CartShmSegment *cart_shm_map(unsigned short port, int create) {
+
+	// Local variables
+	char name[32];
+	CartShmSegment *seg;
+	int fd;
+
+	snprintf(name, sizeof(name), CART_SHM_NAME, port);
+	if ((fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0600)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Shared memory open of [%s] failed [%s]", name, strerror(errno));
+		return(NULL);
+	}
+	if (create && (ftruncate(fd, sizeof(CartShmSegment)) != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Shared memory sizing of [%s] failed [%s]", name, strerror(errno));
+		close(fd);
+		return(NULL);
+	}
+	seg = mmap(NULL, sizeof(CartShmSegment), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "Shared memory map of [%s] failed [%s]", name, strerror(errno));
+		return(NULL);
+	}
+	return(seg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_create
+// Description  : Create the segment for a server on port.  A segment left
+//                by a server that died is unlinked first, so a client still
+//                attached to it keeps the old one and never sees this reset
+//
+// Inputs       : port - the server port
+// Outputs      : the mapped segment, NULL if failure
+
+CartShmSegment *cart_shm_create(unsigned short port) {
+	CartShmSegment *seg;
+	char name[32];
+
+	snprintf(name, sizeof(name), CART_SHM_NAME, port);
+	if (shm_unlink(name) == 0) {
+		logMessage(LOG_WARNING_LEVEL, "Removed stale shared memory segment [%s]", name);
+	}
+	if ((seg = cart_shm_map(port, 1)) == NULL) {
+		return(NULL);
+	}
+	memset(seg, 0x0, sizeof(CartShmSegment));
+	atomic_store(&seg->attached, 0);
+	seg->magic = CART_SHM_MAGIC;
+	return(seg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_attach
+// Description  : Attach a client to the segment of the server on port, only
+//                one client may use a segment at a time
+//
+// Inputs       : port - the server port
+// Outputs      : the mapped segment, NULL if failure
+
+CartShmSegment *cart_shm_attach(unsigned short port) {
+	CartShmSegment *seg;
+	uint32_t free_seg = 0;
+
+	if ((seg = cart_shm_map(port, 0)) == NULL) {
+		return(NULL);
+	}
+	if (seg->magic != CART_SHM_MAGIC) {
+		logMessage(LOG_ERROR_LEVEL, "Shared memory segment has no server");
+		munmap(seg, sizeof(CartShmSegment));
+		return(NULL);
+	}
+	if (!atomic_compare_exchange_strong(&seg->attached, &free_seg, 1)) {
+		logMessage(LOG_ERROR_LEVEL, "Shared memory segment is in use by another client");
+		munmap(seg, sizeof(CartShmSegment));
+		return(NULL);
+	}
+	return(seg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_detach
+// Description  : Release the client's hold on the segment and unmap it
+//
+// Inputs       : seg - the segment
+// Outputs      : none
+
+void cart_shm_detach(CartShmSegment *seg) {
+	atomic_store(&seg->attached, 0);
+	munmap(seg, sizeof(CartShmSegment));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_destroy
+// Description  : Unmap and remove the segment (server)
+//
+// Inputs       : seg - the segment
+//                port - the server port
+// Outputs      : none
+
+void cart_shm_destroy(CartShmSegment *seg, unsigned short port) {
+	char name[32];
+
+	seg->magic = 0;
+	munmap(seg, sizeof(CartShmSegment));
+	snprintf(name, sizeof(name), CART_SHM_NAME, port);
+	shm_unlink(name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_push
+// Description  : Put a register on the ring, waking the consumer if it is
+//                asleep.  There is only ever one request in flight, so the
+//                ring never fills; the producer yields if it somehow does
+//
+// Inputs       : ring - the ring (the caller is its only producer)
+//                reg - the register
+// Outputs      : none
+
+void cart_shm_push(CartShmRing *ring, CartXferRegister reg) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= CART_SHM_RING_SIZE) {
+		sched_yield();
+	}
+	ring->slots[head & (CART_SHM_RING_SIZE-1)] = reg;
+	atomic_store_explicit(&ring->head, head+1, memory_order_seq_cst);
+	if (atomic_load_explicit(&ring->sleeping, memory_order_seq_cst)) {
+		syscall(SYS_futex, &ring->head, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_pop
+// Description  : Take a register off the ring.  Polls for CART_SHM_SPIN
+//                rounds (none on a single CPU), then sleeps on the head in
+//                CART_SHM_WAIT_MS steps
+//
+// Inputs       : ring - the ring (the caller is its only consumer)
+//                reg - where to put the register
+//                waits - sleeps to allow before giving up, -1 for no limit
+// Outputs      : 0 if successful, -1 if nothing arrived
+
+int cart_shm_pop(CartShmRing *ring, CartXferRegister *reg, int waits) {
+
+	// Local variables
+	struct timespec wait = { 0, CART_SHM_WAIT_MS * 1000000L };
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	static int spin = -1;
+	int spins = 0;
+
+	// Polling only helps if the producer can run at the same time
+	if (spin == -1) {
+		spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? CART_SHM_SPIN : 0;
+	}
+
+	while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+		if (spins++ < spin) {
+			CART_SHM_RELAX();
+			continue;
+		}
+		if (waits == 0) {
+			return(-1);
+		}
+
+		// Say we are going to sleep, then look once more so a push between
+		// the two can't be missed
+		atomic_store_explicit(&ring->sleeping, 1, memory_order_seq_cst);
+		if (atomic_load_explicit(&ring->head, memory_order_seq_cst) == tail) {
+			syscall(SYS_futex, &ring->head, FUTEX_WAIT, tail, &wait, NULL, 0);
+			if (waits > 0) {
+				waits--;
+			}
+		}
+		atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+	}
+
+	*reg = ring->slots[tail & (CART_SHM_RING_SIZE-1)];
+	atomic_store_explicit(&ring->tail, tail+1, memory_order_release);
+	return(0);
+}
@@ -0,0 +1,86 @@
+#ifndef CART_SHM_INCLUDED
+#define CART_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_shm.h
+//  Description    : This is the header file for the shared memory transport
+//                   between cart_client and a CART server on the same host.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Project Includes
+#include <cart_controller.h>
+
+// Defines
+#define CART_SHM_MAGIC 0x4d485343         // "CSHM" as little-endian bytes
+#define CART_SHM_NAME "/cart_shm.%hu"     // POSIX shm name, by server port
+#define CART_SHM_RING_SIZE 16             // Must be a power of 2
+#define CART_SHM_SPIN 4096                // Polls before sleeping on the futex
+#define CART_SHM_WAIT_MS 100              // Futex sleep, then look for shutdown
+#define CART_SHM_CLIENT_WAITS 50          // Sleeps a client waits for a response
+#define CART_SHM_SLAB_SIZE (CART_MAX_XFER_FRAMES*CART_FRAME_SIZE)
+#define CART_SHM_CACHELINE 64
+
+/*
+
+ Segment layout
+
+   request ring    - registers from the client, the client is the only producer
+   response ring   - registers from the server, the server is the only producer
+   slab            - the frames (or WRPART payload) of the request in flight
+
+ A ring's head is only written by its producer and its tail only by its
+ consumer, so neither needs a lock.  The client has one request in flight at
+ a time, so one slab is enough: it fills the slab, pushes the register and
+ reads any returned frames from the slab once the response arrives.  A
+ consumer polls for a while before sleeping on a futex on the head, and sets
+ sleeping first so the producer knows to wake it.
+
+*/
+
+// A single-producer/single-consumer ring of registers
+typedef struct {
+	_Atomic uint32_t head __attribute__((aligned(CART_SHM_CACHELINE)));
+	_Atomic uint32_t sleeping;
+	_Atomic uint32_t tail __attribute__((aligned(CART_SHM_CACHELINE)));
+	CartXferRegister slots[CART_SHM_RING_SIZE] __attribute__((aligned(CART_SHM_CACHELINE)));
+} CartShmRing;
+
+// The shared segment
+typedef struct {
+	uint32_t magic;
+	_Atomic uint32_t attached;            // A client is using the segment
+	CartShmRing request;
+	CartShmRing response;
+	char slab[CART_SHM_SLAB_SIZE] __attribute__((aligned(CART_SHM_CACHELINE)));
+} CartShmSegment;
+
+//
+// Functional Prototypes
+
+CartShmSegment *cart_shm_create(unsigned short port);
+	// Create (or reset) the segment for a server on port
+
+CartShmSegment *cart_shm_attach(unsigned short port);
+	// Attach a client to the segment of the server on port
+
+void cart_shm_detach(CartShmSegment *seg);
+	// Release the client's hold on the segment and unmap it
+
+void cart_shm_destroy(CartShmSegment *seg, unsigned short port);
+	// Unmap and remove the segment (server)
+
+void cart_shm_push(CartShmRing *ring, CartXferRegister reg);
+	// Put a register on the ring, waking the consumer if it is asleep
+
+int cart_shm_pop(CartShmRing *ring, CartXferRegister *reg, int waits);
+	// Take a register off the ring, sleeping up to waits times before failing
+
+#endif
@@ -10,6 +10,7 @@
 
 // Include Files
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
@@ -17,31 +18,61 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 // Project Includes
 #include <cart_driver.h>
 #include <cart_cache.h>
 #include <cart_network.h>
+#include <cart_trace.h>
+#include <cart_timeline.h>
+#include <cart_mmap.h>
 #include <cmpsc311_log.h>
+#include <cart_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
-#define CART_WORKLOAD_DIR "workload"
-#define CART_SIM_MAX_OPEN_FILES 128
-#define CART_ARGUMENTS "huvl:c:i:p:"
+#define CART_SIM_VALIDATE_CHUNK (64*1024)  // Bytes compared per validation step
+#define CART_SIM_VALIDATE_THREADS 4        // Default validation threads
+#define CART_SIM_MAX_VALIDATE_THREADS 64
+#define CART_SIM_HASH_SIZE (CART_SIM_MAX_OPEN_FILES*2) // Must be a power of 2
+#define CART_ARGUMENTS "huvbkdmeal:c:z:V:i:p:S:C:t:R:H:x:j:T:L:s:A:"
 #define USAGE \
-	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: cart_sim [-h] [-v] [-b] [-k] [-d] [-a] [-m] [-e] [-l <logfile>] [-c <sz>] [-z <bytes>] [-V <frames>] [-S <n>] [-C <n>] [-t <frames>] [-R <n>] [-H <usec>] [-j <n>] [-T <timeline>] [-L <carts>] [-s <op>:<switch>:<byte>] [-A <advice>] [-x <trace>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -c - set the cart block cache to size <sz> (disabled for assign #2)\n" \
+	"    -z - keep frames evicted from the cache compressed in <bytes> of memory\n" \
+	"    -V - spill frames evicted from memory to a local file of <frames> frames\n" \
 	"    -i - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -S - stripe files over <n> servers, listening on consecutive ports\n" \
+	"    -C - open <n> connections to each server, each with a share of the cartridges\n" \
+	"    -t - place <frames> frames of a file on a server before the next\n" \
+	"    -R - keep <n> copies of every frame, on groups of <n> servers\n" \
+	"    -H - send a read to another copy if none answers in <usec> (default adapts)\n" \
+	"    -m - talk to a server on this host over shared memory instead of TCP\n" \
+	"    -e - run the controller in-process, with no server at all\n" \
+	"    -s - simulate the bus in virtual time, costing each request <op>, each cartridge change <switch>\n" \
+	"         and each byte <byte> nsec, and report the modeled time\n" \
+	"    -b - the workload file is a binary trace, replay it\n" \
+	"    -x - convert the workload to the binary trace <trace> and exit\n" \
+	"    -k - keep a .cmm dump of any file that fails validation\n" \
+	"    -d - deduplicate frames with identical contents\n" \
+	"    -a - gather appends into whole frames before writing them\n" \
+	"    -L - write frames at the head of a log of <carts> cartridges per connection\n" \
+	"    -A - give every file <advice> (normal, sequential, random, willneed, dontneed, noreuse)\n" \
+	"         when it is opened and again before it is validated\n" \
+	"    -j - validate files with <n> threads (default 4), the driver reads one at a time,\n" \
+	"         reading the source files and comparing overlap with them\n" \
+	"    -T - record driver, cache and bus spans, written to <timeline> as Chrome trace JSON\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -52,15 +83,36 @@ typedef struct {
 	int16_t   fhandle;   // This is a file handle for the opened file
 } CartSimulationTable;
 
+// This is the shared state of the validation threads
+typedef struct {
+	CartSimulationTable *ftable;  // The simulation file table
+	int                  nfiles;  // The number of files in the table
+	int                  next;    // The next file to validate
+	int                  failed;  // Lowest failed table index, -1 if none
+	pthread_mutex_t      lock;    // Protects next and failed
+} CartValidationPool;
+
 //
 // Global Data
 int verbose;
+int cart_sim_dump_mismatch = 0;    // Write .cmm backups of files that fail validation
+int cart_sim_validate_threads = CART_SIM_VALIDATE_THREADS; // Validation threads (host I/O overlaps)
+int cart_sim_advice = -1;          // cart_advise advice for every file, -1 for none
+static const char *cart_sim_advice_names[] = { "normal", "sequential", "random", "willneed",
+	"dontneed", "noreuse" };       // Indexed by CART_ADVICE_*
+pthread_mutex_t cart_sim_driver_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes driver calls
 
 //
 // Functional Prototypes
 
 int simulate_CART( char *wload );             // control loop of the CART simulation
+int replay_CART( char *trace );               // replay loop for binary traces
+int finish_simulation(CartSimulationTable *ftable, int nfiles); // validate and shutdown
 int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+void * validate_worker(void *arg);            // Validation thread body
+int dump_cart_file(char *fname, int16_t mfh, int32_t size, char *buf); // Write a .cmm backup
+int lookup_sim_file(CartSimulationTable *ftable, int16_t *fhash, const char *fname); // Find a file
+void insert_sim_file(CartSimulationTable *ftable, int16_t *fhash, int idx); // Index a file
 
 //
 // Functions
@@ -77,8 +129,9 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
-	uint32_t cache_size = 0;
+	int ch, verbose = 0, log_initialized = 0, unit_tests = 0, binary = 0;
+	char *convert = NULL;
+	uint32_t cache_size = 0, ctier_size = 0, dtier_size = 0, hedge_delay, sim_op, sim_switch, sim_byte;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CART_ARGUMENTS)) != -1) {
@@ -96,6 +149,62 @@ int main( int argc, char *argv[] ) {
 			unit_tests = 1;
 			break;
 
+		case 'b': // Binary trace flag
+			binary = 1;
+			break;
+
+		case 'x': // Convert the workload to a binary trace
+			convert = optarg;
+			break;
+
+		case 'k': // Keep dumps of files failing validation
+			cart_sim_dump_mismatch = 1;
+			break;
+
+		case 'm': // Use the shared memory transport
+			cart_network_shm = 1;
+			break;
+
+		case 'e': // Use the in-process controller
+			cart_set_direct_bus(1);
+			break;
+
+		case 'A': // Advice for every file
+			for (cart_sim_advice = CART_ADVICE_NOREUSE; cart_sim_advice >= 0; cart_sim_advice--) {
+				if (strcmp(optarg, cart_sim_advice_names[cart_sim_advice]) == 0) {
+					break;
+				}
+			}
+			if (cart_sim_advice == -1) {
+				logMessage( LOG_ERROR_LEVEL, "Bad advice [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 's': // Simulate the bus in virtual time
+			if ( sscanf(optarg, "%u:%u:%u", &sim_op, &sim_switch, &sim_byte) != 3 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad bus costs [%s], need <op>:<switch>:<byte>", optarg );
+				return( -1 );
+			}
+			cart_set_sim_bus(sim_op, sim_switch, sim_byte);
+			break;
+
+		case 'd': // Deduplicate frame contents
+			cart_set_dedup(1);
+			break;
+
+		case 'a': // Coalesce appends
+			cart_set_coalesce(1);
+			break;
+
+		case 'j': // Set the validation threads
+			if ( (sscanf(optarg, "%d", &cart_sim_validate_threads) != 1) ||
+				 (cart_sim_validate_threads < 1) || (cart_sim_validate_threads > CART_SIM_MAX_VALIDATE_THREADS) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad validation thread count [%s]", optarg );
+				return(-1);
+			}
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
@@ -107,6 +216,20 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
+		case 'z': // Set the compressed cache tier budget
+			if ( sscanf( optarg, "%u", &ctier_size ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad compressed cache size [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'V': // Set the victim file size
+			if ( sscanf( optarg, "%u", &dtier_size ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad victim cache size [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
         case 'i': // Get the IP address
             if (inet_addr(optarg) == INADDR_NONE) {
 			    logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
@@ -122,6 +245,57 @@ int main( int argc, char *argv[] ) {
 			}
             break;			
 
+		case 'S': // Stripe over several servers
+			if ( (sscanf(optarg, "%d", &cart_network_servers) != 1) ||
+				 (cart_network_servers < 1) || (cart_network_servers > CART_MAX_SERVERS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad server count [%s], 1 to %d", optarg, CART_MAX_SERVERS );
+                return(-1);
+			}
+			break;
+
+		case 'C': // Connections to each server
+			if ( (sscanf(optarg, "%d", &cart_network_connections) != 1) ||
+				 (cart_network_connections < 1) || (cart_network_connections > CART_MAX_CONNECTIONS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad connection count [%s], 1 to %d", optarg, CART_MAX_CONNECTIONS );
+                return(-1);
+			}
+			break;
+
+		case 't': // Set the stripe unit
+			if ( cart_set_stripe_unit(atoi(optarg)) != 0 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad stripe unit [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'R': // Set the replica count
+			if ( cart_set_replicas(atoi(optarg)) != 0 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad replica count [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'H': // Set the hedge delay
+			if ( sscanf( optarg, "%u", &hedge_delay ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad hedge delay [%s]", optarg );
+                return(-1);
+			}
+			cart_set_hedge_delay(hedge_delay);
+			break;
+
+		case 'T': // Record a timeline
+			if ( cart_timeline_open(optarg) != 0 ) {
+                return(-1);
+			}
+			break;
+
+		case 'L': // Log-structured writes
+			if ( cart_set_log_structured(atoi(optarg)) != 0 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad log size [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -136,10 +310,15 @@ int main( int argc, char *argv[] ) {
 		enableLogLevels(LOG_INFO_LEVEL);
 	}
 
+	// Format and write log messages on a thread of their own
+	cart_log_start();
+
 	// Setup the cache size as needed
 	if (cache_size != 0) {
 		set_cart_cache_size(cache_size);
 	}
+	set_cart_cache_ctier(ctier_size);
+	set_cart_cache_disk(dtier_size);
 
 	// If exgtracting file from data
 	if (unit_tests) {
@@ -147,7 +326,7 @@ int main( int argc, char *argv[] ) {
 		// Run the unit tests
 		enableLogLevels( LOG_INFO_LEVEL );
 		logMessage(LOG_INFO_LEVEL, "Running unit tests ....\n\n");
-		if ( (cartCacheUnitTest() == 0) && (cartCacheUnitTest() == 0) ) {
+		if ( (cartCacheUnitTest() == 0) && (cartCacheUnitTest() == 0) && (cartMmapUnitTest() == 0) ) {
 			logMessage(LOG_INFO_LEVEL, "Unit tests completed successfully.\n\n");
 		} else {
 			logMessage(LOG_ERROR_LEVEL, "Unit tests failed, aborting.\n\n");
@@ -164,8 +343,13 @@ int main( int argc, char *argv[] ) {
 
 		}
 
+		// Convert the workload if requested
+		if ( convert != NULL ) {
+			return( cart_trace_convert(argv[optind], convert) );
+		}
+
 		// Run the simulation
-		if ( simulate_CART(argv[optind]) == 0 ) {
+		if ( (binary ? replay_CART(argv[optind]) : simulate_CART(argv[optind])) == 0 ) {
 			logMessage( LOG_INFO_LEVEL, "CART simulation completed successfully.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CART simulation failed.\n\n" );
@@ -188,212 +372,472 @@ int main( int argc, char *argv[] ) {
 int simulate_CART( char *wload ) {
 
 	// Local variables
-	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
+	char text[1025], *rbuf = NULL, *grown;
+	const char *wdata = NULL, *line, *eol, *wend;
+	struct stat stats;
+	CartWorkloadLine wl;
+	int32_t err=0, linecount, llen;
 	CartSimulationTable ftable[CART_SIM_MAX_OPEN_FILES];
-	int idx, i;
+	int16_t fhash[CART_SIM_HASH_SIZE];
+	int wfd, idx, nfiles = 0, rbufsz = 0;
 
-	// Setup the file table
+	// Setup the file table and the filename hash index
 	memset(ftable, 0x0, sizeof(CartSimulationTable)*CART_SIM_MAX_OPEN_FILES);
+	memset(fhash, 0x0, sizeof(fhash));
 
-	// Open the workload file
+	// Open the workload file and map it into memory
 	linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
+	if ( ((wfd=open(wload, O_RDONLY)) == -1) || (fstat(wfd, &stats) == -1) ) {
 		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
 			wload, strerror(errno) );
+		if (wfd != -1) close( wfd );
 		return( -1 );
 	}
+	if ( stats.st_size > 0 ) {
+		if ( (wdata=mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, wfd, 0)) == MAP_FAILED ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.\n",
+				wload, strerror(errno) );
+			close( wfd );
+			return( -1 );
+		}
+		madvise( (void *)wdata, stats.st_size, MADV_SEQUENTIAL );
+	}
+	close( wfd );
+	wend = wdata + stats.st_size;
 
 	// Startup the interface
 	if (cart_poweron() == -1) {
 		logMessage( LOG_ERROR_LEVEL, "CART simulator failed initialization.");
-		fclose( fhandle );
+		if (wdata != NULL) munmap( (void *)wdata, stats.st_size );
 		return( -1 );
 	}
 	logMessage(CartSimulatorLLevel, "CART simulator initialization complete.");
 
-	// While file not done
-	while (!feof(fhandle)) {
+	// While file not done, walk the mapped workload one line at a time
+	line = wdata;
+	while ( (err == 0) && (line != NULL) && (line < wend) ) {
 
-		// Get the line and bail out on fail
-		if (fgets(line, 1024, fhandle) != NULL) {
-
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "CART un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
-				return( -1 );
+		// Find the end of the line (memchr is vectorized in the C library)
+		eol = memchr(line, '\n', wend-line);
+		if (eol == NULL) {
+			eol = wend;
+		}
+		llen = eol - line;
+
+		// Parse out the string
+		linecount ++;
+		if ( parse_workload_line(line, llen, &wl) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "CART un-parsable workload string, aborting [%.*s], line %d",
+					llen, line, linecount );
+			err = -1;
+			break;
+		}
+		line = eol + 1;
+
+		// Just log the contents
+		logMessage(CartSimulatorLLevel, "File [%s], command [%s], len=%d, offset=%d",
+				wl.fname, wl.command, wl.len, wl.off);
+
+		// Now look the file up in the hashed file table
+		idx = lookup_sim_file(ftable, fhash, wl.fname);
+
+		// File is not found, open the file
+		if (idx == -1) {
+
+			// Log message, take the next unused index and save filename for later use
+			logMessage(CartSimulatorLLevel, "CART_SIM : Opening file [%s]", wl.fname);
+			idx = nfiles++;
+			CMPSC_ASSERT1(idx<CART_SIM_MAX_OPEN_FILES, "Too many open files on CART sim [%d]", idx);
+			ftable[idx].filename = strdup(wl.fname);
+			insert_sim_file(ftable, fhash, idx);
+
+			// Now perform the open
+			ftable[idx].fhandle = cart_open(ftable[idx].filename);
+			if (ftable[idx].fhandle == -1) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", wl.fname);
+				err = -1;
+				break;
+			}
+			if (cart_sim_advice != -1) {
+				cart_advise(ftable[idx].fhandle, 0, 0, cart_sim_advice);
 			}
 
-			// Just log the contents
-			logMessage(CartSimulatorLLevel, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
+		}
 
-			// Now walk the the table looking for the file
-			idx = -1;
-			i = 0;
-			while ( (i < CART_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-				if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-					idx = i;
-				}
-				i++;
-			}
+		// Now execute the specific command
+		if (wl.cmd == CART_SIM_WRITEAT) {
 
-			// File is not found, open the file
-			if (idx == -1) {
+			// Log the command executed
+			logMessage(CartSimulatorLLevel, "CART_SIM : Writing %d bytes at position %d from file [%s]", wl.len, wl.off, wl.fname);
 
-				// Log message, find unused index and save filename for later use
-				logMessage(CartSimulatorLLevel, "CART_SIM : Opening file [%s]", fname);
-				idx = 0;
-				while ((ftable[idx].filename != NULL) && (idx < CART_SIM_MAX_OPEN_FILES)) {
-					idx++;
-				}
-				CMPSC_ASSERT1(idx<CART_SIM_MAX_OPEN_FILES, "Too many open files on CART sim [%d]", idx);
-				ftable[idx].filename = strdup(fname);
-
-				// Now perform the open
-				ftable[idx].fhandle = cart_open(ftable[idx].filename);
-				if (ftable[idx].fhandle == -1) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-					return(-1);
-				}
+			// First perform the seek
+			if (cart_seek(ftable[idx].fhandle, wl.off)) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", wl.fname, wl.off);
+				err = -1;
+				break;
+			}
 
+			// Now see if we need more data to fill, terminate the lines
+			CMPSC_ASSERT1(wl.len<1024, "Simulated workload command text too large [%d]", wl.len);
+			CMPSC_ASSERT2((wl.plen>=wl.len), "Workload str [%d<%d]", wl.plen, wl.len);
+			translate_payload(text, wl.payload, wl.len);
+
+			// Now perform the write
+			if (cart_write(ftable[idx].fhandle, text, wl.len) != wl.len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", wl.fname, wl.len);
+				err = -1;
+				break;
 			}
 
-			// Now execute the specific command
-			if (strncmp(command, "WRITEAT", 7) == 0) {
 
-				// Log the command executed
-				logMessage(CartSimulatorLLevel, "CART_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
+		} else if (wl.cmd == CART_SIM_WRITE) {
 
-				// First perform the seek
-				if (cart_seek(ftable[idx].fhandle, off)) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
+			// Now see if we need more data to fill, terminate the lines
+			CMPSC_ASSERT1(wl.len<1024, "Simulated workload command text too large [%d]", wl.len);
+			CMPSC_ASSERT2((wl.plen>=wl.len), "Workload str [%d<%d]", wl.plen, wl.len);
+			translate_payload(text, wl.payload, wl.len);
 
-				// Now see if we need more data to fill, terminate the lines
-				CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-				CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-				strncpy(text, sep+1, len);
-				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
-					if (text[i] == '^') {
-						text[i] = '\n';
-					}
-				}
+			// Log the command executed
+			logMessage(CartSimulatorLLevel, "CART_SIM : Writing %d bytes to file [%s]", wl.len, wl.fname);
 
-				// Now perform the write
-				if (cart_write(ftable[idx].fhandle, text, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-					return(-1);
-				}
+			// Now perform the write
+			if (cart_write(ftable[idx].fhandle, text, wl.len) != wl.len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", wl.fname, wl.len);
+				err = -1;
+				break;
+			}
 
 
-			} else if (strncmp(command, "WRITE", 5) == 0) {
+		} else if (wl.cmd == CART_SIM_SEEK) {
 
-				// Now see if we need more data to fill, terminate the lines
-				CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-				CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-				strncpy(text, sep+1, len);
-				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
-					if (text[i] == '^') {
-						text[i] = '\n';
-					}
-				}
+			// Log the command executed
+			logMessage(CartSimulatorLLevel, "CART_SIM : Seeking to position %d in file [%s]", wl.off, wl.fname);
 
-				// Log the command executed
-				logMessage(CartSimulatorLLevel, "CART_SIM : Writing %d bytes to file [%s]", len, fname);
+			// Now perform the seek
+			if (cart_seek(ftable[idx].fhandle, wl.off) != wl.len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", wl.fname, wl.off);
+				err = -1;
+				break;
+			}
+
+		} else if (wl.cmd == CART_SIM_READ) {
 
-				// Now perform the write
-				if (cart_write(ftable[idx].fhandle, text, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-					return(-1);
+			// Log the command executed
+			logMessage(CartSimulatorLLevel, "CART_SIM : Reading %d bytes from file [%s]", wl.len, wl.fname);
+
+			// Now perform the read, growing the (reused) read buffer as needed
+			if (wl.len > rbufsz) {
+				if ((grown = realloc(rbuf, wl.len)) == NULL) {
+					logMessage(LOG_ERROR_LEVEL, "Unable to grow the read buffer to %d bytes, aborting simulation.", wl.len);
+					err = -1;
+					break;
 				}
+				rbuf = grown;
+				rbufsz = wl.len;
+			}
+			if (cart_read(ftable[idx].fhandle, rbuf, wl.len) != wl.len) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", wl.fname, wl.len);
+				err = -1;
+				break;
+			}
 
+		} else {
 
-			} else if (strncmp(command, "SEEK", 4) == 0) {
+			// Bomb out, don't understand the command
+			CMPSC_ASSERT1(0, "CART_SIM : Failed, unknown command [%s]", wl.command);
 
-				// Log the command executed
-				logMessage(CartSimulatorLLevel, "CART_SIM : Seeking to position %d in file [%s]", off, fname);
+		}
+	}
 
-				// Now perform the seek
-				if (cart_seek(ftable[idx].fhandle, off) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
+	// Done with the workload contents
+	if (wdata != NULL) {
+		munmap( (void *)wdata, stats.st_size );
+	}
+	free(rbuf);
 
-			} else if (strncmp(command, "READ", 4) == 0) {
+	// Check for the virtual level failing
+	if ( err ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
+		return( -1 );
+	}
 
-				// Log the command executed
-				logMessage(CartSimulatorLLevel, "CART_SIM : Reading %d bytes from file [%s]", len, fname);
+	// Validate the files and shut down
+	return( finish_simulation(ftable, nfiles) );
+}
 
-				// Now perform the read
-				rbuf = malloc(len);
-				if (cart_read(ftable[idx].fhandle, rbuf, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-				free(rbuf);
-				rbuf = NULL;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_CART
+// Description  : Replay a memory-mapped binary trace against the driver; the
+//                records are pre-parsed, so no per-command parsing is done.
+//
+// Inputs       : trace - the name of the binary trace file
+// Outputs      : 0 if successful test, -1 if failure
 
-			} else {
+int replay_CART( char *trace ) {
+
+	// Local variables
+	CartTrace tr;
+	const CartTraceRecord *rec;
+	const char *payload, *pend;
+	char *rbuf = NULL, *grown;
+	CartSimulationTable ftable[CART_SIM_MAX_OPEN_FILES];
+	int16_t *fmap;
+	int32_t err = 0, rbufsz = 0;
+	uint64_t r;
+	int idx, nfiles = 0;
 
-				// Bomb out, don't understand the command
-				CMPSC_ASSERT1(0, "CART_SIM : Failed, unknown command [%s]", command);
+	// Map the trace, setup the file table and the id to table mapping
+	if (cart_trace_map(trace, &tr) != 0) {
+		return( -1 );
+	}
+	memset(ftable, 0x0, sizeof(CartSimulationTable)*CART_SIM_MAX_OPEN_FILES);
+	fmap = calloc(tr.header->nfiles+1, sizeof(int16_t));
+	payload = tr.payload;
+	pend = tr.payload + tr.header->payload_len;
 
+	// Startup the interface
+	if (cart_poweron() == -1) {
+		logMessage( LOG_ERROR_LEVEL, "CART simulator failed initialization.");
+		cart_trace_unmap(&tr);
+		free(fmap);
+		return( -1 );
+	}
+	logMessage(CartSimulatorLLevel, "CART simulator initialization complete (binary replay).");
+
+	// Issue the records back to back
+	for (r=0; (err==0) && (r<tr.header->nrecords); r++) {
+		rec = &tr.records[r];
+		if (rec->fileid >= tr.header->nfiles) {
+			logMessage(LOG_ERROR_LEVEL, "Bad file id %d in trace record %lu.", rec->fileid, r);
+			err = -1;
+			break;
+		}
+
+		// Open the file on first use (fmap holds table index+1)
+		if ((idx = fmap[rec->fileid]-1) == -1) {
+			idx = nfiles++;
+			CMPSC_ASSERT1(idx<CART_SIM_MAX_OPEN_FILES, "Too many open files on CART sim [%d]", idx);
+			ftable[idx].filename = strdup(tr.names[rec->fileid]);
+			if ((ftable[idx].fhandle = cart_open(ftable[idx].filename)) == -1) {
+				logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.",
+					ftable[idx].filename);
+				err = -1;
+				break;
 			}
+			if (cart_sim_advice != -1) {
+				cart_advise(ftable[idx].fhandle, 0, 0, cart_sim_advice);
+			}
+			fmap[rec->fileid] = idx+1;
 		}
 
-		// Check for the virtual level failing
-		if ( err ) {
-			logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
-			fclose( fhandle );
-			return( -1 );
+		// Now execute the specific command
+		switch (rec->cmd) {
+		case CART_SIM_WRITEAT:
+			if (cart_seek(ftable[idx].fhandle, rec->off)) {
+				err = -1;
+				break;
+			}
+			/* fallthrough */
+
+		case CART_SIM_WRITE:
+			if ((rec->len < 0) || (rec->len > pend - payload) ||
+				(cart_write(ftable[idx].fhandle, (void *)payload, rec->len) != rec->len)) {
+				err = -1;
+			}
+			payload += rec->len;
+			break;
+
+		case CART_SIM_SEEK:
+			if (cart_seek(ftable[idx].fhandle, rec->off) != rec->len) {
+				err = -1;
+			}
+			break;
+
+		case CART_SIM_READ:
+			if (rec->len < 0) {
+				err = -1;
+				break;
+			}
+			if (rec->len > rbufsz) {
+				if ((grown = realloc(rbuf, rec->len)) == NULL) {
+					err = -1;
+					break;
+				}
+				rbuf = grown;
+				rbufsz = rec->len;
+			}
+			if (cart_read(ftable[idx].fhandle, rbuf, rec->len) != rec->len) {
+				err = -1;
+			}
+			break;
+
+		default:
+			CMPSC_ASSERT1(0, "CART_SIM : Failed, unknown trace command [%d]", rec->cmd);
+		}
+		if (err) {
+			logMessage(LOG_ERROR_LEVEL, "Trace record %lu (command %d, file [%s], len=%d, "
+				"offset=%d) failed, aborting simulation.", r, rec->cmd, ftable[idx].filename,
+				rec->len, rec->off);
 		}
 	}
 
-	// Now walk the the table of files to validate
-	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
-		if (ftable[i].filename != NULL) {
-			if (validate_file(ftable[i].filename, ftable[i].fhandle) != 0) {
-				logMessage(LOG_ERROR_LEVEL, "CART Validation failed on file [%s].", ftable[i].filename,fname);
-				fclose( fhandle );
-				return(-1);
-			}
-		}		
+	// Done with the trace contents
+	cart_trace_unmap(&tr);
+	free(fmap);
+	free(rbuf);
+	if ( err ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
+		return( -1 );
+	}
+
+	// Validate the files and shut down
+	return( finish_simulation(ftable, nfiles) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finish_simulation
+// Description  : Validate all of the files used by the simulation, then
+//                shut down the interface
+//
+// Inputs       : ftable - the simulation file table
+//                nfiles - the number of files in the table
+// Outputs      : 0 if successful test, -1 if failure
+
+int finish_simulation(CartSimulationTable *ftable, int nfiles) {
+
+	// Local variables
+	CartValidationPool pool;
+	pthread_t threads[CART_SIM_MAX_VALIDATE_THREADS];
+	int nthreads, i;
+
+	// Validate the files on a few threads, workers pull the next file off the
+	// pool.  The driver isn't reentrant, so its reads are taken in turn and
+	// only the source file reads and compares overlap them
+	memset(&pool, 0x0, sizeof(pool));
+	pool.ftable = ftable;
+	pool.nfiles = nfiles;
+	pool.failed = -1;
+	pthread_mutex_init(&pool.lock, NULL);
+	nthreads = (cart_sim_validate_threads < nfiles) ? cart_sim_validate_threads : nfiles;
+	for (i=0; i<nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, validate_worker, &pool) != 0) {
+			break;
+		}
+	}
+	if (i == 0) {
+		// Could not start any workers, validate on this thread
+		validate_worker(&pool);
+	}
+	nthreads = i;
+	for (i=0; i<nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool.lock);
+	if (pool.failed != -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART Validation failed on file [%s].", ftable[pool.failed].filename);
+		return(-1);
 	}
 
 	// Shut down the interface
 	if (cart_poweroff() == -1) {
 		logMessage( LOG_ERROR_LEVEL, "CART simulator failed shutdown.");
-		fclose( fhandle );
 		return( -1 );
 	}
 	logMessage(CartSimulatorLLevel, "CART simulator shutdown complete.");
 	logMessage(LOG_OUTPUT_LEVEL, "CART simulation: all tests successful!!!.");
 
-	// Close the workload file, successfully
-	fclose( fhandle );
+	// Return successfully
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : validate_worker
+// Description  : Validation thread, validates files from the pool until done
+//
+// Inputs       : arg - the validation pool
+// Outputs      : NULL
+
+void * validate_worker(void *arg) {
+
+	// Local variables
+	CartValidationPool *pool = arg;
+	int idx;
+
+	while (1) {
+
+		// Grab the next file, stopping early if a file has already failed
+		pthread_mutex_lock(&pool->lock);
+		idx = (pool->failed == -1) ? pool->next++ : pool->nfiles;
+		pthread_mutex_unlock(&pool->lock);
+		if (idx >= pool->nfiles) {
+			break;
+		}
+
+		// Validate it, remembering the first failure in table order
+		if (validate_file(pool->ftable[idx].filename, pool->ftable[idx].fhandle) != 0) {
+			pthread_mutex_lock(&pool->lock);
+			if ((pool->failed == -1) || (idx < pool->failed)) {
+				pool->failed = idx;
+			}
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookup_sim_file
+// Description  : Find a file in the simulation table using the hash index
+//
+// Inputs       : ftable - the simulation file table
+//                fhash - the open-addressed index (entries are idx+1, 0 empty)
+//                fname - the filename to find
+// Outputs      : index of the file in ftable, -1 if not found
+
+int lookup_sim_file(CartSimulationTable *ftable, int16_t *fhash, const char *fname) {
+	uint32_t slot = hash_workload_name(fname) & (CART_SIM_HASH_SIZE-1);
+	while (fhash[slot] != 0) {
+		if (strcmp(ftable[fhash[slot]-1].filename, fname) == 0) {
+			return(fhash[slot]-1);
+		}
+		slot = (slot+1) & (CART_SIM_HASH_SIZE-1);
+	}
+	return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insert_sim_file
+// Description  : Add a file table entry to the hash index
+//
+// Inputs       : ftable - the simulation file table
+//                fhash - the open-addressed index
+//                idx - the file table index to insert
+// Outputs      : none
+
+void insert_sim_file(CartSimulationTable *ftable, int16_t *fhash, int idx) {
+	uint32_t slot = hash_workload_name(ftable[idx].filename) & (CART_SIM_HASH_SIZE-1);
+	while (fhash[slot] != 0) {
+		slot = (slot+1) & (CART_SIM_HASH_SIZE-1);
+	}
+	fhash[slot] = idx+1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : validate_file
-// Description  : Vadliate a file in the filesystem
+// Description  : Vadliate a file in the filesystem, streaming both copies
+//                through fixed-size chunk buffers
 //
 // Inputs       : fname - the name of the file to validate
 //                mfh - the memory file handle
@@ -402,11 +846,12 @@ int simulate_CART( char *wload ) {
 int validate_file(char *fname, int16_t mfh) {
 
 	// Local variables
-	char filename[256], bkfile[256], *filbuf, *membuf;
+	char filename[256], *filbuf, *membuf;
 	struct stat stats;
-	int idx, fh;
+	int32_t chunk, done, idx, err = 0;
+	int fh;
 
-	// First figure out how big the file is, setup buffer
+	// First figure out how big the file is, setup buffers
 	snprintf(filename, 256, "%s/%s", CART_WORKLOAD_DIR, fname);
 	logMessage(LOG_OUTPUT_LEVEL, "Validating [%s] file ....", fname);
 	if ((stat(filename, &stats) != 0) || (stats.st_size == 0)) {
@@ -414,61 +859,117 @@ int validate_file(char *fname, int16_t mfh) {
 			"unknown source.", filename);
 		return(-1);		
 	}
-	if ( ((filbuf = malloc(stats.st_size)) == NULL) || ((membuf = malloc(stats.st_size)) == NULL) ) {
+	if ( ((filbuf = malloc(CART_SIM_VALIDATE_CHUNK)) == NULL) ||
+		 ((membuf = malloc(CART_SIM_VALIDATE_CHUNK)) == NULL) ) {
 		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], failed "
 			"buffer allocation.", filename);
+		free(filbuf);
 		return(-1);		
 	}
 
-	// Now open the file and read the contents
+	// Now open the file, seek to the beginning of the memory file
 	if ((fh=open(filename, O_RDONLY)) == -1) {
 		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], open failed ", filename);
+		free(filbuf);
+		free(membuf);
 		return(-1);		
 	}
-	if ((read(fh, filbuf, stats.st_size)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], read failed ", filename);
-		return(-1);
+	pthread_mutex_lock(&cart_sim_driver_lock);
+	err = cart_seek(mfh, 0);
+	if ((err == 0) && (cart_sim_advice != -1)) {
+		err = cart_advise(mfh, 0, 0, cart_sim_advice);
 	}
-	close(fh);
-
-	// Seek to the beginning of the memory file, read the contents
-	if (cart_seek(mfh, 0) == -1) {
+	pthread_mutex_unlock(&cart_sim_driver_lock);
+	if (err == -1) {
 		// Failed, error out
 		logMessage(LOG_ERROR_LEVEL, "Read cart file [%s] see to zero failed.", fname);
-		return(-1);
 	}
-	if (cart_read(mfh, membuf, stats.st_size) != stats.st_size) {
-		// Failed, error out
-		logMessage(LOG_ERROR_LEVEL, "Read cart file [%s] of length %d failed.", fname, stats.st_size);
-		return(-1);
+
+	// Walk both copies a chunk at a time and compare them
+	for (done=0; (err==0) && (done<stats.st_size); done+=chunk) {
+		chunk = (stats.st_size-done < CART_SIM_VALIDATE_CHUNK) ? stats.st_size-done : CART_SIM_VALIDATE_CHUNK;
+		if (read(fh, filbuf, chunk) != chunk) {
+			logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], read failed ", filename);
+			err = -1;
+			break;
+		}
+		pthread_mutex_lock(&cart_sim_driver_lock);
+		idx = cart_read(mfh, membuf, chunk);
+		pthread_mutex_unlock(&cart_sim_driver_lock);
+		if (idx != chunk) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Read cart file [%s] of length %d failed.", fname, stats.st_size);
+			err = -1;
+			break;
+		}
+
+		// Only look byte for byte once we know the chunk differs
+		if (memcmp(membuf, filbuf, chunk) != 0) {
+			for (idx=0; membuf[idx] == filbuf[idx]; idx++);
+			logMessage(LOG_ERROR_LEVEL, "Validation of [%s] failed at offset %d (mem %x/'%c' "
+				"!= fil %x/'%c'", fname, done+idx, membuf[idx], membuf[idx], filbuf[idx], filbuf[idx]);
+			err = -1;
+			if (cart_sim_dump_mismatch) {
+				dump_cart_file(fname, mfh, stats.st_size, membuf);
+			}
+		}
 	}
+	close(fh);
+
+	// Free the buffers, log success, and return
+	free(filbuf);
+	free(membuf);
+	if (err == 0) {
+		logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
+	}
+	return( err );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dump_cart_file
+// Description  : Create a backup (.cmm) of the memory file so people can debug
+//
+// Inputs       : fname - the name of the file
+//                mfh - the memory file handle
+//                size - the number of bytes to dump
+//                buf - a CART_SIM_VALIDATE_CHUNK sized buffer to use
+// Outputs      : 0 if successful, -1 if failure
+
+int dump_cart_file(char *fname, int16_t mfh, int32_t size, char *buf) {
+
+	// Local variables
+	char bkfile[256];
+	int32_t chunk, done, err = 0;
+	int fh;
 
-	// Now create a backup of the memory file so people can debug
+	// Create the backup file
 	snprintf(bkfile, 256, "%s/%s.cmm", CART_WORKLOAD_DIR, fname);
 	if ((fh=open(bkfile, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU)) == -1) {
 		logMessage(LOG_ERROR_LEVEL, "Failure creating backup file [%s], open failed (%s) ", 
 			bkfile, strerror(errno));
 		return(-1);		
 	}
-	if ((write(fh, membuf, stats.st_size)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
-		return(-1);
-	}
-	close(fh);
 
-
-	// Now walk the buffers and compare byte for byte
-	for (idx=0; idx<stats.st_size; idx++) {
-		if (membuf[idx] != filbuf[idx]) {
-			logMessage(LOG_ERROR_LEVEL, "Validation of [%s] failed at offset %d (mem %x/'%c' "
-				"!= fil %x/'%c'", fname, idx, membuf[idx], membuf[idx], filbuf[idx], filbuf[idx]);
-			return(-1);
+	// Stream the memory file out from the start
+	pthread_mutex_lock(&cart_sim_driver_lock);
+	err = cart_seek(mfh, 0);
+	if ((err == 0) && (cart_sim_advice != -1)) {
+		err = cart_advise(mfh, 0, 0, cart_sim_advice);
+	}
+	pthread_mutex_unlock(&cart_sim_driver_lock);
+	for (done=0; (err==0) && (done<size); done+=chunk) {
+		chunk = (size-done < CART_SIM_VALIDATE_CHUNK) ? size-done : CART_SIM_VALIDATE_CHUNK;
+		pthread_mutex_lock(&cart_sim_driver_lock);
+		err = (cart_read(mfh, buf, chunk) == chunk) ? 0 : -1;
+		pthread_mutex_unlock(&cart_sim_driver_lock);
+		if ((err == 0) && (write(fh, buf, chunk) != chunk)) {
+			err = -1;
 		}
 	}
-
-	// Free the buffers, log success, and return successfully
-	free(filbuf);
-	free(membuf);
-	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
-	return( 0 );
+	if (err != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
+	}
+	close(fh);
+	return(err);
 }
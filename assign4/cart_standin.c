@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_standin.c
+//  Description    : This is a stand-in CART server for local testing.  It
+//                   speaks the same framing as cart_server (8-byte network
+//                   order register, then any frames) on top of the in-memory
+//                   controller, and adds the multi-frame RDFRMS/WRFRMS and
+//                   the partial frame WRPART ops.  With -m it serves a client
+//                   on the same host over the shared memory transport, and
+//                   -D makes it answer slowly to test replica selection.
+//                   Each TCP client is served on its own thread, so a client
+//                   may open several connections.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/19/26
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cart_support.h>
+#include <cart_shm.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CART_STANDIN_ARGUMENTS "hvml:p:D:"
+#define USAGE \
+	"USAGE: cart_standin [-h] [-v] [-m] [-l <logfile>] [-p <port>] [-D <usec>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on.\n" \
+	"    -m - serve over shared memory (named by the port) instead of TCP\n" \
+	"    -D - delay each response by up to <usec>, and 1 in 20 by ten times that\n" \
+	"\n"
+
+//
+// Global data
+int                cart_network_shutdown = 0;   // Flag indicating shutdown
+unsigned char     *cart_network_address = NULL; // Address of CART server
+unsigned short     cart_network_port = 0;       // Port of CART server
+unsigned long      CartControllerLLevel = 0;    // Controller log level (global)
+unsigned long      CartDriverLLevel = 0;        // Driver log level (global)
+unsigned long      CartSimulatorLLevel = 0;     // Simulator log level (global)
+unsigned long      standin_delay = 0;           // Most usec to delay a response
+
+//
+// Functional Prototypes
+
+int standin_session(int sock);                        // Serve one client connection
+void *standin_session_thread(void *arg);              // Run and close a session
+int standin_shm_server(void);                         // Serve clients over shared memory
+int standin_recv(int sock, void *buf, size_t len);    // Read exactly len bytes
+int standin_send(int sock, void *buf, size_t len);    // Write exactly len bytes
+void standin_stall(void);                             // Delay a response (-D)
+void standin_stop(int sig);                           // Ask the server to shut down
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the stand-in CART server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, log_initialized = 0, shm = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_STANDIN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			CartControllerLLevel = LOG_INFO_LEVEL;
+			enableLogLevels(LOG_INFO_LEVEL);
+			break;
+
+		case 'm': // Shared memory transport
+			shm = 1;
+			break;
+
+		case 'D': // Delay responses
+			if ( sscanf(optarg, "%lu", &standin_delay) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad delay [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &cart_network_port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed, then serve
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	return( shm ? standin_shm_server() : cart_server() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_server
+// Description  : Listen for clients and serve each on its own thread until
+//                shutdown
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_server( void ) {
+
+	// Local variables
+	struct sockaddr_in saddr, caddr;
+	socklen_t clen;
+	int server, client, one = 1;
+	pthread_t thread;
+
+	// Create, bind and listen on the server socket
+	memset(&saddr, 0x0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons((cart_network_port == 0) ? CART_DEFAULT_PORT : cart_network_port);
+	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if ( ((server = socket(PF_INET, SOCK_STREAM, 0)) == -1) ||
+		 (setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) ||
+		 (bind(server, (struct sockaddr *)&saddr, sizeof(saddr)) != 0) ||
+		 (listen(server, CART_MAX_BACKLOG) != 0) ) {
+		logMessage(LOG_ERROR_LEVEL, "Stand-in server setup failed [%s]", strerror(errno));
+		return(-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "Stand-in server listening on port [%d]", ntohs(saddr.sin_port));
+
+	// Serve clients until told to shut down
+	while (!cart_network_shutdown) {
+		clen = sizeof(caddr);
+		if ((client = accept(server, (struct sockaddr *)&caddr, &clen)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "Stand-in accept failed [%s]", strerror(errno));
+			continue;
+		}
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		logMessage(LOG_INFO_LEVEL, "Stand-in client connection [%s/%d]",
+			inet_ntoa(caddr.sin_addr), ntohs(caddr.sin_port));
+		if (pthread_create(&thread, NULL, standin_session_thread, (void *)(intptr_t)client) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Stand-in session thread failed");
+			close(client);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	close(server);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_session
+// Description  : Serve requests from one client until it powers off or
+//                disconnects
+//
+// Inputs       : sock - the client socket
+// Outputs      : 0 if the client powered off, -1 otherwise
+
+int standin_session(int sock) {
+
+	// Local variables
+	char *frames;
+	CartXferRegister reg, resp, wire;
+	CartridgeIndex loaded = CART_NO_CARTRIDGE;
+	uint8_t op;
+	size_t inlen, outlen, count;
+
+	frames = malloc(CART_MAX_XFER_FRAMES * CART_FRAME_SIZE);
+	while (standin_recv(sock, &wire, sizeof(wire)) == 0) {
+
+		// Work out how many frames travel with the request and the response
+		reg = ntohll64(wire);
+		op = (reg & KY1_MASK) >> 56;
+		count = ((op == CART_OP_RDFRMS) || (op == CART_OP_WRFRMS)) ? (reg & CNT_MASK) : 1;
+		if (op == CART_OP_WRPART) {
+			// WRPART counts bytes, the payload is the offset then the bytes
+			count = reg & CNT_MASK;
+			if (count > CART_FRAME_SIZE) {
+				logMessage(LOG_ERROR_LEVEL, "Stand-in partial write too large [%lu bytes]", count);
+				break;
+			}
+		} else if (count > CART_MAX_XFER_FRAMES) {
+			// Can't take the payload, the stream is no longer in sync
+			logMessage(LOG_ERROR_LEVEL, "Stand-in transfer too large [%lu frames]", count);
+			break;
+		}
+		inlen = ((op == CART_OP_WRFRME) || (op == CART_OP_WRFRMS)) ? count*CART_FRAME_SIZE : 0;
+		if ((op == CART_OP_WRPART) && (count > 0)) {
+			inlen = CART_PARTIAL_HEADER_SIZE + count;
+		}
+		outlen = ((op == CART_OP_RDFRME) || (op == CART_OP_RDFRMS)) ? count*CART_FRAME_SIZE : 0;
+
+		// Receive, execute and respond
+		if ((inlen > 0) && (standin_recv(sock, frames, inlen) != 0)) {
+			break;
+		}
+		resp = cart_io_bus_session(&loaded, reg, frames);
+		standin_stall();
+		wire = htonll64(resp);
+		if (standin_send(sock, &wire, sizeof(wire)) != 0) {
+			break;
+		}
+		if ((outlen > 0) && ((resp & RT_MASK) == 0) && (standin_send(sock, frames, outlen) != 0)) {
+			break;
+		}
+		if (op == CART_OP_POWOFF) {
+			free(frames);
+			return(0);
+		}
+	}
+
+	free(frames);
+	return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_session_thread
+// Description  : Serve a client connection on its own thread, then close it
+//
+// Inputs       : arg - the client socket
+// Outputs      : NULL
+
+void *standin_session_thread(void *arg) {
+	int sock = (int)(intptr_t)arg;
+
+	standin_session(sock);
+	close(sock);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_shm_server
+// Description  : Serve requests arriving on the shared memory segment until
+//                shutdown.  Frames are read from and returned in the slab,
+//                so the controller works on it directly
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_shm_server(void) {
+
+	// Local variables
+	unsigned short port = (cart_network_port == 0) ? CART_DEFAULT_PORT : cart_network_port;
+	struct sigaction stop;
+	CartShmSegment *seg;
+	CartXferRegister reg;
+
+	if ((seg = cart_shm_create(port)) == NULL) {
+		return(-1);
+	}
+
+	// Interrupts end the loop below, so the segment is always removed
+	memset(&stop, 0x0, sizeof(stop));
+	stop.sa_handler = standin_stop;
+	sigemptyset(&stop.sa_mask);
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+	logMessage(LOG_INFO_LEVEL, "Stand-in server serving shared memory [%d]", port);
+
+	// Wake up every so often to look for shutdown
+	while (!cart_network_shutdown) {
+		if (cart_shm_pop(&seg->request, &reg, 1) != 0) {
+			continue;
+		}
+		reg = cart_io_bus(reg, seg->slab);
+		standin_stall();
+		cart_shm_push(&seg->response, reg);
+	}
+
+	cart_shm_destroy(seg, port);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_stop
+// Description  : Signal handler, ask the shared memory server to shut down
+//
+// Inputs       : sig - the signal (unused)
+// Outputs      : none
+
+void standin_stop(int sig) {
+	(void)sig;
+	cart_network_shutdown = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_recv
+// Description  : Read exactly len bytes from the socket
+//
+// Inputs       : sock - the socket
+//                buf, len - where to put the bytes and how many
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_recv(int sock, void *buf, size_t len) {
+	ssize_t got;
+	while (len > 0) {
+		if ((got = read(sock, buf, len)) <= 0) {
+			return(-1);
+		}
+		buf = (char *)buf + got;
+		len -= got;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_send
+// Description  : Write exactly len bytes to the socket
+//
+// Inputs       : sock - the socket
+//                buf, len - the bytes to send
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_send(int sock, void *buf, size_t len) {
+	ssize_t sent;
+	while (len > 0) {
+		if ((sent = write(sock, buf, len)) <= 0) {
+			return(-1);
+		}
+		buf = (char *)buf + sent;
+		len -= sent;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_stall
+// Description  : Hold up a response for a random time up to the -D delay,
+//                with an occasional much longer stall to give a slow tail
+//
+// Inputs       : none
+// Outputs      : none
+
+void standin_stall(void) {
+	unsigned long usec;
+	struct timespec wait;
+
+	if (standin_delay == 0) {
+		return;
+	}
+	usec = getRandomValue(0, standin_delay);
+	if (getRandomValue(1, 20) == 1) {
+		usec *= 10;
+	}
+	wait.tv_sec = usec / 1000000;
+	wait.tv_nsec = (usec % 1000000) * 1000;
+	nanosleep(&wait, NULL);
+}
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <cart_support.h>
 #include <cart_controller.h>
+#include <cart_network.h>
 
 //Define masks for unpacking registers
 #define KY1_MASK 0xFF00000000000000
@@ -19,17 +20,66 @@
 #define RT_MASK	0x0000800000000000
 #define CT1_MASK 0x00007FFF80000000
 #define	FM1_MASK 0x000000007FFF8000
+#define CNT_MASK 0x0000000000007FFF
+
+//WRPART payloads start with the 16-bit (network order) offset in the frame
+#define CART_PARTIAL_HEADER_SIZE 2
+
+//Content-hash dedup, frames are keyed by their SHA1 (CMPSC311_HASH_TYPE)
+#define CART_DEDUP_DIGEST 20
+#define CART_DEDUP_BUCKETS 65536				//must be a power of 2
+#define CART_TOTAL_FRAMES (CART_MAX_SERVERS*CART_MAX_CARTRIDGES*CART_CARTRIDGE_SIZE)
+
+//Frame locations: the server is above bit 16, then 6 bits of cartridge and 10
+//of frame.  location >> 10 is the cartridge counted across all servers
+#define CART_BUS_DEPTH 8					//requests that may be outstanding on one server
+#define CART_BUS_STALE (-2)					//op of a response nobody wants any more
+#define CART_HEDGE_MIN_US 200				//floor of the adaptive hedge delay
+#define CART_LOCATION(server, cart, frm) (((uint32_t)(server) << 16) | ((cart) << 10) | (frm))
+#define CART_SERVER_OF(cart) ((cart) / CART_MAX_CARTRIDGES)
+#define CART_CARTRIDGE_OF(cart) ((cart) % CART_MAX_CARTRIDGES)
+
+#define CART_NO_FRAME 0xFFFFFFFF			//location handed out when there is no room left
+
+//Log-structured writes, each connection's share of the cartridges is a log
+//written at its head and cleaned a cartridge at a time
+#define CART_LFS_RESERVE 2					//clean cartridges the cleaner keeps ahead of the head
+
+//An entry in the dedup index, mapping frame contents to the frame holding them
+typedef struct dedup_entry {
+	char digest[CART_DEDUP_DIGEST];
+	uint32_t location;
+	char stored;						//the frame holding them has been written
+	struct dedup_entry *next;
+}dedup_entry;
+
+//The file table, paths and handles start this big and double as they fill
+#define CART_FILES_INITIAL 64				//entries of the file table
+#define CART_PATH_BLOCK (64*1024)			//bytes of each block of interned paths
+#define CART_HANDLES_INITIAL 64				//entries of the handle table
+#define CART_FILE_INDEX(f) ((uint32_t)((f) - files))	//a file's place in the table
+
+//Read ahead, the window doubles from the least as sequential reads go on
+#define CART_READAHEAD_MIN 4				//frames read ahead once reads turn sequential
+#define CART_READAHEAD_MAX 32				//most frames read ahead of a read
 
 //The Main file structure
 typedef struct {
-	char path[128];						//File path  
-	int16_t fd;							//File descriptor
-	int32_t fp;							//File pointer in number of bytes
-	int32_t filesize;					//File Size in bytes					
-	int NumberOfFrames;					//Number of frames allocated for the file
-	uint16_t *CartFrame;			//Locations of frames the file is stored in
-										//The upper 6 bits of this variable contain the cartridge number..
+	const char *path;					//File path, interned (never freed before poweroff)
+	int16_t fd;							//File handle while the file is open
+	int64_t fp;							//File pointer in number of bytes
+	int64_t filesize;					//File Size in bytes					
+	uint32_t NumberOfFrames;			//Number of frames allocated for the file
+	uint32_t FrameCapacity;				//Entries allocated in CartFrame
+	uint32_t *CartFrame;			//Locations of frames the file is stored in
+										//Bits 16 and up hold the server, the next 6 bits the cartridge number..
 										//while the lower 10 contain the frame number
+	char *wbuf;							//Append buffer, the last frame's new bytes (at their frame offsets)
+	int64_t bufstart;					//File offset of the first buffered byte
+	int32_t buflen;						//Bytes in the append buffer, always the end of the file
+	int64_t readnext;					//File offset just past the last read, -1 if none
+	uint32_t readahead;					//Frames being read ahead of sequential reads
+	uint8_t advice;						//How the file is read (CART_ADVICE_*), set by cart_advise
 	enum{
 		CLOSED = 0,
 		OPEN = 1
@@ -37,6 +87,28 @@ typedef struct {
 
 }file;
 
+extern file *files;						//the file table (cart_driver.c)
+extern uint32_t FileCounter;			//files in the table
+
+//A run of contiguous frames on one cartridge, queued for the bus
+typedef struct {
+	CartridgeIndex cart;				//cartridge counted across servers (location >> 10)
+	CartFrameIndex frm;					//first frame
+	int count;							//number of frames
+	char *buf;							//the frames
+}CartBusRun;
+
+//A request sent to a server whose response hasn't been read yet
+typedef struct {
+	CartXferRegister reg;				//the request
+	char *buf;							//where its frames go
+	int op;								//the transfer request it carries, -1 if none
+	int stale;							//another replica answered, drop the response
+	uint64_t sent;						//when it was sent (usec)
+	uint64_t traced;					//when it was sent for the timeline (nsec), 0 if off
+	uint64_t done;						//when it finishes in virtual time (nsec, simulated bus only)
+}CartBusPending;
+
 
 CartXferRegister create_cart_opcode(uint64_t KY1, uint64_t KY2, uint64_t CT1, uint64_t FM1);
 //Creates a packed register using shifts and masks
@@ -44,7 +116,7 @@ CartXferRegister create_cart_opcode(uint64_t KY1, uint64_t KY2, uint64_t CT1, ui
 int16_t extract_cart_opcode(CartXferRegister resp, char *KY1, char *KY2, char *RT, uint16_t *CT1, uint16_t *FM1);
 //extracts values and places them in the function parameters 
 
-int32_t file_ExtractFrame(uint16_t location,uint16_t* frame, uint16_t *cart);
+int32_t file_ExtractFrame(uint32_t location,uint16_t* frame, uint16_t *cart);
 //extracts a cartridge and frame value from location
 
 int16_t AllocateFrame(file* file);
@@ -53,6 +125,59 @@ int16_t AllocateFrame(file* file);
 int32_t min(int32_t a, int32_t b);
 //returns the minimum value of a and b
 
+CartXferRegister create_cart_xfer_opcode(uint64_t KY1, uint64_t CT1, uint64_t FM1, uint64_t CNT);
+//Creates a packed register for a multi-frame transfer of CNT frames
+
+int16_t cart_load_cartridge(int lane, CartridgeIndex cart);
+//Loads the cartridge on a connection if it is not already the current one
+
+int16_t cart_bus_transfer(CartBusRun *runs, int nruns, int write);
+//Reads or writes runs of frames, working on every server in parallel
+
+CartXferRegister cart_bus_request(int lane, CartXferRegister reg, void *buf);
+//Issues a request on a connection and keeps the bus statistics
+
+int cart_bus_send(int lane, CartXferRegister reg, void *buf);
+//Sends a request on a connection without waiting for the response
+
+CartXferRegister cart_bus_recv(int lane);
+//Receives the response to the oldest request still wanted on a connection
+
+int16_t cart_bus_broadcast(CartXferRegister reg, int every);
+//Issues a request to every server, -1 if any of them fails it
+
+uint32_t cart_new_frame(int lane);
+//Hands out an unused frame location from a connection's cartridges
+
+int16_t cart_write_partial(uint32_t location, int32_t offset, char *data, int32_t len);
+//Writes len bytes at offset within a frame using WRPART
+
+int16_t cart_load_frames(uint32_t *locations, int count, int ahead, char *buf);
+//Fills buf with the frames at the locations, from the cache or the bus (or only the cache if buf is NULL),
+//the last ahead of them are read ahead
+
+int16_t cart_store_frames(uint32_t *locations, int count, char *buf);
+//Writes the frames in buf to the locations and the cache
+
+int16_t cart_dedup_frame(uint32_t *location, char *frame);
+//Maps a frame about to be written onto a frame with the same contents, 1 if it still needs writing,
+//2 if the frame with them is not written yet
+
+void cart_dedup_release(uint32_t location);
+//Drops a reference to a frame, freeing it when nothing refers to it
+
+int cart_flush_file(file *wfile);
+//Writes out a file's append buffer
+
+file *cart_handle_file(int16_t fd);
+//Finds the open file a handle refers to, NULL if it refers to none
+
+int16_t cart_lfs_relocate(file *lfile, uint32_t first, uint32_t count);
+//Moves frames of a file to the head of the log before they are written (log mode only)
+
+int16_t cart_lfs_clean(void);
+//Empties the cartridges with the fewest live frames when the log runs short of clean ones
+
 #endif
 
 
@@ -0,0 +1,196 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_timeline.c
+//  Description    : This is the span timeline of the CART client, recorded
+//                   into a buffer allocated when it is turned on and written
+//                   as Chrome trace JSON.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+// Project Includes
+#include <cart_timeline.h>
+#include <cmpsc311_log.h>
+#include <cart_log.h>
+
+//
+// Global data
+
+int CartTimelineOn;                  // Spans are being recorded
+uint32_t CartTimelineCall;           // The driver call being made
+CartSpan *TimelineSpans;             // The span buffer
+_Atomic uint32_t TimelineCount;      // Spans claimed (may pass the buffer size)
+_Atomic uint32_t TimelineTracks;     // Thread tracks handed out
+uint64_t TimelineEpoch;              // When recording started
+char *TimelinePath;                  // Where to write the spans
+static __thread uint32_t TimelineTrack; // The calling thread's track, 0 until it has one
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_timeline_open
+// Description  : Allocate the span buffer and start recording
+//
+// Inputs       : path - the file to write the spans to at poweroff
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_timeline_open(const char *path) {
+	if ((TimelineSpans = malloc(CART_TIMELINE_SPANS * sizeof(CartSpan))) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to allocate the timeline of %d spans", CART_TIMELINE_SPANS);
+		return(-1);
+	}
+	TimelinePath = strdup(path);
+	atomic_store(&TimelineCount, 0);
+	TimelineEpoch = cart_timeline_now();
+	CartTimelineOn = 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_timeline_now
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in nsec
+
+uint64_t cart_timeline_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint64_t)now.tv_sec*1000000000 + now.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_timeline_track
+// Description  : Return the calling thread's track, numbering threads in
+//                the order they first record a span
+//
+// Inputs       : none
+// Outputs      : the track
+
+uint32_t cart_timeline_track(void) {
+	if (TimelineTrack == 0) {
+		TimelineTrack = atomic_fetch_add(&TimelineTracks, 1) + 1;
+	}
+	return(TimelineTrack);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_timeline_span
+// Description  : Record a span ending now, dropping it if the buffer is full
+//
+// Inputs       : cat, name - the category and name (literals)
+//                track - the thread or lane track
+//                start - when it began (from CART_TIMELINE_BEGIN)
+//                keys - the argument names, comma separated (a literal)
+//                a0, a1, a2 - the arguments
+// Outputs      : none
+
+void cart_timeline_span(const char *cat, const char *name, uint32_t track, uint64_t start,
+		const char *keys, int64_t a0, int64_t a1, int64_t a2) {
+	uint32_t slot = atomic_fetch_add_explicit(&TimelineCount, 1, memory_order_relaxed);
+	CartSpan *span;
+
+	if (slot >= CART_TIMELINE_SPANS) {
+		return;
+	}
+	span = &TimelineSpans[slot];
+	span->cat = cat;
+	span->name = name;
+	span->keys = keys;
+	span->start = start;
+	span->dur = cart_timeline_now() - start;
+	span->track = track;
+	span->call = CartTimelineCall;
+	span->args[0] = a0;
+	span->args[1] = a1;
+	span->args[2] = a2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_timeline_write
+// Description  : Write the spans as Chrome trace JSON (complete events,
+//                times in usec from the start) and free the buffer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_timeline_write(void) {
+
+	// Local variables
+	uint32_t count, i, t, tracks;
+	const char *key, *comma;
+	int lanes[CART_TIMELINE_LANE_TRACK] = { 0 }, a, ret = 0;
+	CartSpan *span;
+	FILE *out;
+
+	if (!CartTimelineOn) {
+		return(0);
+	}
+	CartTimelineOn = 0;
+	count = atomic_load(&TimelineCount);
+	if (count > CART_TIMELINE_SPANS) {
+		logMessage(LOG_WARNING_LEVEL, "Timeline full, %u of %u spans dropped", count - CART_TIMELINE_SPANS, count);
+		count = CART_TIMELINE_SPANS;
+	}
+	if ((out = fopen(TimelinePath, "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to write the timeline to [%s]", TimelinePath);
+		ret = -1;
+	} else {
+		fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+		fprintf(out, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"cart_sim\"}}");
+
+		// Name the tracks
+		tracks = atomic_load(&TimelineTracks);
+		for (t = 1; t <= tracks; t++) {
+			fprintf(out, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"thread %u\"}}", t, t);
+		}
+		for (i = 0; i < count; i++) {
+			t = TimelineSpans[i].track;
+			if ((t >= CART_TIMELINE_LANE_TRACK) && (t < 2*CART_TIMELINE_LANE_TRACK) && !lanes[t - CART_TIMELINE_LANE_TRACK]) {
+				lanes[t - CART_TIMELINE_LANE_TRACK] = 1;
+				fprintf(out, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"lane %u\"}}",
+					t, t - CART_TIMELINE_LANE_TRACK);
+			}
+		}
+
+		// The spans
+		for (i = 0; i < count; i++) {
+			span = &TimelineSpans[i];
+			fprintf(out, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"cat\":\"%s\",\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"call\":%u",
+				span->track, span->cat, span->name, (double)(span->start - TimelineEpoch) / 1000.0,
+				(double)span->dur / 1000.0, span->call);
+			for (key = span->keys, a = 0; (key != NULL) && (*key != 0) && (a < 3); a++) {
+				comma = strchr(key, ',');
+				fprintf(out, ",\"%.*s\":%lld", (int)((comma == NULL) ? strlen(key) : (size_t)(comma - key)), key,
+					(long long)span->args[a]);
+				key = (comma == NULL) ? NULL : comma + 1;
+			}
+			fprintf(out, "}}");
+		}
+		fprintf(out, "\n]}\n");
+		if (fclose(out) != 0) {
+			ret = -1;
+		}
+		logMessage(LOG_OUTPUT_LEVEL, "Timeline:%u spans written to %s", count, TimelinePath);
+	}
+	free(TimelineSpans);
+	free(TimelinePath);
+	TimelineSpans = NULL;
+	TimelinePath = NULL;
+	return(ret);
+}
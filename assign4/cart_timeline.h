@@ -0,0 +1,87 @@
+#ifndef CART_TIMELINE_INCLUDED
+#define CART_TIMELINE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_timeline.h
+//  Description    : This is the header file for the span timeline of the
+//                   CART client: driver calls, cache lookups and bus
+//                   requests recorded into a preallocated buffer and
+//                   written out as Chrome trace JSON at poweroff.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define CART_TIMELINE_SPANS (1<<18)      // Spans the buffer holds, later ones are dropped
+#define CART_TIMELINE_LANE_TRACK 1000    // Track of lane 0, the driver's threads come before it
+
+/*
+
+ Spans
+
+ A span is a name, a category, a track, a start and a duration, with up to
+ three named integer arguments.  Driver calls and cache lookups go on the
+ track of the thread that made them, bus requests on the track of the lane
+ (connection) that carried them, from when the request was sent to when its
+ response was read.  Every span carries the number of the driver call it
+ ran under, so the requests a cart_read caused can be picked out even
+ when several lanes overlap.
+
+ The file loads in chrome://tracing and in the Perfetto UI.  With the
+ timeline off each probe is a test of CartTimelineOn.
+
+*/
+
+// A recorded span
+typedef struct {
+	const char *cat;       // The category (driver, cache, bus)
+	const char *name;      // The span name
+	const char *keys;      // Names of the arguments, comma separated
+	uint64_t start;        // When it began (nsec)
+	uint64_t dur;          // How long it took (nsec)
+	uint32_t track;        // The thread or lane
+	uint32_t call;         // The driver call it ran under
+	int64_t args[3];       // The arguments
+} CartSpan;
+
+//
+// Global data
+
+extern int CartTimelineOn;          // Spans are being recorded
+extern uint32_t CartTimelineCall;   // The driver call being made
+
+//
+// Probes
+
+#define CART_TIMELINE_BEGIN() (CartTimelineOn ? cart_timeline_now() : 0)
+	// Start a span, 0 if the timeline is off
+
+#define CART_TIMELINE_END(cat, name, track, start, keys, a0, a1, a2) \
+	do { if (start) cart_timeline_span(cat, name, track, start, keys, a0, a1, a2); } while (0)
+	// End a span begun with CART_TIMELINE_BEGIN
+
+//
+// Functional Prototypes
+
+int cart_timeline_open(const char *path);
+	// Start recording spans, to be written to path at poweroff
+
+uint64_t cart_timeline_now(void);
+	// Read the clock the spans use (nsec)
+
+uint32_t cart_timeline_track(void);
+	// The calling thread's track
+
+void cart_timeline_span(const char *cat, const char *name, uint32_t track, uint64_t start,
+	const char *keys, int64_t a0, int64_t a1, int64_t a2);
+	// Record a span that began at start and ends now
+
+int cart_timeline_write(void);
+	// Write the spans out and stop recording
+
+#endif
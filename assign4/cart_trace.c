@@ -0,0 +1,487 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_trace.c
+//  Description    : This is the implementation of the workload trace support
+//                   for the CART simulator: the single-pass text tokenizer,
+//                   and the writer/converter/loader for binary traces.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Project includes
+#include <cart_trace.h>
+#include <cmpsc311_log.h>
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parse_workload_line
+// Description  : Tokenize a single (non-terminated) workload line of the form
+//                "<file> <COMMAND> <len> <off> :<payload>" in one pass
+//
+// Inputs       : line - the start of the line
+//                llen - the length of the line (not including newline)
+//                wl - the parsed line (output)
+// Outputs      : 0 if successful, -1 if failure
+
+int parse_workload_line(const char *line, int32_t llen, CartWorkloadLine *wl) {
+
+	// Local variables
+	const char *p = line, *end = line+llen, *tok;
+	int32_t *nums[2] = { &wl->len, &wl->off };
+	int i, neg;
+
+	// Pull out the filename and the command tokens
+	for (i=0; i<2; i++) {
+		char *dst = (i == 0) ? wl->fname : wl->command;
+		while ((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+		tok = p;
+		while ((p < end) && (*p != ' ') && (*p != '\t')) p++;
+		if ((p == tok) || (p-tok >= CART_SIM_MAX_TOKEN)) {
+			return(-1);
+		}
+		memcpy(dst, tok, p-tok);
+		dst[p-tok] = 0x0;
+	}
+
+	// Now the two (possibly signed) decimal fields
+	for (i=0; i<2; i++) {
+		while ((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+		neg = ((p < end) && (*p == '-'));
+		if (neg) p++;
+		tok = p;
+		*nums[i] = 0;
+		while ((p < end) && (*p >= '0') && (*p <= '9')) {
+			*nums[i] = (*nums[i] * 10) + (*p++ - '0');
+		}
+		if (p == tok) {
+			return(-1);
+		}
+		if (neg) *nums[i] = -(*nums[i]);
+	}
+
+	// Find the payload separator
+	if ((tok = memchr(p, ':', end-p)) == NULL) {
+		return(-1);
+	}
+	wl->payload = tok+1;
+	wl->plen = end-(tok+1);
+
+	// Classify the command once so the dispatch is a simple compare
+	if (strncmp(wl->command, "WRITEAT", 7) == 0) {
+		wl->cmd = CART_SIM_WRITEAT;
+	} else if (strncmp(wl->command, "WRITE", 5) == 0) {
+		wl->cmd = CART_SIM_WRITE;
+	} else if (strncmp(wl->command, "SEEK", 4) == 0) {
+		wl->cmd = CART_SIM_SEEK;
+	} else if (strncmp(wl->command, "READ", 4) == 0) {
+		wl->cmd = CART_SIM_READ;
+	} else {
+		wl->cmd = CART_SIM_UNKNOWN;
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : translate_payload
+// Description  : Copy the payload text and turn the '^' markers into newlines
+//
+// Inputs       : text - the destination buffer (at least len+1 bytes)
+//                src - the payload text from the workload
+//                len - the number of bytes to copy
+// Outputs      : none
+
+void translate_payload(char *text, const char *src, int32_t len) {
+
+	// Copy the text, then hop from marker to marker using memchr
+	char *p = text, *end = text+len;
+	memcpy(text, src, len);
+	text[len] = 0x0;
+	while ((p < end) && ((p = memchr(p, '^', end-p)) != NULL)) {
+		*p++ = '\n';
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_workload_name
+// Description  : FNV-1a hash of a workload filename
+//
+// Inputs       : fname - the filename to hash
+// Outputs      : the hash value
+
+uint32_t hash_workload_name(const char *fname) {
+	uint32_t hash = 2166136261u;
+	while (*fname) {
+		hash = (hash ^ (unsigned char)*fname++) * 16777619u;
+	}
+	return(hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_writer_init
+// Description  : Setup an empty trace writer
+//
+// Inputs       : wr - the writer to setup
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_writer_init(CartTraceWriter *wr) {
+	memset(wr, 0x0, sizeof(CartTraceWriter));
+	if ( ((wr->name_index = calloc(CART_TRACE_INDEX_SIZE, sizeof(uint32_t))) == NULL) ||
+		 ((wr->name_offs = calloc(CART_TRACE_MAX_FILES, sizeof(uint32_t))) == NULL) ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure allocating trace name index.");
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : intern_trace_name
+// Description  : Find (or add) a filename in the writer's filename table
+//
+// Inputs       : wr - the trace writer
+//                fname - the filename to intern
+// Outputs      : the file id, -1 if failure
+
+static int32_t intern_trace_name(CartTraceWriter *wr, const char *fname) {
+
+	// Local variables
+	uint32_t slot = hash_workload_name(fname) & (CART_TRACE_INDEX_SIZE-1);
+	uint64_t nlen = strlen(fname)+1;
+
+	// Probe the index for the name
+	while (wr->name_index[slot] != 0) {
+		if (strcmp(&wr->names[wr->name_offs[wr->name_index[slot]-1]], fname) == 0) {
+			return((int32_t)wr->name_index[slot]-1);
+		}
+		slot = (slot+1) & (CART_TRACE_INDEX_SIZE-1);
+	}
+
+	// Not found, add it to the end of the table
+	if (wr->nfiles >= CART_TRACE_MAX_FILES) {
+		logMessage(LOG_ERROR_LEVEL, "Too many files for binary trace [%s].", fname);
+		return(-1);
+	}
+	if (wr->names_len + nlen > wr->names_cap) {
+		wr->names_cap = (wr->names_cap == 0) ? 4096 : wr->names_cap*2;
+		while (wr->names_len + nlen > wr->names_cap) wr->names_cap *= 2;
+		wr->names = realloc(wr->names, wr->names_cap);
+	}
+	memcpy(&wr->names[wr->names_len], fname, nlen);
+	wr->name_offs[wr->nfiles] = (uint32_t)wr->names_len;
+	wr->name_index[slot] = wr->nfiles+1;
+	wr->names_len += nlen;
+	return((int32_t)wr->nfiles++);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_append
+// Description  : Add a command to the trace, with its payload for writes
+//
+// Inputs       : wr - the trace writer
+//                cmd - the command
+//                fname - the file the command operates on
+//                len, off - the command fields
+//                payload - the translated payload (len bytes, writes only)
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_append(CartTraceWriter *wr, CartSimCommand cmd, const char *fname,
+		int32_t len, int32_t off, const char *payload) {
+
+	// Local variables
+	CartTraceRecord *rec;
+	int32_t id;
+
+	// Intern the filename, grow the record array
+	if ((id = intern_trace_name(wr, fname)) == -1) {
+		return(-1);
+	}
+	if (wr->nrecords == wr->records_cap) {
+		wr->records_cap = (wr->records_cap == 0) ? 4096 : wr->records_cap*2;
+		wr->records = realloc(wr->records, wr->records_cap*sizeof(CartTraceRecord));
+	}
+	rec = &wr->records[wr->nrecords++];
+	rec->cmd = (uint8_t)cmd;
+	rec->pad = 0;
+	rec->fileid = (uint16_t)id;
+	rec->len = len;
+	rec->off = off;
+
+	// Writes carry their payload out-of-line
+	if ((cmd == CART_SIM_WRITE) || (cmd == CART_SIM_WRITEAT)) {
+		if (wr->payload_len + len > wr->payload_cap) {
+			wr->payload_cap = (wr->payload_cap == 0) ? 65536 : wr->payload_cap*2;
+			while (wr->payload_len + len > wr->payload_cap) wr->payload_cap *= 2;
+			wr->payload = realloc(wr->payload, wr->payload_cap);
+		}
+		memcpy(&wr->payload[wr->payload_len], payload, len);
+		wr->payload_len += len;
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_writer_finish
+// Description  : Write the trace out to a file and release the writer
+//
+// Inputs       : wr - the trace writer
+//                binfile - the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_writer_finish(CartTraceWriter *wr, const char *binfile) {
+
+	// Local variables
+	CartTraceHeader hdr;
+	char zero[8] = { 0 };
+	FILE *fh;
+	int ret = 0;
+
+	// Lay out the sections, keeping the records 8-byte aligned
+	memset(&hdr, 0x0, sizeof(hdr));
+	hdr.magic = CART_TRACE_MAGIC;
+	hdr.version = CART_TRACE_VERSION;
+	hdr.nfiles = (uint16_t)wr->nfiles;
+	hdr.nrecords = wr->nrecords;
+	hdr.names_off = sizeof(CartTraceHeader);
+	hdr.names_len = wr->names_len;
+	hdr.records_off = (hdr.names_off + hdr.names_len + 7) & ~((uint64_t)7);
+	hdr.payload_off = hdr.records_off + (wr->nrecords*sizeof(CartTraceRecord));
+	hdr.payload_len = wr->payload_len;
+
+	// Now write the sections out
+	if ((fh = fopen(binfile, "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Failure creating binary trace [%s], error: %s.",
+			binfile, strerror(errno));
+		ret = -1;
+	} else {
+		if ( (fwrite(&hdr, sizeof(hdr), 1, fh) != 1) ||
+			 (fwrite(wr->names, 1, wr->names_len, fh) != wr->names_len) ||
+			 (fwrite(zero, 1, hdr.records_off-(hdr.names_off+hdr.names_len), fh) !=
+			 	hdr.records_off-(hdr.names_off+hdr.names_len)) ||
+			 (fwrite(wr->records, sizeof(CartTraceRecord), wr->nrecords, fh) != wr->nrecords) ||
+			 (fwrite(wr->payload, 1, wr->payload_len, fh) != wr->payload_len) ) {
+			logMessage(LOG_ERROR_LEVEL, "Failure writing binary trace [%s].", binfile);
+			ret = -1;
+		}
+		if (fclose(fh) != 0) {
+			ret = -1;
+		}
+	}
+
+	// Release the writer
+	cart_trace_writer_release(wr);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_writer_release
+// Description  : Release a trace writer without writing it out
+//
+// Inputs       : wr - the trace writer
+// Outputs      : none
+
+void cart_trace_writer_release(CartTraceWriter *wr) {
+	free(wr->names);
+	free(wr->name_index);
+	free(wr->name_offs);
+	free(wr->records);
+	free(wr->payload);
+	memset(wr, 0x0, sizeof(CartTraceWriter));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_convert
+// Description  : Convert a text workload into the binary trace format
+//
+// Inputs       : textfile - the text workload to read
+//                binfile - the binary trace to write
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_convert(const char *textfile, const char *binfile) {
+
+	// Local variables
+	const char *wdata = NULL, *line, *eol, *wend;
+	char text[1025];
+	CartTraceWriter wr;
+	CartWorkloadLine wl;
+	struct stat stats;
+	int32_t linecount = 0, llen;
+	int fh;
+
+	// Map the text workload
+	if ( ((fh=open(textfile, O_RDONLY)) == -1) || (fstat(fh, &stats) == -1) ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.",
+			textfile, strerror(errno));
+		if (fh != -1) close(fh);
+		return(-1);
+	}
+	if ( (stats.st_size > 0) &&
+		 ((wdata=mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fh, 0)) == MAP_FAILED) ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.",
+			textfile, strerror(errno));
+		close(fh);
+		return(-1);
+	}
+	close(fh);
+	if (cart_trace_writer_init(&wr) != 0) {
+		if (wdata != NULL) munmap((void *)wdata, stats.st_size);
+		return(-1);
+	}
+
+	// Walk the lines, adding a record for each
+	wend = wdata + stats.st_size;
+	for (line=wdata; (line!=NULL) && (line<wend); line=eol+1) {
+		if ((eol = memchr(line, '\n', wend-line)) == NULL) {
+			eol = wend;
+		}
+		llen = eol - line;
+		linecount++;
+		if ( (parse_workload_line(line, llen, &wl) != 0) || (wl.cmd == CART_SIM_UNKNOWN) ) {
+			logMessage(LOG_ERROR_LEVEL, "CART un-parsable workload string [%.*s], line %d",
+				llen, line, linecount);
+			break;
+		}
+		if ((wl.cmd == CART_SIM_WRITE) || (wl.cmd == CART_SIM_WRITEAT)) {
+			if ((wl.len < 0) || (wl.len >= 1024) || (wl.plen < wl.len)) {
+				logMessage(LOG_ERROR_LEVEL, "Bad workload payload length [%d], line %d",
+					wl.len, linecount);
+				break;
+			}
+			translate_payload(text, wl.payload, wl.len);
+		}
+		if (cart_trace_append(&wr, wl.cmd, wl.fname, wl.len, wl.off, text) != 0) {
+			break;
+		}
+	}
+	if (wdata != NULL) {
+		munmap((void *)wdata, stats.st_size);
+	}
+
+	// Bail out if we did not get through the whole workload
+	if ((line != NULL) && (line < wend)) {
+		cart_trace_writer_release(&wr);
+		return(-1);
+	}
+
+	// Now write out the trace
+	if (cart_trace_writer_finish(&wr, binfile) != 0) {
+		return(-1);
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "Converted [%s] (%d lines) to binary trace [%s].",
+		textfile, linecount, binfile);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_map
+// Description  : Map a binary trace into memory and check its layout
+//
+// Inputs       : binfile - the binary trace file
+//                trace - the mapped trace (output)
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_map(const char *binfile, CartTrace *trace) {
+
+	// Local variables
+	const CartTraceHeader *hdr;
+	const char *name, *nend;
+	struct stat stats;
+	int fh, i;
+
+	// Open and map the trace
+	memset(trace, 0x0, sizeof(CartTrace));
+	if ( ((fh=open(binfile, O_RDONLY)) == -1) || (fstat(fh, &stats) == -1) ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure opening binary trace [%s], error: %s.",
+			binfile, strerror(errno));
+		if (fh != -1) close(fh);
+		return(-1);
+	}
+	if ( (stats.st_size < sizeof(CartTraceHeader)) ||
+		 ((trace->base=mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fh, 0)) == MAP_FAILED) ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure mapping binary trace [%s].", binfile);
+		close(fh);
+		trace->base = NULL;
+		return(-1);
+	}
+	close(fh);
+	trace->size = stats.st_size;
+	madvise(trace->base, trace->size, MADV_SEQUENTIAL);
+
+	// Check the header and section bounds, every offset is inside the
+	// mapping before anything is subtracted from its size (nothing can wrap)
+	hdr = trace->header = trace->base;
+	if ( (hdr->magic != CART_TRACE_MAGIC) || (hdr->version != CART_TRACE_VERSION) ||
+		 (hdr->names_off > trace->size) || (hdr->records_off > trace->size) ||
+		 (hdr->payload_off > trace->size) ||
+		 (hdr->names_len > trace->size - hdr->names_off) ||
+		 (hdr->records_off % sizeof(uint32_t) != 0) ||
+		 (hdr->nrecords > (trace->size - hdr->records_off) / sizeof(CartTraceRecord)) ||
+		 (hdr->records_off > hdr->payload_off) ||
+		 (hdr->nrecords*sizeof(CartTraceRecord) > hdr->payload_off - hdr->records_off) ||
+		 (hdr->payload_len > trace->size - hdr->payload_off) ) {
+		logMessage(LOG_ERROR_LEVEL, "Bad binary trace header [%s].", binfile);
+		cart_trace_unmap(trace);
+		return(-1);
+	}
+	trace->records = (const CartTraceRecord *)((const char *)trace->base + hdr->records_off);
+	trace->payload = (const char *)trace->base + hdr->payload_off;
+
+	// Index the filename table
+	trace->names = malloc(sizeof(char *) * (hdr->nfiles+1));
+	name = (const char *)trace->base + hdr->names_off;
+	nend = name + hdr->names_len;
+	for (i=0; i<hdr->nfiles; i++) {
+		trace->names[i] = name;
+		if ((name = memchr(name, 0x0, nend-name)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Bad binary trace filename table [%s].", binfile);
+			cart_trace_unmap(trace);
+			return(-1);
+		}
+		name++;
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_unmap
+// Description  : Release a mapped binary trace
+//
+// Inputs       : trace - the mapped trace
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_unmap(CartTrace *trace) {
+	if (trace->base != NULL) {
+		munmap(trace->base, trace->size);
+	}
+	free(trace->names);
+	memset(trace, 0x0, sizeof(CartTrace));
+	return(0);
+}
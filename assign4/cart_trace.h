@@ -0,0 +1,148 @@
+#ifndef CART_TRACE_INCLUDED
+#define CART_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_trace.h
+//  Description    : This is the header file for the workload trace formats
+//                   used by the CART simulator, the text workload tokenizer
+//                   and the compact binary trace format.
+//
+//  Author         : Edward Bagdon
+//  Last Modified  : 10/18/26
+//
+
+// Includes
+#include <stdint.h>
+#include <stddef.h>
+
+// Defines
+#define CART_SIM_MAX_TOKEN 128
+#define CART_WORKLOAD_DIR "workload"    // Where the source files of a workload live
+#define CART_SIM_MAX_OPEN_FILES 128      // Files a workload may use, cart_sim's file table
+#define CART_TRACE_MAGIC 0x43525443   // "CTRC" as little-endian bytes
+#define CART_TRACE_VERSION 1
+#define CART_TRACE_MAX_FILES 65535
+#define CART_TRACE_INDEX_SIZE (1<<17)  // Must be a power of 2, > 2*max files
+
+/*
+
+ Binary trace layout (all fields little-endian, offsets from start of file)
+
+   CartTraceHeader             - fixed header, see below
+   filename table              - nfiles NUL-terminated names, file id order
+   CartTraceRecord[nrecords]   - fixed-width command records
+   payload                     - write payloads, concatenated in record order
+
+ Records carry no payload offset: the replayer walks the payload section with
+ a running cursor, advancing by len for every WRITE/WRITEAT record.  Payloads
+ are stored already translated ('^' converted to newline).
+
+*/
+
+// These are the workload commands
+typedef enum {
+	CART_SIM_WRITEAT = 0,  // Seek, then write the payload
+	CART_SIM_WRITE   = 1,  // Write the payload at the current position
+	CART_SIM_SEEK    = 2,  // Seek to a position
+	CART_SIM_READ    = 3,  // Read from the current position
+	CART_SIM_UNKNOWN = 4   // Unrecognized command
+} CartSimCommand;
+
+// This is a single parsed workload line
+typedef struct {
+	char            fname[CART_SIM_MAX_TOKEN];   // The file the command operates on
+	char            command[CART_SIM_MAX_TOKEN]; // The command text
+	CartSimCommand  cmd;      // The classified command
+	int32_t         len;      // The length field
+	int32_t         off;      // The offset field
+	const char     *payload;  // The payload text (after the ':', not terminated)
+	int32_t         plen;     // The number of payload bytes on the line
+} CartWorkloadLine;
+
+// This is the binary trace file header
+typedef struct {
+	uint32_t magic;        // CART_TRACE_MAGIC
+	uint16_t version;      // CART_TRACE_VERSION
+	uint16_t nfiles;       // Number of interned filenames
+	uint64_t nrecords;     // Number of command records
+	uint64_t names_off;    // Offset of the filename table
+	uint64_t names_len;    // Length of the filename table in bytes
+	uint64_t records_off;  // Offset of the record array
+	uint64_t payload_off;  // Offset of the payload section
+	uint64_t payload_len;  // Length of the payload section in bytes
+} CartTraceHeader;
+
+// This is a single binary trace record
+typedef struct {
+	uint8_t  cmd;      // The command (CartSimCommand)
+	uint8_t  pad;      // Unused, zero
+	uint16_t fileid;   // Index into the filename table
+	int32_t  len;      // The length field
+	int32_t  off;      // The offset field
+} CartTraceRecord;
+
+// This is an in-memory binary trace under construction
+typedef struct {
+	char            *names;       // The filename table
+	uint64_t         names_len;   // Bytes used in the filename table
+	uint64_t         names_cap;   // Bytes allocated for the filename table
+	uint32_t        *name_index;  // Open-addressed index, entries are id+1
+	uint32_t        *name_offs;   // Table offset of each name, by id
+	uint32_t         nfiles;      // Number of interned filenames
+	CartTraceRecord *records;     // The record array
+	uint64_t         nrecords;    // Number of records
+	uint64_t         records_cap; // Records allocated
+	char            *payload;     // The payload section
+	uint64_t         payload_len; // Bytes used in the payload section
+	uint64_t         payload_cap; // Bytes allocated for the payload section
+} CartTraceWriter;
+
+// This is a memory-mapped binary trace
+typedef struct {
+	void                  *base;     // The mapping
+	size_t                 size;     // The size of the mapping
+	const CartTraceHeader *header;   // The trace header
+	const char           **names;    // Filenames, indexed by file id
+	const CartTraceRecord *records;  // The record array
+	const char            *payload;  // The payload section
+} CartTrace;
+
+//
+// Text workload interfaces
+
+int parse_workload_line(const char *line, int32_t llen, CartWorkloadLine *wl);
+	// Tokenize a single workload line
+
+void translate_payload(char *text, const char *src, int32_t len);
+	// Copy the payload, converting '^' markers to newlines
+
+uint32_t hash_workload_name(const char *fname);
+	// Hash a workload filename (FNV-1a)
+
+//
+// Binary trace interfaces
+
+int cart_trace_writer_init(CartTraceWriter *wr);
+	// Setup an empty trace writer
+
+int cart_trace_append(CartTraceWriter *wr, CartSimCommand cmd, const char *fname,
+		int32_t len, int32_t off, const char *payload);
+	// Add a command (and its translated payload for writes) to the trace
+
+int cart_trace_writer_finish(CartTraceWriter *wr, const char *binfile);
+	// Write the trace out to a file and release the writer
+
+void cart_trace_writer_release(CartTraceWriter *wr);
+	// Release a trace writer without writing it out
+
+int cart_trace_convert(const char *textfile, const char *binfile);
+	// Convert a text workload into the binary trace format
+
+int cart_trace_map(const char *binfile, CartTrace *trace);
+	// Map a binary trace into memory and check its layout
+
+int cart_trace_unmap(CartTrace *trace);
+	// Release a mapped binary trace
+
+#endif